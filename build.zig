@@ -15,19 +15,24 @@ pub fn build(b: *std.Build) void {
     // set a preferred release mode, allowing the user to decide how to optimize.
     const optimize = b.standardOptimizeOption(.{});
 
-    const lib = b.addStaticLibrary(.{
-        .name = "n",
-        // In this case the main source file is merely a path, however, in more
-        // complicated build scripts, this could be a generated file.
-        .root_source_file = b.path("src/root.zig"),
-        .target = target,
-        .optimize = optimize,
-    });
+    const build_options = b.addOptions();
+    build_options.addOption(
+        usize,
+        "max_velocity",
+        b.option(usize, "max-velocity", "Maximum Velocity") orelse 0,
+    );
+
+    build_options.addOption(
+        usize,
+        "vector_bits",
+        b.option(usize, "vector_bits", "Size of a vector") orelse 32,
+    );
 
-    // This declares intent for the library to be installed into the standard
-    // location when the user invokes the "install" step (the default step when
-    // running `zig build`).
-    b.installArtifact(lib);
+    build_options.addOption(
+        usize,
+        "prev_positions",
+        1 + (b.option(usize, "prev_positions", "Amnt of extra positions to store") orelse 4),
+    );
 
     const exe = b.addExecutable(.{
         .name = "n",
@@ -39,6 +44,7 @@ pub fn build(b: *std.Build) void {
     // This declares intent for the executable to be installed into the
     // standard location when the user invokes the "install" step (the default
     // step when running `zig build`).
+    exe.root_module.addOptions("build-options", build_options);
     b.installArtifact(exe);
 
     // This *creates* a Run step in the build graph, to be executed when another
@@ -66,19 +72,12 @@ pub fn build(b: *std.Build) void {
 
     // Creates a step for unit testing. This only builds the test executable
     // but does not run it.
-    const lib_unit_tests = b.addTest(.{
-        .root_source_file = b.path("src/root.zig"),
-        .target = target,
-        .optimize = optimize,
-    });
-
-    const run_lib_unit_tests = b.addRunArtifact(lib_unit_tests);
-
     const exe_unit_tests = b.addTest(.{
         .root_source_file = b.path("src/main.zig"),
         .target = target,
         .optimize = optimize,
     });
+    exe_unit_tests.root_module.addOptions("build-options", build_options);
 
     const run_exe_unit_tests = b.addRunArtifact(exe_unit_tests);
 
@@ -86,25 +85,46 @@ pub fn build(b: *std.Build) void {
     // the `zig build --help` menu, providing a way for the user to request
     // running the unit tests.
     const test_step = b.step("test", "Run unit tests");
-    test_step.dependOn(&run_lib_unit_tests.step);
     test_step.dependOn(&run_exe_unit_tests.step);
-    const build_options = b.addOptions();
-    exe.addOptions("build-options", build_options);
-    build_options.addOption(
-        usize,
-        "max_velocity",
-        b.option(usize, "max-velocity", "Maximum Velocity") orelse 0,
-    );
 
-    build_options.addOption(
-        usize,
-        "vector_bits",
-        b.option(usize, "vector_bits", "Size of a vector") orelse 32,
-    );
+    // The benchmarks are always built optimized, unless told otherwise, as
+    // debug numbers aren't worth comparing.
+    const bench = b.addExecutable(.{
+        .name = "labyrinth-bench",
+        .root_source_file = b.path("src/bench.zig"),
+        .target = target,
+        .optimize = b.option(std.builtin.OptimizeMode, "bench-optimize", "Optimization mode for `bench`") orelse .ReleaseFast,
+    });
+    bench.root_module.addOptions("build-options", build_options);
 
-    build_options.addOption(
-        usize,
-        "prev_positions",
-        1 + (b.option(usize, "prev_positions", "Amnt of extra positions to store") orelse 4),
-    );
+    // Every top-level `examples/*.lb`, plus fizzbuzz, is run; `bench.zig`
+    // adds its own synthetic mazes on top of them.
+    const run_bench = b.addRunArtifact(bench);
+    addBenchCorpus(b, run_bench) catch |err| std.debug.panic("unable to read examples: {}", .{err});
+    if (b.args) |args| run_bench.addArgs(args);
+
+    const bench_step = b.step("bench", "Run the benchmarks, printing JSON results");
+    bench_step.dependOn(&run_bench.step);
+}
+
+fn addBenchCorpus(b: *std.Build, run: *std.Build.Step.Run) !void {
+    var examples = try b.build_root.handle.openDir("examples", .{ .iterate = true });
+    defer examples.close();
+
+    var names = std.ArrayList([]const u8).init(b.allocator);
+    var iter = examples.iterate();
+    while (try iter.next()) |entry| {
+        if (entry.kind == .file and std.mem.endsWith(u8, entry.name, ".lb"))
+            try names.append(b.dupe(entry.name));
+    }
+
+    // Sort them so results are always in the same order.
+    std.mem.sort([]const u8, names.items, {}, struct {
+        fn lessThan(_: void, l: []const u8, r: []const u8) bool {
+            return std.mem.lessThan(u8, l, r);
+        }
+    }.lessThan);
+
+    for (names.items) |name| run.addFileArg(b.path(b.fmt("examples/{s}", .{name})));
+    run.addFileArg(b.path("examples/fizzbuzz/single-minotaur.lb"));
 }
@@ -3,132 +3,564 @@ const Allocator = std.mem.Allocator;
 const Value = @import("Value.zig");
 const IntType = @import("types.zig").IntType;
 const utils = @import("utils.zig");
-
+const MemStats = @import("MemStats.zig");
+
+/// Arrays are immutable and refcounted. Each one is one of:
+/// - `small`: up to `max_small_len` bytes stored inline; most strings are these.
+/// - `values`: a contiguous buffer of values. If it has an `owner`, it's a view into the owner's
+///   buffer, which is how slicing flat arrays is O(1).
+/// - `cons`: the concatenation of two other arrays. These form a balanced rope, so concatenating
+///   and slicing is O(log n).
 const Array = @This();
 
-refcount: u32 = 1,
-next: ?*Array = null,
-value: Value,
+pub const Tag = enum(u8) { small, values, cons };
+
+/// The longest byte strings that are stored inline.
+pub const max_small_len = 16;
+
+/// The deepest a rope can be; deeper ones are rebalanced.
+pub const max_depth = 48;
+
+/// Concatenations shorter than this are copied into a flat array instead of making a `cons`.
+const min_cons_len = 32;
 
-var _empty = Array{ .value = undefined };
+/// Short arrays appended to a rope are copied into its rightmost leaf until it's this long.
+const max_merged_leaf_len = 256;
+
+refcount: u32 = 1,
+tag: Tag,
+/// How deep the tree under a `cons` is; zero for everything else.
+depth: u8 = 0,
+len: usize,
+data: union {
+    small: [max_small_len]u8,
+    values: struct { ptr: [*]Value, owner: ?*Array },
+    cons: struct { left: *Array, right: *Array },
+},
+
+var _empty = Array{ .tag = .small, .len = 0, .data = .{ .small = undefined } };
 pub const empty: *Array = &_empty;
 
-/// Creates a new `Array` with no starting capacity.
-pub fn init(alloc: Allocator, value: Value) Allocator.Error!*Array {
-    var ary = try alloc.create(Array);
-    ary.* = .{ .value = value };
-    return ary;
+fn create(alloc: Allocator, ary: Array) Allocator.Error!*Array {
+    const scope = MemStats.enter(.array);
+    defer scope.leave();
+
+    const new = try alloc.create(Array);
+    new.* = ary;
+    MemStats.arrayCreated(new);
+    return new;
 }
 
-/// Deinitializes `ary`. `refcount` must be zero.
-pub fn deinit(ary: *Array, alloc: Allocator) void {
-    if (ary == empty) return;
+/// Creates an array out of the bytes in `string`.
+pub fn fromString(alloc: Allocator, string: []const u8) Allocator.Error!*Array {
+    if (string.len == 0) return empty;
 
-    std.debug.assert(ary.refcount == 0);
+    if (string.len <= max_small_len) {
+        var ary = Array{ .tag = .small, .len = string.len, .data = .{ .small = undefined } };
+        @memcpy(ary.data.small[0..string.len], string);
+        return create(alloc, ary);
+    }
 
-    if (ary.next) |next| next.decrement(alloc);
-    ary.value.deinit(alloc);
-    alloc.destroy(ary);
+    var builder = try Builder.initCapacity(alloc, string.len);
+    errdefer builder.deinit(alloc);
+    for (string) |byte| builder.appendAssumeCapacity(Value.from(byte));
+    return builder.finish(alloc);
 }
 
-pub fn prependNoIncrement(ary: *Array, alloc: Allocator, value: Value) Allocator.Error!*Array {
-    var new = try init(alloc, value);
-    new.next = ary;
-    return new;
-}
+/// Builds up a new array one value at a time.
+pub const Builder = struct {
+    values: std.ArrayListUnmanaged(Value) = .{},
+
+    pub fn initCapacity(alloc: Allocator, cap: usize) Allocator.Error!Builder {
+        const scope = MemStats.enter(.array);
+        defer scope.leave();
+        return .{ .values = try std.ArrayListUnmanaged(Value).initCapacity(alloc, cap) };
+    }
+
+    /// Deinitializes the builder and everything that's been added to it.
+    pub fn deinit(builder: *Builder, alloc: Allocator) void {
+        for (builder.values.items) |value| value.deinit(alloc);
+        builder.values.deinit(alloc);
+        builder.* = undefined;
+    }
+
+    /// Adds `value` to the end; the builder takes ownership of it.
+    pub fn append(builder: *Builder, alloc: Allocator, value: Value) Allocator.Error!void {
+        const scope = MemStats.enter(.array);
+        defer scope.leave();
+        try builder.values.append(alloc, value);
+    }
+
+    pub fn appendAssumeCapacity(builder: *Builder, value: Value) void {
+        builder.values.appendAssumeCapacity(value);
+    }
+
+    /// Adds a clone of every element of `ary` to the end.
+    pub fn appendArray(builder: *Builder, alloc: Allocator, ary: *const Array) Allocator.Error!void {
+        const scope = MemStats.enter(.array);
+        defer scope.leave();
+        try builder.values.ensureUnusedCapacity(alloc, ary.len);
+        var iterator = ary.iter();
+        while (iterator.next()) |value| builder.appendAssumeCapacity(value.clone());
+    }
+
+    /// Turns everything that's been added into an array, and frees the builder. On failure, the
+    /// builder is unchanged.
+    pub fn finish(builder: *Builder, alloc: Allocator) Allocator.Error!*Array {
+        const items = builder.values.items;
+        if (items.len == 0) {
+            builder.values.deinit(alloc);
+            builder.* = .{};
+            return empty;
+        }
+
+        const scope = MemStats.enter(.array);
+        defer scope.leave();
+        const new = try alloc.create(Array);
+        errdefer alloc.destroy(new);
+
+        if (fitsSmall(items)) {
+            new.* = .{ .tag = .small, .len = items.len, .data = .{ .small = undefined } };
+            for (new.data.small[0..items.len], items) |*byte, value| byte.* = @intCast(value.classify().int);
+            builder.values.deinit(alloc);
+        } else {
+            const owned = try builder.values.toOwnedSlice(alloc);
+            new.* = .{ .tag = .values, .len = owned.len, .data = .{ .values = .{ .ptr = owned.ptr, .owner = null } } };
+        }
+
+        builder.* = .{};
+        MemStats.arrayCreated(new);
+        return new;
+    }
+
+    pub fn fitsSmall(values: []const Value) bool {
+        if (max_small_len < values.len) return false;
+        for (values) |value| switch (value.classify()) {
+            .int => |int| if (std.math.cast(u8, int) == null) return false,
+            else => return false,
+        };
+        return true;
+    }
+};
+
+/// Frees `ary`. `refcount` must be zero.
+fn deinit(ary: *Array, alloc: Allocator) void {
+    std.debug.assert(ary.refcount == 0);
+    MemStats.arrayFreed(ary);
+
+    switch (ary.tag) {
+        .small => {},
+        .values => if (ary.data.values.owner) |owner| {
+            owner.decrement(alloc);
+        } else {
+            const values = ary.data.values.ptr[0..ary.len];
+            for (values) |value| value.deinit(alloc);
+            alloc.free(values);
+        },
+        .cons => {
+            ary.data.cons.left.decrement(alloc);
+            ary.data.cons.right.decrement(alloc);
+        },
+    }
 
-// pub fn perepend(ary: *Array, alloc: Allocator, value: Value) Allocator.Error!*Array {
-//     var new = try ary.prependNoIncrement(alloc, value);
-//     ary.increment();
-//     return new;
-// }
+    alloc.destroy(ary);
+}
 
 /// Increments the refcount by one.
+///
+/// Refcounts are atomic, as minotaurs sharing an array can be ticked on different threads.
 pub inline fn increment(ary: *Array) void {
-    if (ary == empty) {
-        ary.refcount +%= 1;
-    } else {
-        ary.refcount += 1;
-    }
+    if (ary == empty) return;
+    MemStats.count(.increments);
+    _ = @atomicRmw(u32, &ary.refcount, .Add, 1, .monotonic);
 }
 
 /// Decrements the refcount by one; if it reaches zero, the array is deallocated.
 pub fn decrement(ary: *Array, alloc: Allocator) void {
     if (ary == empty) return;
 
-    ary.refcount -= 1;
+    MemStats.count(.decrements);
+    if (@atomicRmw(u32, &ary.refcount, .Sub, 1, .acq_rel) == 1) ary.deinit(alloc);
+}
+
+/// Roughly how many bytes `ary` keeps alive, including the arrays and big integers it refers to.
+/// Each of them is split evenly between everything that refers to it at the time, so arrays that
+/// are shared aren't counted more than once in total.
+pub fn footprint(ary: *const Array) usize {
+    if (ary == empty) return 0;
+
+    var bytes: usize = @sizeOf(Array);
+    switch (ary.tag) {
+        .small => {},
+        .values => if (ary.data.values.owner) |owner| {
+            bytes += owner.footprint();
+        } else {
+            bytes += ary.len * @sizeOf(Value);
+            for (ary.data.values.ptr[0..ary.len]) |value| bytes += value.footprint();
+        },
+        .cons => bytes += ary.data.cons.left.footprint() + ary.data.cons.right.footprint(),
+    }
+    return bytes / @max(@atomicLoad(u32, &ary.refcount, .monotonic), 1);
+}
 
-    if (ary.refcount == 0) ary.deinit(alloc);
+pub inline fn isEmpty(ary: *const Array) bool {
+    return ary.len == 0;
 }
 
-pub fn cons(ary: *Array, alloc: Allocator, end: *Array) Allocator.Error!*Array {
-    // no need to decrement counts
-    if (ary.isEmpty()) return end;
-    if (end.isEmpty()) return ary;
-    _ = alloc;
+/// Returns whether the caller's reference is the only one to `ary`, so it can be changed in place
+/// without anything else noticing.
+pub inline fn isUnique(ary: *const Array) bool {
+    return ary != empty and @atomicLoad(u32, &ary.refcount, .acquire) == 1;
+}
 
-    return empty;
-    // var begin = Array.
-    // var begin = try ary.deepClone(alloc);
-    // const dup = try ary.deepClone(minotaur.allocator);
-    // var dup_iter = dup.iter();
+/// Gets the `idx`th element of a `small` or `values` array, without touching its refcount.
+inline fn leafGet(ary: *const Array, idx: usize) Value {
+    return switch (ary.tag) {
+        .small => Value.from(ary.data.small[idx]),
+        .values => ary.data.values.ptr[idx],
+        .cons => unreachable,
+    };
 }
-pub const Iterator = struct {
-    array: *const Array,
 
-    pub fn isDone(iterator: *const Iterator) bool {
-        return iterator.array.isEmpty();
+/// Gets the `idx`th element, without touching its refcount. `idx` must be in bounds.
+pub fn get(ary: *const Array, idx: usize) Value {
+    std.debug.assert(idx < ary.len);
+
+    var node = ary;
+    var i = idx;
+    while (node.tag == .cons) {
+        const left = node.data.cons.left;
+        if (i < left.len) {
+            node = left;
+        } else {
+            i -= left.len;
+            node = node.data.cons.right;
+        }
     }
 
-    pub fn next(iterator: *Iterator) ?Value {
-        if (iterator.isDone()) return null;
+    return node.leafGet(i);
+}
+
+/// Returns the elements `start..start+count`; they must be in bounds. This shares storage with
+/// `ary` rather than copying it, and is O(log n).
+pub fn slice(ary: *Array, alloc: Allocator, start: usize, count: usize) Allocator.Error!*Array {
+    std.debug.assert(start + count <= ary.len);
+
+    if (count == 0) return empty;
+    if (count == ary.len) {
+        ary.increment();
+        return ary;
+    }
+
+    switch (ary.tag) {
+        .small => return fromString(alloc, ary.data.small[start..][0..count]),
+        .values => {
+            const owner = ary.data.values.owner orelse ary;
+            const view = try create(alloc, .{
+                .tag = .values,
+                .len = count,
+                .data = .{ .values = .{ .ptr = ary.data.values.ptr + start, .owner = owner } },
+            });
+            owner.increment();
+            return view;
+        },
+        .cons => {
+            const left = ary.data.cons.left;
+            const right = ary.data.cons.right;
+
+            if (start + count <= left.len) return left.slice(alloc, start, count);
+            if (left.len <= start) return right.slice(alloc, start - left.len, count);
+
+            const begin = try left.slice(alloc, start, left.len - start);
+            defer begin.decrement(alloc);
+            const end = try right.slice(alloc, 0, start + count - left.len);
+            defer end.decrement(alloc);
+            return cons(alloc, begin, end);
+        },
+    }
+}
+
+/// Returns `ary` with everything after the first element.
+pub fn tail(ary: *Array, alloc: Allocator) Allocator.Error!*Array {
+    std.debug.assert(ary.len != 0);
+    return ary.slice(alloc, 1, ary.len - 1);
+}
+
+/// Like `tail`, but takes over the caller's reference to `ary`. If nothing else refers to it and
+/// it's stored inline, its bytes are shifted down in place.
+pub fn tailReusing(ary: *Array, alloc: Allocator) Allocator.Error!*Array {
+    std.debug.assert(ary.len != 0);
+    if (ary.tag == .small and 1 < ary.len and ary.isUnique()) {
+        std.mem.copyForwards(u8, ary.data.small[0 .. ary.len - 1], ary.data.small[1..ary.len]);
+        ary.len -= 1;
+        return ary;
+    }
+
+    defer ary.decrement(alloc);
+    return ary.tail(alloc);
+}
+
+/// Returns `begin` followed by `end`. Neither's refcount is consumed.
+pub fn cons(alloc: Allocator, begin: *Array, end: *Array) Allocator.Error!*Array {
+    if (begin.isEmpty()) {
+        end.increment();
+        return end;
+    }
+
+    if (end.isEmpty()) {
+        begin.increment();
+        return begin;
+    }
+
+    // Short concatenations are just copied, so ropes don't end up with lots of tiny leaves.
+    if (begin.len + end.len < min_cons_len) {
+        var builder = try Builder.initCapacity(alloc, begin.len + end.len);
+        errdefer builder.deinit(alloc);
+        try builder.appendArray(alloc, begin);
+        try builder.appendArray(alloc, end);
+        return builder.finish(alloc);
+    }
+
+    // Appending a bit at a time would otherwise hang a tiny leaf off the end each time, and need
+    // rebalancing every few dozen appends.
+    if (begin.tag == .cons and end.len < min_cons_len) {
+        if (try appendToRightmost(alloc, begin, end)) |merged| return merged;
+    }
 
-        defer if (iterator.array.next) |n| {
-            iterator.array = n;
+    const depth = @max(begin.depth, end.depth) + 1;
+    if (max_depth < depth) return rebalance(alloc, &.{ begin, end });
+
+    const new = try create(alloc, .{
+        .tag = .cons,
+        .depth = depth,
+        .len = begin.len + end.len,
+        .data = .{ .cons = .{ .left = begin, .right = end } },
+    });
+    begin.increment();
+    end.increment();
+    return new;
+}
+
+/// Returns `node` with `end` copied into its rightmost leaf, rebuilding the `cons`es down to it, or
+/// null if that leaf's too long already. Neither's refcount is consumed.
+fn appendToRightmost(alloc: Allocator, node: *Array, end: *Array) Allocator.Error!?*Array {
+    if (node.tag != .cons) {
+        if (max_merged_leaf_len < node.len + end.len) return null;
+
+        var builder = try Builder.initCapacity(alloc, node.len + end.len);
+        errdefer builder.deinit(alloc);
+        try builder.appendArray(alloc, node);
+        try builder.appendArray(alloc, end);
+        return try builder.finish(alloc);
+    }
+
+    const left = node.data.cons.left;
+    const right = try appendToRightmost(alloc, node.data.cons.right, end) orelse return null;
+    defer right.decrement(alloc);
+
+    const new = try create(alloc, .{
+        .tag = .cons,
+        .depth = @max(left.depth, right.depth) + 1,
+        .len = left.len + right.len,
+        .data = .{ .cons = .{ .left = left, .right = right } },
+    });
+    left.increment();
+    right.increment();
+    return new;
+}
+
+/// Like `cons`, but takes over the caller's reference to `begin`, even on failure. If nothing else
+/// refers to `begin` and the result's short enough to be copied anyways, `end` is appended to it in
+/// place.
+pub fn consReusing(alloc: Allocator, begin: *Array, end: *Array) Allocator.Error!*Array {
+    if (end.isEmpty()) return begin;
+
+    if (begin.len + end.len < min_cons_len and begin.isUnique()) {
+        const appended = begin.appendInPlace(alloc, end) catch |err| {
+            begin.decrement(alloc);
+            return err;
         };
+        if (appended) return begin;
+    }
 
-        return iterator.array.value;
+    defer begin.decrement(alloc);
+    return cons(alloc, begin, end);
+}
+
+/// Appends a clone of every element of `end` to `ary`, which nothing else refers to. Returns false
+/// without changing anything if it can't be done in place.
+fn appendInPlace(ary: *Array, alloc: Allocator, end: *const Array) Allocator.Error!bool {
+    const len = ary.len + end.len;
+
+    switch (ary.tag) {
+        .small => {
+            if (max_small_len < len) return false;
+            const bytes = ary.data.small[ary.len..len];
+            switch (end.tag) {
+                .small => @memcpy(bytes, end.data.small[0..end.len]),
+                .values => {
+                    const values = end.data.values.ptr[0..end.len];
+                    if (!Builder.fitsSmall(values)) return false;
+                    for (bytes, values) |*byte, value| byte.* = @intCast(value.classify().int);
+                },
+                .cons => return false,
+            }
+        },
+        .values => {
+            if (ary.data.values.owner != null) return false;
+
+            const scope = MemStats.enter(.array);
+            defer scope.leave();
+            const values = try alloc.realloc(ary.data.values.ptr[0..ary.len], len);
+            var iterator = end.iter();
+            for (values[ary.len..]) |*value| value.* = iterator.next().?.clone();
+            ary.data.values.ptr = values.ptr;
+        },
+        .cons => return false,
     }
-};
 
-pub inline fn iter(ary: *const Array) Iterator {
-    return .{ .array = ary };
+    // Arrays are only tracked if they're long enough when they're created, so check again.
+    const was_tracked = MemStats.tracked_len <= ary.len;
+    ary.len = len;
+    if (!was_tracked) MemStats.arrayCreated(ary);
+    return true;
 }
 
-pub fn reverse(ary: *const Array, alloc: Allocator) Allocator.Error!*Array {
-    var current = empty;
-    var iterator = ary.iter();
-    while (iterator.next()) |value| {
-        current = try current.prependNoIncrement(alloc, value.clone());
+/// Concatenates all of `arrays` into a balanced rope.
+fn rebalance(alloc: Allocator, arrays: []const *Array) Allocator.Error!*Array {
+    var leaves = std.ArrayList(*Array).init(alloc);
+    defer leaves.deinit();
+
+    for (arrays) |ary| try collectLeaves(ary, &leaves);
+    return buildBalanced(alloc, leaves.items);
+}
+
+fn collectLeaves(ary: *Array, leaves: *std.ArrayList(*Array)) Allocator.Error!void {
+    if (ary.tag != .cons) return leaves.append(ary);
+    try collectLeaves(ary.data.cons.left, leaves);
+    try collectLeaves(ary.data.cons.right, leaves);
+}
+
+fn buildBalanced(alloc: Allocator, leaves: []const *Array) Allocator.Error!*Array {
+    if (leaves.len == 1) {
+        leaves[0].increment();
+        return leaves[0];
     }
-    return current;
+
+    const left = try buildBalanced(alloc, leaves[0 .. leaves.len / 2]);
+    defer left.decrement(alloc);
+    const right = try buildBalanced(alloc, leaves[leaves.len / 2 ..]);
+    defer right.decrement(alloc);
+
+    const new = try create(alloc, .{
+        .tag = .cons,
+        .depth = @max(left.depth, right.depth) + 1,
+        .len = left.len + right.len,
+        .data = .{ .cons = .{ .left = left, .right = right } },
+    });
+    left.increment();
+    right.increment();
+    return new;
 }
 
-pub inline fn isEmpty(ary: *const Array) bool {
-    return ary == empty;
+/// Returns `ary` with `start..start+count` replaced by `replacement`, which must be in bounds.
+pub fn splice(ary: *Array, alloc: Allocator, start: usize, count: usize, replacement: *Array) Allocator.Error!*Array {
+    const begin = try ary.slice(alloc, 0, start);
+    defer begin.decrement(alloc);
+    const end = try ary.slice(alloc, start + count, ary.len - start - count);
+    defer end.decrement(alloc);
+
+    const middle = try cons(alloc, begin, replacement);
+    defer middle.decrement(alloc);
+    return cons(alloc, middle, end);
 }
 
-/// Returns how many elements are currently in the array.
-pub fn len(ary: *const Array) usize {
-    var iterator = ary.iter();
-    var l: usize = 0;
-    while (iterator.next() != null) l += 1;
-    return l;
+/// Walks over every element of an array, leaf by leaf.
+pub const Iterator = struct {
+    /// The right halves of `cons`es that haven't been visited yet.
+    pending: [max_depth + 1]*const Array = undefined,
+    pending_len: usize = 0,
+    leaf: *const Array,
+    index: usize = 0,
+
+    fn descend(iterator: *Iterator, start: *const Array) void {
+        var node = start;
+        while (node.tag == .cons) {
+            iterator.pending[iterator.pending_len] = node.data.cons.right;
+            iterator.pending_len += 1;
+            node = node.data.cons.left;
+        }
+
+        iterator.leaf = node;
+        iterator.index = 0;
+    }
+
+    pub fn next(iterator: *Iterator) ?Value {
+        while (iterator.index == iterator.leaf.len) {
+            if (iterator.pending_len == 0) return null;
+            iterator.pending_len -= 1;
+            iterator.descend(iterator.pending[iterator.pending_len]);
+        }
+
+        defer iterator.index += 1;
+        return iterator.leaf.leafGet(iterator.index);
+    }
+
+    /// Returns the rest of the current leaf as one contiguous run of values, without touching their
+    /// refcounts, and moves past it. The bytes of `small` leaves are expanded into `buffer`.
+    pub fn nextRun(iterator: *Iterator, buffer: *[max_small_len]Value) ?[]const Value {
+        while (iterator.index == iterator.leaf.len) {
+            if (iterator.pending_len == 0) return null;
+            iterator.pending_len -= 1;
+            iterator.descend(iterator.pending[iterator.pending_len]);
+        }
+
+        const leaf = iterator.leaf;
+        defer iterator.index = leaf.len;
+        return switch (leaf.tag) {
+            .small => {
+                const bytes = leaf.data.small[iterator.index..leaf.len];
+                for (buffer[0..bytes.len], bytes) |*value, byte| value.* = Value.from(byte);
+                return buffer[0..bytes.len];
+            },
+            .values => leaf.data.values.ptr[iterator.index..leaf.len],
+            .cons => unreachable,
+        };
+    }
+};
+
+pub fn iter(ary: *const Array) Iterator {
+    var iterator = Iterator{ .leaf = undefined };
+    iterator.descend(ary);
+    return iterator;
+}
+
+pub fn reverse(ary: *const Array, alloc: Allocator) Allocator.Error!*Array {
+    var builder = try Builder.initCapacity(alloc, ary.len);
+    errdefer builder.deinit(alloc);
+
+    var i = ary.len;
+    while (i != 0) {
+        i -= 1;
+        builder.appendAssumeCapacity(ary.get(i).clone());
+    }
+
+    return builder.finish(alloc);
 }
 
 /// Sees whether `ary` has the same elements as `other`.
 pub fn equals(ary: *const Array, other: *const Array) bool {
     if (ary == other) return true;
+    if (ary.len != other.len) return false;
 
     var liter = ary.iter();
     var riter = other.iter();
 
     while (liter.next()) |left| {
-        const right = riter.next() orelse return false;
-        if (!left.equals(right)) return false;
+        if (!left.equals(riter.next().?)) return false;
     }
 
-    return riter.next() == null;
+    return true;
 }
 
 /// Errors that can happen when `parseInt` is called.
@@ -164,37 +596,6 @@ pub fn parseInt(ary: *const Array) ParseIntError!IntType {
         }
     }
     return std.math.mul(IntType, int, sign orelse 1);
-
-    // if (ary.value.equals(minus)) {
-    //     sign = -1;
-    //     curr = curr.?.next;
-    // }
-
-    // while (if (curr == null) null else (curr orelse unreachable).next) |next| : (curr = next) {
-    //     switch (next.value.classify()) {
-    //         .int => |i| {
-    //             if (i < '0' or '9' < i) break;
-    //             int = try std.math.add(IntType, try std.math.mul(IntType, int, 10), i - '0');
-    //         },
-    //         else => return error.NotAnArrayOfInts,
-    //     }
-    // }
-
-    // return int * sign;
-}
-
-pub fn fromString(alloc: Allocator, string: []const u8) Allocator.Error!*Array {
-    var ary = Array.empty;
-    var idx = string.len; // TODO: std.mem.reverseIterator when it comes out.
-
-    while (true) {
-        idx -= 1;
-        const byte = string[idx];
-        ary = try ary.prependNoIncrement(alloc, Value.from(@as(IntType, @intCast(byte))));
-        if (idx == 0) break;
-    }
-
-    return ary;
 }
 
 pub fn format(
@@ -202,16 +603,17 @@ pub fn format(
     comptime fmt: []const u8,
     opts: std.fmt.FormatOptions,
     writer: anytype,
-) std.os.WriteError!void {
+) @TypeOf(writer).Error!void {
     const which = comptime utils.FmtEnum.mustFrom(fmt);
     var iterator = ary.iter();
+    var idx: usize = 0;
     switch (which) {
         .s, .d => {
-            while (iterator.next()) |value| {
+            while (iterator.next()) |value| : (idx += 1) {
                 try value.format(fmt, opts, writer);
                 switch (which) {
                     .s => if (value.classify() == .ary) try writer.writeByte('\n'),
-                    .d => if (!iterator.isDone()) try writer.writeByte(' '),
+                    .d => if (idx + 1 != ary.len) try writer.writeByte(' '),
                     .any => unreachable,
                 }
             }
@@ -219,10 +621,8 @@ pub fn format(
         .any => {
             try writer.writeByte('[');
 
-            var first = true;
-            while (iterator.next()) |value| {
-                if (!first) try writer.writeAll(", ");
-                first = false;
+            while (iterator.next()) |value| : (idx += 1) {
+                if (idx != 0) try writer.writeAll(", ");
                 try writer.print("{}", .{value});
             }
 
@@ -231,101 +631,142 @@ pub fn format(
     }
 }
 
-// const test_alloc = std.testing.allocator;
-// test "refcount defaults to 1, len starts as 0" {
-//     var ary = try Array.init(test_alloc);
-//     defer ary.decrement(test_alloc);
-
-//     try std.testing.expectEqual(@as(u32, 1), ary.refcount);
-//     try std.testing.expectEqual(@as(usize, 0), ary.len());
-// }
-
-// test "refcount works as expected" {
-//     var ary = try Array.init(test_alloc);
-
-//     try std.testing.expectEqual(@as(u32, 1), ary.refcount);
-//     ary.increment();
-//     try std.testing.expectEqual(@as(u32, 2), ary.refcount);
-//     ary.increment();
-//     try std.testing.expectEqual(@as(u32, 3), ary.refcount);
-
-//     ary.decrement(undefined);
-//     try std.testing.expectEqual(@as(u32, 2), ary.refcount);
-//     ary.decrement(undefined);
-//     try std.testing.expectEqual(@as(u32, 1), ary.refcount);
-//     ary.decrement(test_alloc);
-// }
+const test_alloc = std.testing.allocator;
 
-// test "deinit also deinits elements" {
-//     var ary = try Array.initCapacity(test_alloc, 4);
-//     var child = try Array.init(test_alloc);
-//     child.increment();
-
-//     try std.testing.expectEqual(@as(u32, 2), child.refcount);
-//     try ary.push(test_alloc, Value.from(child));
-//     ary.decrement(test_alloc);
-//     try std.testing.expectEqual(@as(u32, 1), child.refcount);
-//     child.decrement(test_alloc);
-// }
-
-// test "push, pop, and len work" {
-//     var ary = try Array.init(test_alloc);
-//     defer ary.decrement(test_alloc);
-
-//     try std.testing.expectEqual(@as(usize, 0), ary.len());
-
-//     try ary.push(test_alloc, Value.from(1));
-//     try std.testing.expectEqual(@as(usize, 1), ary.len());
+fn expectString(expected: []const u8, ary: *const Array) !void {
+    try std.testing.expectEqual(expected.len, ary.len);
+    for (expected, 0..) |byte, i|
+        try std.testing.expect(ary.get(i).equals(Value.from(byte)));
+}
 
-//     try ary.push(test_alloc, Value.from(2));
-//     try std.testing.expectEqual(@as(usize, 2), ary.len());
+test "short strings are stored inline" {
+    const ary = try fromString(test_alloc, "hello");
+    defer ary.decrement(test_alloc);
 
-//     try std.testing.expect(ary.pop().?.equals(Value.from(2)));
-//     try std.testing.expectEqual(@as(usize, 1), ary.len());
+    try std.testing.expectEqual(Tag.small, ary.tag);
+    try expectString("hello", ary);
+}
 
-//     try std.testing.expect(ary.pop().?.equals(Value.from(1)));
-//     try std.testing.expectEqual(@as(usize, 0), ary.len());
+test "cons and slice work across leaves" {
+    const begin = try fromString(test_alloc, "abcdefghijklmnopqrstuvwxyz");
+    defer begin.decrement(test_alloc);
+    const end = try fromString(test_alloc, "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    defer end.decrement(test_alloc);
 
-//     try std.testing.expectEqual(ary.pop(), null);
-// }
+    const both = try cons(test_alloc, begin, end);
+    defer both.decrement(test_alloc);
+    try std.testing.expectEqual(Tag.cons, both.tag);
+    try std.testing.expectEqual(@as(usize, 52), both.len);
 
-// test "arrays are equal" {
-//     var ary1 = try Array.init(test_alloc);
-//     defer ary1.decrement(test_alloc);
+    const middle = try both.slice(test_alloc, 24, 4);
+    defer middle.decrement(test_alloc);
+    try expectString("yzAB", middle);
 
-//     var ary2 = try Array.init(test_alloc);
-//     defer ary2.decrement(test_alloc);
+    const spliced = try both.splice(test_alloc, 1, 50, middle);
+    defer spliced.decrement(test_alloc);
+    try expectString("ayzABZ", spliced);
+}
 
-//     try std.testing.expect(ary1.equals(ary1));
-//     try std.testing.expect(ary1.equals(ary2));
+test "appending a byte at a time fills the rightmost leaf" {
+    const begin = try fromString(test_alloc, "abcdefghijklmnopqrstuvwxyz");
+    defer begin.decrement(test_alloc);
+    var rope = try cons(test_alloc, begin, begin);
+    defer rope.decrement(test_alloc);
+    const byte = try fromString(test_alloc, "!");
+    defer byte.decrement(test_alloc);
+
+    for (0..1000) |_| {
+        const longer = try cons(test_alloc, rope, byte);
+        rope.decrement(test_alloc);
+        rope = longer;
+    }
 
-//     try ary1.push(test_alloc, Value.from(1));
-//     try std.testing.expect(ary1.equals(ary1));
-//     try std.testing.expect(!ary1.equals(ary2));
+    try std.testing.expectEqual(@as(usize, 1052), rope.len);
+    try std.testing.expect(rope.depth < 8);
+    try std.testing.expect(rope.get(1051).equals(Value.from('!')));
+    try std.testing.expect(rope.get(51).equals(Value.from('z')));
+}
 
-//     try ary2.push(test_alloc, Value.from(1));
-//     try std.testing.expect(ary1.equals(ary2));
-// }
+test "reverse and equals" {
+    const ary = try fromString(test_alloc, "racecar, but longer than sixteen");
+    defer ary.decrement(test_alloc);
+    const rev = try ary.reverse(test_alloc);
+    defer rev.decrement(test_alloc);
+    const rev2 = try rev.reverse(test_alloc);
+    defer rev2.decrement(test_alloc);
 
-// test "parse int works" {
-//     var ary = try Array.init(test_alloc);
-//     defer ary.decrement(test_alloc);
+    try std.testing.expect(!ary.equals(rev));
+    try std.testing.expect(ary.equals(rev2));
+}
 
-//     try std.testing.expectEqual(@as(IntType, 0), try ary.parseInt());
+test "arrays nothing else refers to are reused in place" {
+    const ary = try fromString(test_alloc, "abc");
+    const end = try fromString(test_alloc, "de");
+    defer end.decrement(test_alloc);
+
+    const appended = try consReusing(test_alloc, ary, end);
+    try std.testing.expectEqual(ary, appended);
+    try expectString("abcde", appended);
+
+    // Once it's shared, it's copied instead.
+    appended.increment();
+    defer appended.decrement(test_alloc);
+    const rest = try appended.tailReusing(test_alloc);
+    try std.testing.expect(rest != appended);
+    try expectString("bcde", rest);
+
+    const shifted = try rest.tailReusing(test_alloc);
+    defer shifted.decrement(test_alloc);
+    try std.testing.expectEqual(rest, shifted);
+    try expectString("cde", shifted);
+
+    const doubled = try Value.mapReusing(Value.from(shifted).clone(), test_alloc, Value.from(2), .mul);
+    defer doubled.deinit(test_alloc);
+    try std.testing.expect(doubled.classify().ary != shifted);
+
+    var builder = try Builder.initCapacity(test_alloc, 20);
+    for (0..20) |i| builder.appendAssumeCapacity(Value.from(@as(IntType, @intCast(i)) * 100));
+    const big = try builder.finish(test_alloc);
+    const halved = try Value.mapReusing(Value.from(big), test_alloc, Value.from(2), .div);
+    defer halved.deinit(test_alloc);
+    try std.testing.expectEqual(big, halved.classify().ary);
+    try std.testing.expectEqual(@as(IntType, 950), try big.get(19).toInt());
+}
 
-//     try ary.push(test_alloc, Value.from('-'));
-//     try std.testing.expectEqual(@as(IntType, 0), try ary.parseInt());
-//     try ary.push(test_alloc, Value.from('1'));
-//     try std.testing.expectEqual(@as(IntType, -1), try ary.parseInt());
-//     try ary.push(test_alloc, Value.from('2'));
-//     try std.testing.expectEqual(@as(IntType, -12), try ary.parseInt());
-//     try ary.push(test_alloc, Value.from('a'));
-//     try std.testing.expectEqual(@as(IntType, -12), try ary.parseInt());
+test "mod by negative divisors floors through ropes and nested arrays" {
+    const begin = try fromString(test_alloc, "abcdefghijklmnopqrstuvwxyz");
+    defer begin.decrement(test_alloc);
+    const rope = try cons(test_alloc, begin, begin);
+    defer rope.decrement(test_alloc);
+
+    const modded = try Value.from(rope).mod(test_alloc, Value.from(-10));
+    defer modded.deinit(test_alloc);
+    for (0..rope.len) |i| {
+        const rem = @rem(try rope.get(i).toInt(), 10);
+        try std.testing.expectEqual(if (rem == 0) 0 else rem - 10, try modded.classify().ary.get(i).toInt());
+    }
 
-//     _ = ary.pop();
-//     var ary2 = try Array.init(test_alloc);
-//     defer ary2.decrement(test_alloc);
-//     try ary.push(test_alloc, Value.from(ary2));
+    var builder = try Builder.initCapacity(test_alloc, 2);
+    builder.appendAssumeCapacity(Value.from(-7));
+    builder.appendAssumeCapacity(Value.from(try fromString(test_alloc, "\x07")));
+    const nested = try builder.finish(test_alloc);
+    defer nested.decrement(test_alloc);
+
+    const nested_modded = try Value.from(nested).mod(test_alloc, Value.from(-3));
+    defer nested_modded.deinit(test_alloc);
+    const outer = nested_modded.classify().ary;
+    try std.testing.expectEqual(@as(IntType, -1), try outer.get(0).toInt());
+    try std.testing.expectEqual(@as(IntType, -2), try outer.get(1).classify().ary.get(0).toInt());
+
+    // The divisors can be the array too.
+    const divisors = try Value.from(7).mod(test_alloc, nested_modded);
+    defer divisors.deinit(test_alloc);
+    try std.testing.expectEqual(@as(IntType, 0), try divisors.classify().ary.get(0).toInt());
+    try std.testing.expectEqual(@as(IntType, -1), try divisors.classify().ary.get(1).classify().ary.get(0).toInt());
+}
 
-//     try std.testing.expectError(ParseIntError.NotAnArrayOfInts, ary.parseInt());
-// }
+test "parse int works" {
+    const ary = try fromString(test_alloc, " -12a");
+    defer ary.decrement(test_alloc);
+    try std.testing.expectEqual(@as(IntType, -12), try ary.parseInt());
+}
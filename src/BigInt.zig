@@ -0,0 +1,177 @@
+//! Integers that are too big to be stored inline in a `Value`, which ints are promoted to when
+//! arithmetic on them would overflow (see `Value.mapIt`).
+//!
+//! Like arrays, they're immutable and refcounted. Results that fit in an `IntType` are always
+//! demoted back to ints (see `normalize`), so each number only has one representation, and big
+//! integers are never zero.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const big = std.math.big.int;
+const Value = @import("Value.zig");
+const Array = @import("Array.zig");
+const kernels = @import("kernels.zig");
+const IntType = @import("types.zig").IntType;
+const BigInt = @This();
+
+pub const Limb = big.Limb;
+
+/// Enough limbs to hold any `IntType`.
+pub const IntLimbs = [big.calcTwosCompLimbCount(@typeInfo(IntType).Int.bits)]Limb;
+
+pub const Error = error{DivisionByZero} || Allocator.Error;
+
+refcount: u32 = 1,
+positive: bool,
+limbs: []const Limb,
+
+pub fn toConst(int: *const BigInt) big.Const {
+    return .{ .limbs = int.limbs, .positive = int.positive };
+}
+
+/// Returns `int` as a `big.Const`, using `limbs` as its storage.
+pub fn constFromInt(limbs: *IntLimbs, int: IntType) big.Const {
+    return big.Mutable.init(limbs, int).toConst();
+}
+
+/// Returns `num` as a value: an int if it fits in one, and a new big integer with a copy of its
+/// limbs otherwise.
+pub fn normalize(alloc: Allocator, num: big.Const) Allocator.Error!Value {
+    if (num.to(IntType)) |int| return Value.from(int) else |_| {}
+
+    const limbs = try alloc.dupe(Limb, num.limbs);
+    errdefer alloc.free(limbs);
+    const new = try alloc.create(BigInt);
+    new.* = .{ .positive = num.positive, .limbs = limbs };
+    return Value.from(new);
+}
+
+/// Increments the refcount by one. Like arrays', refcounts are atomic.
+pub inline fn increment(int: *BigInt) void {
+    _ = @atomicRmw(u32, &int.refcount, .Add, 1, .monotonic);
+}
+
+/// Decrements the refcount by one; if it reaches zero, `int` is freed.
+pub fn decrement(int: *BigInt, alloc: Allocator) void {
+    if (@atomicRmw(u32, &int.refcount, .Sub, 1, .acq_rel) != 1) return;
+
+    alloc.free(int.limbs);
+    alloc.destroy(int);
+}
+
+/// Does `op` to `lhs` and `rhs` the same way `kernels.apply` does to ints, except it can't
+/// overflow: `div` truncates, and `mod` takes the sign of `rhs`.
+pub fn apply(alloc: Allocator, comptime op: kernels.Op, lhs: big.Const, rhs: big.Const) Error!Value {
+    switch (op) {
+        .add, .sub => {
+            const limbs = try alloc.alloc(Limb, @max(lhs.limbs.len, rhs.limbs.len) + 1);
+            defer alloc.free(limbs);
+
+            var result = big.Mutable.init(limbs, 0);
+            if (op == .add) result.add(lhs, rhs) else result.sub(lhs, rhs);
+            return normalize(alloc, result.toConst());
+        },
+        .mul => {
+            const limbs = try alloc.alloc(Limb, lhs.limbs.len + rhs.limbs.len + 1);
+            defer alloc.free(limbs);
+
+            var result = big.Mutable.init(limbs, 0);
+            result.mul(lhs, rhs, &.{}, alloc);
+            return normalize(alloc, result.toConst());
+        },
+        .div, .mod => {
+            if (rhs.eqlZero()) return error.DivisionByZero;
+
+            // One allocation for the quotient, the remainder, and the scratch space.
+            const q_len = lhs.limbs.len + 1;
+            const r_len = rhs.limbs.len + 1;
+            const limbs = try alloc.alloc(Limb, q_len + r_len + big.calcDivLimbsBufferLen(lhs.limbs.len, rhs.limbs.len));
+            defer alloc.free(limbs);
+
+            var q = big.Mutable.init(limbs[0..q_len], 0);
+            var r = big.Mutable.init(limbs[q_len..][0..r_len], 0);
+            const buffer = limbs[q_len + r_len ..];
+            if (op == .div) q.divTrunc(&r, lhs, rhs, buffer) else q.divFloor(&r, lhs, rhs, buffer);
+            return normalize(alloc, if (op == .div) q.toConst() else r.toConst());
+        },
+    }
+}
+
+/// Parses `ary` like `Array.parseInt`, but without overflowing.
+pub fn parse(alloc: Allocator, ary: *const Array) (Array.ParseIntError || Allocator.Error)!Value {
+    var digits = std.ArrayList(u8).init(alloc);
+    defer digits.deinit();
+
+    var positive: ?bool = null;
+    var iterator = ary.iter();
+    while (iterator.next()) |val| {
+        const byte = switch (val.classify()) {
+            .int => |i| std.math.cast(u8, i) orelse break,
+            else => return error.NotAnArrayOfInts,
+        };
+
+        if (positive == null) {
+            if (std.ascii.isWhitespace(byte)) continue;
+            positive = byte != '-';
+            if (byte == '-') continue;
+        }
+
+        if (!std.ascii.isDigit(byte)) break;
+        try digits.append(byte);
+    }
+    if (digits.items.len == 0) return Value.from(0);
+
+    var result = try big.Managed.init(alloc);
+    defer result.deinit();
+    result.setString(10, digits.items) catch |err| return switch (err) {
+        error.InvalidCharacter, error.InvalidBase => unreachable,
+        else => |e| e,
+    };
+    result.setSign(positive orelse true);
+    return normalize(alloc, result.toConst());
+}
+
+/// Converts `int` to a string of its digits.
+pub fn toArray(int: *const BigInt, alloc: Allocator) Allocator.Error!*Array {
+    const string = try int.toConst().toStringAlloc(alloc, 10, .lower);
+    defer alloc.free(string);
+    return Array.fromString(alloc, string);
+}
+
+/// Prints `int` in decimal. The digits are worked out in a temporary buffer, which only falls back
+/// to the heap for numbers with thousands of digits.
+pub fn format(int: *const BigInt, writer: anytype) @TypeOf(writer).Error!void {
+    var fallback = std.heap.stackFallback(1024, std.heap.page_allocator);
+    const alloc = fallback.get();
+    const string = int.toConst().toStringAlloc(alloc, 10, .lower) catch return writer.writeAll("(BigInt)");
+    defer alloc.free(string);
+    try writer.writeAll(string);
+}
+
+test "overflowing ints are promoted, and demoted again once they fit" {
+    const alloc = std.testing.allocator;
+    const max = Value.from(@as(IntType, std.math.maxInt(IntType)));
+
+    const sum = try max.add(alloc, Value.from(1));
+    defer sum.deinit(alloc);
+    try std.testing.expect(sum.classify() == .big);
+    try std.testing.expectEqual(@as(IntType, 1), sum.cmp(max));
+
+    const square = try sum.mul(alloc, sum);
+    defer square.deinit(alloc);
+    const back = try square.div(alloc, sum);
+    defer back.deinit(alloc);
+    try std.testing.expect(back.equals(sum));
+
+    const less = try sum.sub(alloc, Value.from(1));
+    try std.testing.expect(less.equals(max));
+    try std.testing.expectEqual(@as(IntType, -5), try (try square.mod(alloc, Value.from(-7))).toInt());
+
+    const string = try square.toArray(alloc);
+    defer string.decrement(alloc);
+    try std.testing.expectEqual(@as(usize, 38), string.len);
+    const parsed = try Value.from(string).toNumber(alloc);
+    defer parsed.deinit(alloc);
+    try std.testing.expect(parsed.equals(square));
+    try std.testing.expectFmt("21267647932558653966460912964485513216", "{d}", .{square});
+}
@@ -5,6 +5,9 @@ const Labyrinth = @import("Labyrinth.zig");
 const Maze = @import("Maze.zig");
 const Array = @import("Array.zig");
 const Value = @import("Value.zig");
+const Output = @import("Output.zig");
+const checkpoint = @import("checkpoint.zig");
+const TimelineStore = @import("TimelineStore.zig");
 const utils = @import("utils.zig");
 
 iter: std.process.ArgIterator,
@@ -12,6 +15,17 @@ alloc: Allocator,
 options: Labyrinth.Options,
 filename: ?[]const u8 = null,
 expr: ?[]const u8 = null,
+/// The checkpoint to restore, instead of starting a maze from scratch.
+restore: ?[]const u8 = null,
+/// The jobs to run the maze against, instead of running it once; see `batch`.
+batch: ?[]const u8 = null,
+batch_results: []const u8 = "n.results.jsonl",
+/// The trace to play back, instead of running anything; see `replay`.
+replay: ?[]const u8 = null,
+/// The generation `replay` starts drawing at.
+seek: usize = 0,
+/// Whether `-t` was given; a batch runs a job per cpu at once otherwise.
+threads_given: bool = false,
 
 pub fn init(alloc: Allocator) !CommandLineArgs {
     var iter = try std.process.ArgIterator.initWithAllocator(alloc);
@@ -35,34 +49,29 @@ fn parseShebang(cla: *CommandLineArgs, file: *[]const u8) !void {
     if (file.len != 0 and file.*[0] == '\n') file.* = file.*[1..];
 }
 
-pub fn createLabyrinth(cla: *CommandLineArgs) !Labyrinth {
-    var maze: Maze = undefined;
-
-    if (cla.filename) |filename| {
-        var contents = try utils.readFile(cla.alloc, filename);
-        const orig_contents = contents;
-        defer cla.alloc.free(orig_contents);
+/// Creates the labyrinth, with everything it owns allocated by `alloc`.
+pub fn createLabyrinth(cla: *CommandLineArgs, alloc: Allocator) !Labyrinth {
+    if (cla.restore) |path| {
+        if (cla.filename != null or cla.expr != null)
+            cla.stop(.err, "`--restore` can't be given a filename or `-e` too", .{});
 
-        try cla.parseShebang(&contents);
-        maze = try Maze.init(cla.alloc, filename, contents);
-    } else if (cla.expr) |*expr| {
-        try cla.parseShebang(expr);
-        maze = try Maze.init(cla.alloc, "-e", expr.*);
-    } else {
-        cla.stop(.err, "either `-e` or a filename must be given", .{});
+        // The minotaur's arguments were saved along with the rest of its stack.
+        return checkpoint.restore(alloc, path, cla.options);
     }
 
-    var labyrinth = Labyrinth.init(cla.alloc, maze, cla.options) catch |err| {
-        maze.deinit(cla.alloc);
+    var maze = try cla.createMaze(alloc);
+    var labyrinth = Labyrinth.init(alloc, maze, cla.options) catch |err| {
+        maze.deinit(alloc);
         return err;
     };
     errdefer labyrinth.deinit();
 
     var iter = cla.iter;
     var minotaur = labyrinth.getMinotaur(0) catch unreachable;
+    defer labyrinth.setMinotaur(0, minotaur);
     while (iter.next()) |field| {
         const string = try Array.fromString(labyrinth.allocator, field);
-        errdefer string.deinit(labyrinth.allocator);
+        errdefer string.decrement(labyrinth.allocator);
 
         try minotaur.push(Value.from(string));
     }
@@ -70,6 +79,34 @@ pub fn createLabyrinth(cla: *CommandLineArgs) !Labyrinth {
     return labyrinth;
 }
 
+/// Reads the maze from the file or `-e` that was given.
+pub fn createMaze(cla: *CommandLineArgs, alloc: Allocator) !Maze {
+    var maze: Maze = undefined;
+
+    if (cla.filename) |filename| {
+        const source = try Maze.Source.read(alloc, filename);
+        errdefer source.deinit(alloc);
+
+        var contents = source.bytes();
+        try cla.parseShebang(&contents);
+        maze = try Maze.init(alloc, filename, contents);
+        maze.source = source;
+    } else if (cla.expr) |*expr| {
+        try cla.parseShebang(expr);
+        maze = try Maze.init(alloc, "-e", expr.*);
+    } else {
+        cla.stop(.err, "either `-e` or a filename must be given", .{});
+    }
+
+    return maze;
+}
+
+/// How many jobs a batch runs at once.
+pub fn batchThreads(cla: *const CommandLineArgs) u32 {
+    if (cla.threads_given) return cla.options.threads;
+    return @intCast(std.Thread.getCpuCount() catch 1);
+}
+
 pub fn deinit(cla: *CommandLineArgs) void {
     cla.iter.deinit();
     cla.* = undefined;
@@ -85,6 +122,25 @@ const Option = enum {
            @"--chdir",             // chdir to next argument before anything else
     @"-o", @"--output-maze",       // outputs maze at each step.
     @"-m", @"--output-minotaurs",  // outputs minotaurs at each step.
+           @"--fps",               // caps how many times a second the maze is output.
+    @"-t", @"--threads",           // splits generations across the next argument's amount of threads.
+           @"--flush",             // sets when output is flushed.
+           @"--alloc",             // sets what the labyrinth allocates with.
+           @"--no-traces",         // disables running straight-line cells ahead of time.
+           @"--checkpoint-every",  // saves a checkpoint every next argument's amount of generations.
+           @"--checkpoint-file",   // sets where checkpoints are saved.
+           @"--restore",           // restores the checkpoint in the next argument.
+           @"--timeline-cap",      // caps how many bytes timelines take up.
+           @"--timeline-policy",   // sets what happens to timelines past the cap.
+           @"--timeline-spill-file", // sets where timelines are spilled to.
+           @"--profile",           // profiles the program, writing the report to the next argument.
+           @"--mem-stats",         // counts allocations and refcounts, writing them to the next argument.
+           @"--merge",             // merges minotaurs that are indistinguishable from each other.
+           @"--batch",             // runs the maze once per job in the next argument.
+           @"--batch-results",     // sets where a batch's results are written.
+           @"--record",            // records a trace of every generation to the next argument.
+           @"--replay",            // plays back the trace in the next argument.
+           @"--seek",              // starts playing back a trace at the next argument's generation.
 };
 // zig fmt: on
 
@@ -111,6 +167,13 @@ fn nextPositional(cla: *CommandLineArgs, option: Option) []const u8 {
     };
 }
 
+fn nextInt(cla: *CommandLineArgs, comptime T: type, option: Option) T {
+    const arg = cla.nextPositional(option);
+    return std.fmt.parseInt(T, arg, 10) catch {
+        cla.stop(.err, "invalid integer for {s}: {s}", .{ @tagName(option), arg });
+    };
+}
+
 pub fn parse(cla: *CommandLineArgs) !void {
     while (cla.iter.next()) |flagname| {
         // ignore empty flags
@@ -137,9 +200,70 @@ pub fn parse(cla: *CommandLineArgs) !void {
             },
             .@"-o", .@"--output-maze" => cla.options.print_maze = true,
             .@"-m", .@"--output-minotaurs" => cla.options.print_minotaurs = true,
-            .@"--chdir" => try std.os.chdir(cla.nextPositional(option)),
+            .@"--fps" => cla.options.fps = switch (cla.nextInt(u32, option)) {
+                0 => cla.stop(.err, "--fps must be at least 1", .{}),
+                else => |n| n,
+            },
+            .@"--chdir" => try std.posix.chdir(cla.nextPositional(option)),
+            .@"-t", .@"--threads" => {
+                cla.options.threads = switch (cla.nextInt(u32, option)) {
+                    0 => @intCast(std.Thread.getCpuCount() catch 1),
+                    else => |n| n,
+                };
+                cla.threads_given = true;
+            },
+            .@"--flush" => {
+                const policy = cla.nextPositional(option);
+                cla.options.flush = Output.FlushPolicy.parse(policy) orelse
+                    cla.stop(.err, "invalid flush policy: {s}", .{policy});
+            },
+            .@"--alloc" => {
+                const kind = cla.nextPositional(option);
+                cla.options.allocator = std.meta.stringToEnum(Labyrinth.AllocatorKind, kind) orelse
+                    cla.stop(.err, "invalid allocator: {s}", .{kind});
+            },
+            .@"--no-traces" => cla.options.traces = false,
+            .@"--checkpoint-every" => cla.options.checkpoint_every = switch (cla.nextInt(usize, option)) {
+                0 => cla.stop(.err, "--checkpoint-every must be at least 1", .{}),
+                else => |n| n,
+            },
+            .@"--checkpoint-file" => cla.options.checkpoint_path = cla.nextPositional(option),
+            .@"--restore" => cla.restore = cla.nextPositional(option),
+            .@"--timeline-cap" => cla.options.timeline_cap = cla.nextInt(usize, option),
+            .@"--timeline-policy" => {
+                const policy = cla.nextPositional(option);
+                cla.options.timeline_policy = std.meta.stringToEnum(TimelineStore.Policy, policy) orelse
+                    cla.stop(.err, "invalid timeline policy: {s}", .{policy});
+            },
+            .@"--timeline-spill-file" => cla.options.timeline_spill_path = cla.nextPositional(option),
+            .@"--profile" => cla.options.profile_path = cla.nextPositional(option),
+            .@"--mem-stats" => cla.options.mem_stats_path = cla.nextPositional(option),
+            .@"--merge" => cla.options.merge_minotaurs = true,
+            .@"--batch" => cla.batch = cla.nextPositional(option),
+            .@"--batch-results" => cla.batch_results = cla.nextPositional(option),
+            .@"--record" => cla.options.record_path = cla.nextPositional(option),
+            .@"--replay" => cla.replay = cla.nextPositional(option),
+            .@"--seek" => cla.seek = cla.nextInt(usize, option),
         }
     }
+
+    if (cla.batch != null) cla.checkBatch();
+    if (cla.replay != null and (cla.filename != null or cla.expr != null or cla.restore != null))
+        cla.stop(.err, "`--replay` can't be given a filename, `-e`, or `--restore` too", .{});
+    if (cla.options.record_path != null and cla.options.debug)
+        cla.stop(.err, "`--record` can't be used with `-d`", .{});
+}
+
+/// Stops if anything was given that a batch's jobs can't do, as they'd all fight over the terminal
+/// or the same files.
+fn checkBatch(cla: *const CommandLineArgs) void {
+    const options = cla.options;
+    if (cla.restore != null) cla.stop(.err, "`--batch` can't be used with `--restore`", .{});
+    if (options.debug or options.print_maze or options.print_minotaurs)
+        cla.stop(.err, "`--batch` can't be used with `-d`, `-o`, or `-m`", .{});
+    if (options.checkpoint_every != null or options.profile_path != null or options.mem_stats_path != null or
+        options.record_path != null or options.timeline_policy == .spill)
+        cla.stop(.err, "`--batch` can't be used with checkpoints, profiling, `--mem-stats`, `--record`, or spilling timelines", .{});
 }
 
 const version = "1.0";
@@ -160,6 +284,32 @@ fn writeUsage(cla: *const CommandLineArgs) noreturn {
         \\     --chdir DIR  changes to DIR
         \\  -o --output-maze prints maze at each step
         \\  -m --output-minotaurs prints minotaurs too.
+        \\     --fps N      with -o, draws at most N frames a second, skipping generations between;
+        \\                  with --replay, plays N generations a second
+        \\  -t --threads N  splits each generation across N threads (0 for one per cpu)
+        \\     --flush WHEN flushes output each `line`, `tick`, at `exit`, or every WHEN bytes
+        \\     --alloc KIND allocates with `slab` (size-class slabs, the default) or `gpa`
+        \\     --no-traces  executes every cell one at a time, instead of running ahead
+        \\     --checkpoint-every N saves everything every N generations, to resume later
+        \\     --checkpoint-file FILE saves checkpoints to FILE (default `n.checkpoint`)
+        \\     --restore FILE resumes from the checkpoint in FILE; omit `filename`
+        \\     --timeline-cap BYTES caps roughly how much memory timelines (`B`, `b`, `V`) use
+        \\     --timeline-policy P past the cap, branching is an `error`, or the oldest timelines
+        \\                  are dropped (`evict`) or written to a file until travelled to (`spill`)
+        \\     --timeline-spill-file FILE spills timelines to FILE (default `n.timelines`)
+        \\     --profile FILE counts executions, forks, and slays per cell and time per kind of
+        \\                  function, writing them to FILE as JSON and a heat map to stderr
+        \\     --mem-stats FILE counts allocations by kind and function, refcounts, and the biggest
+        \\                  arrays, writing them to FILE as JSON and a summary to stderr at exit
+        \\                  (and to stderr on SIGUSR1)
+        \\     --merge      runs identical minotaurs once for all of them, printing what each would
+        \\     --batch FILE runs the maze once per line of FILE (`{{"args": [...]}}`), -t at a time
+        \\                  (default one per cpu), capturing what each prints
+        \\     --batch-results FILE writes each job's results to FILE (default `n.results.jsonl`)
+        \\     --record FILE writes what changes each generation (minotaurs, `set_at`, and output)
+        \\                  to FILE as a compact trace, without drawing anything
+        \\     --replay FILE draws the trace in FILE a generation at a time; omit `filename`
+        \\     --seek GEN   with --replay, skips ahead to generation GEN before drawing
         \\If a file is `-`, data is read from stdin.
         \\
     , .{ version, cla.options.program_name });
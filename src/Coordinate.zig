@@ -30,6 +30,6 @@ pub fn format(
     comptime _: []const u8,
     _: std.fmt.FormatOptions,
     writer: anytype,
-) std.os.WriteError!void {
+) @TypeOf(writer).Error!void {
     try writer.print("({d},{d})", .{ coord.x, coord.y });
 }
@@ -26,9 +26,9 @@ pub fn deinit(debugger: *Debugger) void {
 
 pub fn run(dbg: *Debugger) !void {
     const stdout = std.io.getStdOut().writer();
-    var stdin = std.io.getStdIn().reader();
-    var line_buf: [2048]u8 = undefined;
-    var context: Command.ParseContext = undefined;
+    const stdin = std.io.getStdIn().reader();
+    const line_buf: [2048]u8 = undefined;
+    const context: Command.ParseContext = undefined;
 
     while (!dbg.labyrinth.isDone()) {
         _ = stdin;
@@ -65,7 +65,7 @@ pub fn run(dbg: *Debugger) !void {
     }
 }
 pub const ArgParser = struct {
-    iter: std.mem.TokenIterator(u8),
+    iter: std.mem.TokenIterator(u8, .any),
     ctx: *Command.ParseContext,
     cmd_name: []const u8,
 
@@ -75,7 +75,7 @@ pub const ArgParser = struct {
     }
 
     pub fn init(line: []const u8, ctx: *Command.ParseContext) ?ArgParser {
-        var iter = std.mem.tokenize(u8, line, &std.ascii.whitespace);
+        var iter = std.mem.tokenizeAny(u8, line, &std.ascii.whitespace);
         const cmd_name = iter.next() orelse return null;
         return .{ .ctx = ctx, .iter = iter, .cmd_name = cmd_name };
     }
@@ -113,7 +113,7 @@ const Command = union(enum) {
         CantParseInt: std.fmt.ParseIntError,
 
         fn fail(ctx: *@This(), comptime err: ParseError, value: anytype) ParseError {
-            ctx.* = @unionInit(@This(), std.meta.tagName(err), value);
+            ctx.* = @unionInit(@This(), @errorName(err), value);
             return err;
         }
     };
@@ -173,7 +173,7 @@ const Command = union(enum) {
                 .velocity = try args.read(Vector),
             } },
             .sticky, .sk => .{ .sticky = b: {
-                var ptr = try alloc.create(Command);
+                const ptr = try alloc.create(Command);
                 errdefer alloc.destroy(ptr);
 
                 var argp2 = try args.initFromOld();
@@ -186,7 +186,10 @@ const Command = union(enum) {
     }
 
     pub fn run(command: Command, dbg: *Debugger) !void {
-        const stdout = dbg.labyrinth.stdout.writer();
+        const stdout = dbg.labyrinth.output.writer();
+        defer dbg.labyrinth.output.flush() catch {};
+        // `playGeneration` isn't called here, so this is where the scratch arena's reset instead.
+        defer _ = dbg.labyrinth.scratch.reset(.retain_capacity);
         switch (command) {
             .quit => unreachable, // should be handled in Debugger.run
             .noop => {},
@@ -199,11 +202,15 @@ const Command = union(enum) {
             },
             .step => |step| {
                 if (step.minotaur) |minotaur| {
-                    for (utils.range(step.amount)) |_|
-                        _ = try dbg.labyrinth.tickMinotaur(minotaur);
+                    for (utils.range(step.amount)) |_| {
+                        try dbg.labyrinth.tickMinotaur(minotaur);
+                        _ = dbg.labyrinth.scratch.reset(.retain_capacity);
+                    }
                 } else {
-                    for (utils.range(step.amount)) |_|
+                    for (utils.range(step.amount)) |_| {
                         try dbg.labyrinth.stepAllMinotaurs();
+                        _ = dbg.labyrinth.scratch.reset(.retain_capacity);
+                    }
                 }
             },
             .print => |info| {
@@ -217,6 +224,7 @@ const Command = union(enum) {
             },
             .jump_to => |jmp| {
                 var minotaur = try dbg.labyrinth.getMinotaur(jmp.id);
+                defer dbg.labyrinth.setMinotaur(jmp.id, minotaur);
                 minotaur.is_first = false;
                 if (jmp.position) |p| minotaur.jumpTo(p);
                 if (jmp.velocity) |v| minotaur.velocity = v;
@@ -0,0 +1,162 @@
+//! The side effects ticking minotaurs have on the rest of the `Labyrinth`.
+//!
+//! When a generation is ticked on one thread, maze writes, timelines, and output are applied
+//! straight away. When it's split across threads, each chunk of minotaurs gets its own buffered
+//! `Effects` instead, and the chunks are applied in order once every thread's done; this way the
+//! result is identical to ticking every minotaur in order on one thread.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Labyrinth = @import("Labyrinth.zig");
+const Minotaur = @import("Minotaur.zig");
+const Coordinate = @import("Coordinate.zig");
+const Output = @import("Output.zig");
+const Value = @import("Value.zig");
+const TimelineStore = @import("TimelineStore.zig");
+const Effects = @This();
+
+/// A buffered `set_at`.
+pub const Write = struct { pos: Coordinate, byte: u8 };
+
+/// A copy that was split off the merged minotaur `after` (see `Minotaur.tickMerged`).
+pub const Split = struct { after: Labyrinth.MinotaurId, minotaur: Minotaur };
+
+/// Whether maze writes, timelines, and output go straight to the labyrinth.
+immediate: bool,
+
+/// Minotaurs that were spawned; they join the labyrinth at the start of the next generation.
+spawned: Labyrinth.MinotaurList = .{},
+
+/// Copies that were split off merged minotaurs, in the order they were ticked. They join the
+/// labyrinth right after the minotaur they were split off, where they'd have been if they'd never
+/// been merged.
+split: std.ArrayListUnmanaged(Split) = .{},
+
+/// The minotaur that's being ticked.
+ticking: Labyrinth.MinotaurId = undefined,
+
+/// Buffered timelines, whose ids start at `first_timeline`.
+timelines: std.ArrayListUnmanaged(Minotaur) = .{},
+
+/// The id the first buffered timeline will have once it's been added to the labyrinth.
+first_timeline: usize = 0,
+
+/// Buffered `set_at`s, in the order they were executed.
+writes: std.ArrayListUnmanaged(Write) = .{},
+
+/// Buffered output.
+output: std.ArrayListUnmanaged(u8) = .{},
+
+/// The error the chunk stopped at, if any. Nothing after it was ticked.
+err: ?Minotaur.PlayError = null,
+
+/// Deinitializes `effects`, including any minotaurs which were never added to the labyrinth.
+pub fn deinit(effects: *Effects, alloc: Allocator) void {
+    effects.clear();
+    effects.spawned.deinit(alloc);
+    effects.split.deinit(alloc);
+    effects.timelines.deinit(alloc);
+    effects.writes.deinit(alloc);
+    effects.output.deinit(alloc);
+    effects.* = undefined;
+}
+
+/// Drops everything that's buffered, keeping the capacity around for the next generation.
+pub fn clear(effects: *Effects) void {
+    for (0..effects.spawned.len) |id| {
+        var minotaur = effects.spawned.get(id);
+        minotaur.deinit();
+    }
+    for (effects.split.items) |*split| split.minotaur.deinit();
+    for (effects.timelines.items) |*minotaur| minotaur.deinit();
+
+    effects.spawned.shrinkRetainingCapacity(0);
+    effects.split.clearRetainingCapacity();
+    effects.timelines.clearRetainingCapacity();
+    effects.writes.clearRetainingCapacity();
+    effects.output.clearRetainingCapacity();
+    effects.err = null;
+}
+
+/// Adds `minotaur` to the next generation.
+pub fn spawn(effects: *Effects, alloc: Allocator, minotaur: Minotaur) Allocator.Error!void {
+    try effects.spawned.append(alloc, minotaur);
+}
+
+/// Adds `minotaur` as a new timeline, returning its id.
+pub fn addTimeline(effects: *Effects, labyrinth: *Labyrinth, minotaur: Minotaur) TimelineStore.Error!usize {
+    if (effects.immediate) return labyrinth.addTimeline(minotaur);
+
+    const id = effects.first_timeline + effects.timelines.items.len;
+    try effects.timelines.append(labyrinth.allocator, minotaur);
+    return id;
+}
+
+/// Sets `pos` in the maze to `byte`.
+pub fn setAt(effects: *Effects, labyrinth: *Labyrinth, pos: Coordinate, byte: u8) Minotaur.PlayError!void {
+    if (effects.immediate) return labyrinth.setCell(pos, byte);
+    try effects.writes.append(labyrinth.allocator, .{ .pos = pos, .byte = byte });
+}
+
+/// Prints `args` with the format string `fmt` to the labyrinth's output.
+pub fn print(effects: *Effects, labyrinth: *Labyrinth, comptime fmt: []const u8, args: anytype) Output.Error!void {
+    if (effects.immediate) return labyrinth.output.writer().print(fmt, args);
+    try effects.bufferedWriter(labyrinth.allocator).print(fmt, args);
+}
+
+/// Prints `value` as a string to the labyrinth's output, optionally followed by a newline.
+pub fn printString(effects: *Effects, labyrinth: *Labyrinth, value: Value, newline: bool) Output.Error!void {
+    if (effects.immediate) {
+        try labyrinth.output.writeString(value);
+        if (newline) try labyrinth.output.writeAll("\n");
+        return;
+    }
+
+    try Output.encodeString(&effects.output, labyrinth.allocator, value);
+    if (newline) try effects.output.append(labyrinth.allocator, '\n');
+}
+
+const BufferedContext = struct { *Effects, Allocator };
+const BufferedWriter = std.io.Writer(BufferedContext, Output.Error, writeBuffered);
+
+// This uses `Output.Error` instead of just `Allocator.Error`, so that values can be formatted the same
+// way regardless of whether they're going to the labyrinth's output or to the buffer.
+fn bufferedWriter(effects: *Effects, alloc: Allocator) BufferedWriter {
+    return .{ .context = .{ effects, alloc } };
+}
+
+fn writeBuffered(context: BufferedContext, bytes: []const u8) Output.Error!usize {
+    try context[0].output.appendSlice(context[1], bytes);
+    return bytes.len;
+}
+
+/// Applies everything `effects` buffered to `labyrinth`, and then clears it.
+pub fn apply(effects: *Effects, labyrinth: *Labyrinth) Minotaur.PlayError!void {
+    std.debug.assert(!effects.immediate);
+    std.debug.assert(effects.first_timeline == labyrinth.timelines.len());
+
+    try labyrinth.output.writeAll(effects.output.items);
+
+    for (effects.writes.items) |write|
+        try labyrinth.setCell(write.pos, write.byte);
+
+    for (effects.timelines.items, 0..) |minotaur, idx| {
+        _ = labyrinth.addTimeline(minotaur) catch |err| {
+            for (effects.timelines.items[idx..]) |*rest| rest.deinit();
+            effects.timelines.clearRetainingCapacity();
+            return err;
+        };
+    }
+    effects.timelines.clearRetainingCapacity();
+
+    const spawned = &labyrinth.effects.spawned;
+    try spawned.ensureUnusedCapacity(labyrinth.allocator, effects.spawned.len);
+    for (0..effects.spawned.len) |id|
+        spawned.appendAssumeCapacity(effects.spawned.get(id));
+    effects.spawned.shrinkRetainingCapacity(0);
+
+    try labyrinth.effects.split.appendSlice(labyrinth.allocator, effects.split.items);
+    effects.split.clearRetainingCapacity();
+
+    effects.clear();
+}
@@ -2,6 +2,21 @@ const std = @import("std");
 const utils = @import("utils.zig");
 const Maze = @import("Maze.zig");
 const Minotaur = @import("Minotaur.zig");
+const Effects = @import("Effects.zig");
+const Function = @import("function.zig").Function;
+const Coordinate = @import("Coordinate.zig");
+const Output = @import("Output.zig");
+const TraceCache = @import("TraceCache.zig");
+const LiteralCache = @import("LiteralCache.zig");
+const Renderer = @import("Renderer.zig");
+const TimerWheel = @import("TimerWheel.zig");
+const TimelineStore = @import("TimelineStore.zig");
+const Profiler = @import("Profiler.zig");
+const MemStats = @import("MemStats.zig");
+const Recorder = @import("Recorder.zig");
+const Value = @import("Value.zig");
+const IntType = @import("types.zig").IntType;
+const checkpoint = @import("checkpoint.zig");
 const Allocator = std.mem.Allocator;
 const assert = std.debug.assert;
 
@@ -9,67 +24,211 @@ const Labyrinth = @This();
 
 pub const MinotaurId = usize;
 
+/// Minotaurs are stored struct-of-arrays, so passes which only need one field (eg sleep counters,
+/// exit statuses, or positions when printing) only touch that field's memory.
+pub const MinotaurList = std.MultiArrayList(Minotaur);
+
 maze: Maze,
 options: Options,
-minotaurs: std.ArrayListUnmanaged(*Minotaur),
-timelines: std.ArrayListUnmanaged(*Minotaur),
+/// The minotaurs in the current generation.
+minotaurs: MinotaurList = .{},
+/// The ids of the minotaurs that are awake this generation, in order. Only these are ticked.
+awake: std.ArrayListUnmanaged(MinotaurId) = .{},
+/// Where the next generation's `awake` is built up.
+next_awake: std.ArrayListUnmanaged(MinotaurId) = .{},
+/// Every minotaur that isn't in `awake`, by the generation they wake up in.
+sleepers: TimerWheel = .{},
+/// The minotaurs which exited this generation, in order.
+slain: std.ArrayListUnmanaged(MinotaurId) = .{},
+/// The minotaur that's being ticked; every minotaur before it has been ticked this generation.
+cursor: MinotaurId = std.math.maxInt(MinotaurId),
+/// The effects of ticking minotaurs on this thread. Minotaurs spawned during the current generation
+/// are kept in its `spawned`, and are moved into `minotaurs` once the generation's over.
+effects: Effects = .{ .immediate = true },
+/// The timelines minotaurs have branched off, which they can travel back to.
+timelines: TimelineStore,
 allocator: Allocator,
 exit_status: ?u8 = null,
 generation: usize = 0,
-stdout: std.fs.File,
-spawned_count: usize = 0,
-rng: std.rand.DefaultPrng,
+/// The generation a checkpoint was last saved or restored in, for `options.checkpoint_every`.
+last_checkpoint: usize = 0,
+/// Where everything minotaurs print goes.
+output: Output,
+rng: std.Random.DefaultPrng,
+/// Temporary allocations that only last for the current generation, such as render buffers. It's
+/// reset at the end of every generation.
+scratch: std.heap.ArenaAllocator,
+
+/// The threads generations are split across, if `options.threads` is more than one.
+pool: ?*std.Thread.Pool = null,
+/// The buffered effects of each chunk of minotaurs in a parallel generation.
+chunks: std.ArrayListUnmanaged(Effects) = .{},
+/// Where minotaurs are going to `set_at` during a parallel generation, and the first to write there.
+planned_writes: std.AutoHashMapUnmanaged(Coordinate, MinotaurId) = .{},
+/// Straight-line runs of cells that minotaurs can execute ahead of time.
+traces: TraceCache = .{},
+/// The string and integer literals in the maze, so minotaurs don't have to build them up each time.
+literals: LiteralCache = .{},
+/// Draws the maze each generation for `options.print_maze`.
+renderer: Renderer = .{},
+/// Counts what's executed where, for `options.profile_path`.
+profiler: ?Profiler = null,
+/// Records a trace of every generation for `options.record_path`, once `play` starts.
+recorder: ?Recorder = null,
+/// The minotaurs that were merged into earlier ones, while merging minotaurs.
+merged: std.ArrayListUnmanaged(MinotaurId) = .{},
+/// Where each of `effects.split` goes, while they're being put back in.
+split_at: std.ArrayListUnmanaged(MinotaurId) = .{},
 
 pub const Options = struct {
     print_maze: bool = false,
     print_minotaurs: bool = false,
     wait_for_user_input: bool = false,
     debug: bool = false,
-    sleep_ms: u32 = 10, //25,
+    /// With `print_maze`, the least amount of time between frames when `fps` isn't set.
+    sleep_ms: u32 = 20,
+    /// With `print_maze`, caps how many frames are drawn a second; generations in between aren't
+    /// drawn, and run as fast as they can.
+    fps: ?u32 = null,
     program_name: []const u8,
+    /// How many threads to split generations across.
+    threads: u32 = 1,
+    /// When output is flushed; `null` picks based on whether stdout's a terminal.
+    flush: ?Output.FlushPolicy = null,
+    /// What arrays, minotaurs, and the maze are allocated with.
+    allocator: AllocatorKind = .slab,
+    /// Where minotaurs print to; `null` means stdout.
+    output_file: ?std.fs.File = null,
+    /// Whether minotaurs can run straight-line cells ahead of time; see `TraceCache`. They never do
+    /// when debugging, or printing out the maze or minotaurs every generation.
+    traces: bool = true,
+    /// If set, the labyrinth is saved to `checkpoint_path` every this many generations; see
+    /// `checkpoint`.
+    checkpoint_every: ?usize = null,
+    checkpoint_path: []const u8 = "n.checkpoint",
+    /// If set, roughly how many bytes timelines can take up; see `TimelineStore`.
+    timeline_cap: ?usize = null,
+    /// What happens to older timelines once newer ones would take up more than `timeline_cap`.
+    timeline_policy: TimelineStore.Policy = .@"error",
+    /// Where timelines are spilled to with the `spill` policy.
+    timeline_spill_path: []const u8 = "n.timelines",
+    /// If set, what's executed where is counted, and written to this path as JSON once the program
+    /// exits; see `Profiler`. Generations aren't split across threads and traces aren't run while
+    /// profiling, so every cell's counted exactly when it's executed.
+    profile_path: ?[]const u8 = null,
+    /// If set, and the labyrinth's allocator is counting into `MemStats.active`, its report is
+    /// written to this path as JSON once the program exits; see `MemStats`.
+    mem_stats_path: ?[]const u8 = null,
+    /// If set, a trace of what changes each generation is written to this path while playing, which
+    /// `replay` can play back later; see `Recorder`. Traces aren't run while recording, so every
+    /// minotaur's where it says it is at the end of each generation.
+    record_path: ?[]const u8 = null,
+    /// Whether awake minotaurs that are indistinguishable from each other are merged into one
+    /// between generations; see `mergeMinotaurs`. They never are when debugging, printing out the
+    /// minotaurs every generation, or profiling.
+    merge_minotaurs: bool = false,
+};
+
+pub const AllocatorKind = enum {
+    /// Everything goes straight through the general purpose allocator.
+    gpa,
+    /// Small objects are allocated out of a `SlabAllocator` on top of the general purpose allocator.
+    slab,
 };
 
-pub fn init(alloc: Allocator, maze: Maze, options: Options) Allocator.Error!Labyrinth {
-    var minotaurs = try std.ArrayListUnmanaged(*Minotaur).initCapacity(alloc, 8);
+/// How many minotaurs each thread ticks at a time during a parallel generation.
+const chunk_size = 256;
+
+pub fn init(alloc: Allocator, maze: Maze, options: Options) !Labyrinth {
+    var minotaurs = MinotaurList{};
     errdefer minotaurs.deinit(alloc);
+    try minotaurs.ensureTotalCapacity(alloc, 8);
 
-    var timelines = try std.ArrayListUnmanaged(*Minotaur).initCapacity(alloc, 8);
+    var timelines = TimelineStore{ .cap = options.timeline_cap, .policy = options.timeline_policy };
     errdefer timelines.deinit(alloc);
+    if (options.timeline_policy == .spill) try timelines.openSpill(options.timeline_spill_path);
+
+    var awake = try std.ArrayListUnmanaged(MinotaurId).initCapacity(alloc, 8);
+    errdefer awake.deinit(alloc);
+    awake.appendAssumeCapacity(0);
 
     var minotaur = try Minotaur.initCapacity(alloc, 8);
     minotaur.is_first = true;
+    minotaurs.appendAssumeCapacity(minotaur);
     errdefer minotaur.deinit();
-    try minotaurs.append(alloc, minotaur);
+
+    var pool: ?*std.Thread.Pool = null;
+    if (1 < options.threads) {
+        pool = try alloc.create(std.Thread.Pool);
+        errdefer alloc.destroy(pool.?);
+        try pool.?.init(.{ .allocator = alloc, .n_jobs = options.threads });
+    }
 
     return Labyrinth{
         .maze = maze,
         .allocator = alloc,
         .minotaurs = minotaurs,
+        .awake = awake,
         .timelines = timelines,
+        .pool = pool,
         .options = options,
-        .stdout = std.io.getStdOut(),
-        .rng = std.rand.DefaultPrng.init(@as(u64, @intCast(std.time.milliTimestamp()))),
+        .output = Output.init(alloc, options.output_file orelse std.io.getStdOut(), options.flush),
+        .scratch = std.heap.ArenaAllocator.init(alloc),
+        .traces = .{ .enabled = options.traces and !options.debug and !options.print_maze and !options.print_minotaurs and
+            options.profile_path == null and options.record_path == null },
+        .renderer = .{ .fps = options.fps, .sleep_ms = options.sleep_ms },
+        .profiler = if (options.profile_path != null) .{} else null,
+        .rng = std.Random.DefaultPrng.init(@as(u64, @intCast(std.time.milliTimestamp()))),
     };
 }
 
 pub fn deinit(labyrinth: *Labyrinth) void {
+    labyrinth.output.deinit();
     labyrinth.maze.deinit(labyrinth.allocator);
 
-    for (labyrinth.minotaurs.items) |minotaur| minotaur.deinit();
-    for (labyrinth.timelines.items) |minotaur| minotaur.deinit();
+    if (labyrinth.pool) |pool| {
+        pool.deinit();
+        labyrinth.allocator.destroy(pool);
+    }
+
+    deinitAll(&labyrinth.minotaurs, &labyrinth.traces);
+    for (labyrinth.chunks.items) |*chunk| chunk.deinit(labyrinth.allocator);
 
     labyrinth.minotaurs.deinit(labyrinth.allocator);
+    labyrinth.awake.deinit(labyrinth.allocator);
+    labyrinth.next_awake.deinit(labyrinth.allocator);
+    labyrinth.sleepers.deinit(labyrinth.allocator);
+    labyrinth.slain.deinit(labyrinth.allocator);
+    labyrinth.effects.deinit(labyrinth.allocator);
     labyrinth.timelines.deinit(labyrinth.allocator);
+    labyrinth.chunks.deinit(labyrinth.allocator);
+    labyrinth.planned_writes.deinit(labyrinth.allocator);
+    labyrinth.scratch.deinit();
+    labyrinth.traces.deinit(labyrinth.allocator);
+    labyrinth.literals.deinit(labyrinth.allocator);
+    labyrinth.renderer.deinit(labyrinth.allocator);
+    labyrinth.merged.deinit(labyrinth.allocator);
+    labyrinth.split_at.deinit(labyrinth.allocator);
+    if (labyrinth.profiler) |*profiler| profiler.deinit(labyrinth.allocator);
+    if (labyrinth.recorder) |*recorder| recorder.deinit(labyrinth.allocator);
 
     labyrinth.* = undefined;
 }
 
+fn deinitAll(minotaurs: *MinotaurList, traces: *TraceCache) void {
+    for (0..minotaurs.len) |id| {
+        var minotaur = minotaurs.get(id);
+        if (minotaur.fused != null) minotaur.finishTrace(traces);
+        minotaur.deinit();
+    }
+}
+
 pub fn format(
     this: *const Labyrinth,
     comptime _: []const u8,
     _: std.fmt.FormatOptions,
     writer: anytype,
-) std.os.WriteError!void {
+) @TypeOf(writer).Error!void {
     try writer.writeAll("Labyrinth(");
     // if (this.options & 1 == 1) {
     //     try writer.writeAll("maze=");
@@ -78,77 +237,134 @@ pub fn format(
     // }
 
     try writer.writeAll("minotaurs=[");
-    for (this.minotaurs.items, 0..) |minotaur, idx| {
+    for (0..this.minotaurs.len) |idx| {
         if (idx != 0) try writer.writeAll(", ");
-        try writer.print("{}", .{minotaur});
+        try writer.print("{}", .{this.minotaurs.get(idx)});
     }
     try writer.writeAll("])");
 }
 
-pub fn addTimeline(labyrinth: *Labyrinth, minotaur: *Minotaur) Allocator.Error!usize {
-    const id = labyrinth.timelines.items.len;
-    try labyrinth.timelines.append(labyrinth.allocator, minotaur);
-    return id;
+pub fn addTimeline(labyrinth: *Labyrinth, minotaur: Minotaur) TimelineStore.Error!usize {
+    return labyrinth.timelines.add(labyrinth.allocator, minotaur);
 }
 
-pub fn getTimeline(labyrinth: *Labyrinth, id: usize) MinotaurGetError!*Minotaur {
-    if (labyrinth.timelines.items.len <= id) return error.MinotaurDoesntExist;
-    return labyrinth.timelines.items[id];
+pub fn getTimeline(labyrinth: *Labyrinth, id: usize) TimelineStore.Error!*Minotaur {
+    return labyrinth.timelines.get(labyrinth.allocator, id);
 }
 
-pub fn spawnMinotaur(this: *Labyrinth, minotaur: *Minotaur) Allocator.Error!void {
-    try this.minotaurs.append(this.allocator, minotaur);
-    this.spawned_count += 1;
+fn debugPrintMaze(this: *Labyrinth) !void {
+    // Make sure everything that was printed shows up before the maze does.
+    if (this.options.print_maze or this.options.print_minotaurs)
+        try this.output.flush();
+
+    if (!this.options.print_maze) {
+        var writer = std.io.getStdOut().writer();
+        if (this.options.print_minotaurs) {
+            try writer.writeAll("\n");
+            try this.printMinotaurs(writer);
+        }
+        return;
+    }
+
+    if (this.isDone() or this.renderer.isDue()) try this.drawFrame();
 }
 
-pub fn slayMinotaur(this: *Labyrinth, id: MinotaurId) MinotaurGetError!void {
-    if (this.minotaurs.items.len <= id) return error.MinotaurDoesntExist;
+/// Draws the maze, and the minotaurs if they're being printed too, with `renderer`.
+fn drawFrame(this: *Labyrinth) !void {
+    try this.settleAll();
+
+    var footer = std.ArrayList(u8).init(this.scratch.allocator());
+    if (this.options.print_minotaurs) try this.printMinotaurs(footer.writer());
+
+    try this.renderer.draw(this.allocator, .{
+        .generation = this.generation,
+        .maze = &this.maze,
+        .positions = this.minotaurs.items(.positions),
+        .colours = this.minotaurs.items(.colour),
+        .footer = footer.items,
+        .output_written = this.output.written,
+    }, std.io.getStdOut());
+}
 
-    const is_last = this.minotaurs.items.len == 1;
-    var minotaur = if (is_last) this.minotaurs.pop() else this.minotaurs.swapRemove(id);
-    if (is_last) this.exit_status = minotaur.exit_status;
-    minotaur.deinit();
+pub fn printMaze(this: *Labyrinth, writer: anytype) !void {
+    try this.settleAll();
+    try this.maze.printMaze(.{
+        .scratch = this.scratch.allocator(),
+        .positions = this.minotaurs.items(.positions),
+        .colours = this.minotaurs.items(.colour),
+    }, writer);
 }
 
-pub fn debugPrint(this: *const Labyrinth, writer: anytype) std.os.WriteError!void {
-    std.time.sleep(this.options.sleep_ms * 1_000_000);
-    try utils.clearScreen(writer);
-    try writer.print("tick {d}\n", .{this.generation});
-    try this.printMaze(writer);
+pub fn printMinotaurs(this: *Labyrinth, writer: anytype) !void {
+    try this.settleAll();
+    for (0..this.minotaurs.len) |i|
+        try writer.print("minotaur {d}: {}\n", .{ i, this.minotaurs.get(i) });
+}
 
-    if (this.options.print_minotaurs) {
-        try writer.writeAll("\n");
-        for (this.minotaurs.items, 0..) |minotaur, i|
-            try writer.print("minotaur {d}: {}\n", .{ i, minotaur });
+/// Sets the cell at `pos` to `byte`, invalidating any literals and traces that go through it. Minotaurs that are
+/// part way through one which haven't reached `pos` yet are settled, so they'll see the new cell.
+pub fn setCell(this: *Labyrinth, pos: Coordinate, byte: u8) Minotaur.PlayError!void {
+    try this.maze.set(this.allocator, pos, byte);
+    if (this.recorder) |*recorder| try recorder.wrote(this.allocator, pos, byte);
+    this.literals.invalidate(this.allocator, pos);
+    try this.traces.invalidate(this.allocator, pos, this.generation);
+    if (this.traces.inFlight() == 0) return;
+
+    const slice = this.minotaurs.slice();
+    for (slice.items(.fused), slice.items(.wake_at), 0..) |fused, wake_at, id| {
+        if (fused == null) continue;
+        const sleep_left = this.sleepLeft(id, wake_at);
+        if (sleep_left == 0) continue;
+
+        if (!TraceCache.covers(slice.get(id).pendingSteps(sleep_left), pos)) continue;
+        try this.settle(id, sleep_left);
     }
 }
 
-fn addNewMinotaurs(this: *Labyrinth) Allocator.Error!bool {
-    defer this.spawned_count = 0;
-    return this.spawned_count != 0;
-}
+/// Settles every minotaur that's part way through a trace, so their states can be looked at.
+pub fn settleAll(this: *Labyrinth) Minotaur.PlayError!void {
+    if (this.traces.inFlight() == 0) return;
 
-fn debugPrintMaze(this: *const Labyrinth) !void {
-    if (!this.options.print_maze) {
-        var writer = std.io.getStdOut().writer();
-        if (this.options.print_minotaurs) {
-            try writer.writeAll("\n");
-            for (this.minotaurs.items, 0..) |minotaur, i|
-                try writer.print("minotaur {d}: {}\n", .{ i, minotaur });
-        }
-        return;
+    const slice = this.minotaurs.slice();
+    for (slice.items(.fused), slice.items(.wake_at), 0..) |fused, wake_at, id| {
+        if (fused == null) continue;
+        const sleep_left = this.sleepLeft(id, wake_at);
+        if (sleep_left == 0) continue;
+
+        try this.settle(id, sleep_left);
     }
-    try this.debugPrint(std.io.getStdOut().writer());
-    std.time.sleep(this.options.sleep_ms * 1_000_000);
 }
 
-pub fn printMaze(this: *const Labyrinth, writer: anytype) !void {
-    try this.maze.printMaze(.{ .minotaurs = this.minotaurs.items }, writer);
+/// Settles minotaur `id`, and then wakes it up; if it hasn't had its turn this generation yet, it
+/// gets it.
+fn settle(this: *Labyrinth, id: MinotaurId, sleep_left: usize) Minotaur.PlayError!void {
+    {
+        var minotaur = this.minotaurs.get(id);
+        defer this.minotaurs.set(id, minotaur);
+        try minotaur.settle(this, sleep_left);
+    }
+
+    // Between generations, `awake` is already the next generation's.
+    const wake_ats = this.minotaurs.items(.wake_at);
+    if (this.cursor == std.math.maxInt(MinotaurId)) {
+        wake_ats[id] = this.generation + 1;
+        const idx = TimerWheel.countBelow(this.awake.items, id);
+        try this.awake.insert(this.allocator, idx, id);
+    } else if (id < this.cursor) {
+        wake_ats[id] = this.generation + 1;
+        try this.sleepers.insert(this.allocator, id, wake_ats[id]);
+    } else {
+        wake_ats[id] = this.generation;
+        const idx = TimerWheel.countBelow(this.awake.items, id);
+        try this.awake.insert(this.allocator, idx, id);
+    }
 }
 
-pub fn printMinotaurs(this: *const Labyrinth, writer: anytype) !void {
-    for (this.minotaurs.items, 0..) |minotaur, i|
-        try writer.print("minotaur {d}: {}\n", .{ i, minotaur });
+/// How many more generations minotaur `id`, which wakes up at `wake_at`, is going to sleep through,
+/// counting the current one if it hasn't had its turn yet.
+fn sleepLeft(this: *const Labyrinth, id: MinotaurId, wake_at: usize) usize {
+    const left = wake_at -| this.generation;
+    return if (id < this.cursor) left -| 1 else left;
 }
 
 pub fn isDone(this: *const Labyrinth) bool {
@@ -156,66 +372,602 @@ pub fn isDone(this: *const Labyrinth) bool {
 }
 
 pub const MinotaurGetError = error{MinotaurDoesntExist};
-pub fn getMinotaur(this: *Labyrinth, id: MinotaurId) MinotaurGetError!*Minotaur {
-    if (this.minotaurs.items.len <= id) return error.MinotaurDoesntExist;
-    return this.minotaurs.items[id];
+
+/// Returns a copy of the minotaur `id`. Changes to it must be stored back with `setMinotaur`.
+pub fn getMinotaur(this: *const Labyrinth, id: MinotaurId) MinotaurGetError!Minotaur {
+    if (this.minotaurs.len <= id) return error.MinotaurDoesntExist;
+    return this.minotaurs.get(id);
+}
+
+/// Stores `minotaur` back as minotaur `id`; `id` must have come from `getMinotaur`.
+pub fn setMinotaur(this: *Labyrinth, id: MinotaurId, minotaur: Minotaur) void {
+    this.minotaurs.set(id, minotaur);
 }
 
-// returns whether the minotaur is still alive.
-pub const TickResult = enum { slayed, spawned, alive };
-pub fn tickMinotaur(this: *Labyrinth, id: MinotaurId) !TickResult {
-    var minotaur = try this.getMinotaur(id);
-    try minotaur.tick(this);
+/// Ticks just the minotaur `id`, and then moves on to the next generation of minotaurs.
+pub fn tickMinotaur(this: *Labyrinth, id: MinotaurId) !void {
+    this.generation += 1;
 
-    if (!minotaur.hasExited()) {
-        return if (try this.addNewMinotaurs()) .spawned else .alive;
+    {
+        var minotaur = try this.getMinotaur(id);
+        defer this.setMinotaur(id, minotaur);
+        this.cursor = id;
+        defer this.cursor = std.math.maxInt(MinotaurId);
+        this.effects.ticking = id;
+        try minotaur.tick(this, &this.effects);
     }
 
-    this.slayMinotaur(id) catch unreachable; // we already validated it earlier.
-    return if (try this.addNewMinotaurs()) .alive else .slayed;
+    try this.nextGeneration();
 }
 
 pub fn stepAllMinotaurs(this: *Labyrinth) !void {
-    var minotaur_id: usize = 0;
-    var amnt_to_step = this.minotaurs.items.len;
-    var amnt_of_spawned_minotaurs: usize = 0;
-
     this.generation += 1;
-    // We have to be careful to not tick new minotaurs that have been added by previous minotaurs
-    // during this stepping process. Since Labyrinth makes no gaurantees about the execution order
-    // of minotaurs, we slay minotaurs by replacing them with the lastmost in the list (so we dont
-    // have to shift everything over each time). However, this means that we might have swapped
-    // a new minotaur over. We make sure we don't do this by keeping track of how many new minotaurs
-    // have spawned: If at least one is around, then we skip it and tick the next one.
-    while (minotaur_id < amnt_to_step) {
-        switch (try this.tickMinotaur(minotaur_id)) {
-            // If the minotaur is still alive, then just advance.
-            .alive => minotaur_id += 1,
-
-            // A new one was spawned, so we advance and incrmement the spawned count.
-            .spawned => {
-                minotaur_id += 1;
-                amnt_of_spawned_minotaurs += 1;
-            },
 
-            // The slain minotaur has been swapped with the last minotaur. So if that's
-            // a new minotaur, we skip over it, and decrement the amount of new minotaurs.
-            .slayed => if (amnt_of_spawned_minotaurs == 0) {
-                amnt_to_step -= 1;
-            } else {
-                // otherwise, we just swapped in a new minotaur, so we decrement the spawned count.
-                minotaur_id += 1;
-                amnt_of_spawned_minotaurs -= 1;
+    // Newborns are put in `effects.spawned` instead of `minotaurs`, so we only tick the minotaurs
+    // that were around at the start of the generation, and `minotaurs` isn't resized from under us.
+    if (this.pool != null and this.profiler == null and 2 * chunk_size <= this.awake.items.len and try this.planParallelGeneration()) {
+        try this.stepParallel();
+    } else {
+        var slice = this.minotaurs.slice();
+        defer this.cursor = std.math.maxInt(MinotaurId);
+        try this.tickRange(&slice, 0, std.math.maxInt(usize), &this.effects);
+    }
+
+    try this.nextGeneration();
+}
+
+/// Ticks the awake minotaurs in `awake[start..end]`, with their side effects going to `effects`.
+fn tickRange(
+    this: *Labyrinth,
+    slice: *MinotaurList.Slice,
+    start: usize,
+    end: usize,
+    effects: *Effects,
+) Minotaur.PlayError!void {
+    // Settling a minotaur can wake it up part way through a serial generation, adding it to `awake`
+    // (see `settle`), so the length is checked every time around.
+    var idx = start;
+    while (idx < @min(end, this.awake.items.len)) : (idx += 1) {
+        const id = this.awake.items[idx];
+        if (effects.immediate) this.cursor = id;
+        effects.ticking = id;
+
+        var minotaur = slice.get(id);
+        defer slice.set(id, minotaur);
+        try minotaur.tick(this, effects);
+    }
+}
+
+/// Returns whether `function` can be executed on another thread. Functions which touch shared state
+/// that can't be buffered in `Effects` (the rng, reading the maze or timelines, or dumping the
+/// labyrinth) have to be run on the main thread, in order.
+fn isParallelSafe(function: Function) bool {
+    return switch (function) {
+        .rand, .randdir, .get_at, .travel, .travelq, .foreign, .dump, .dumpq, .gets => false,
+        .ary, .ary_end, .slay1, .get, .set, .invalid => false,
+        else => true,
+    };
+}
+
+/// Figures out whether the upcoming generation can be split across threads and still behave the
+/// same as ticking every minotaur in order. If it can, `chunks` is set up for it.
+///
+/// Every minotaur's next function must be safe to run in parallel (see `isParallelSafe`). `set_at`s
+/// are allowed as long as no later minotaur reads the cell that's written, and timelines are given
+/// the ids they'd have if the minotaurs were ticked in order.
+fn planParallelGeneration(this: *Labyrinth) Allocator.Error!bool {
+    const slice = this.minotaurs.slice();
+    const awake = this.awake.items;
+    const n_chunks = std.math.divCeil(usize, awake.len, chunk_size) catch unreachable;
+
+    while (this.chunks.items.len < n_chunks)
+        try this.chunks.append(this.allocator, .{ .immediate = false });
+
+    this.planned_writes.clearRetainingCapacity();
+    var timelines = this.timelines.len();
+
+    for (awake, 0..) |id, idx| {
+        if (idx % chunk_size == 0) this.chunks.items[idx / chunk_size].first_timeline = timelines;
+
+        const minotaur = slice.get(id);
+        const peek = minotaur.peek(&this.maze) orelse return false;
+        const function = peek.function orelse continue;
+
+        switch (function) {
+            .branch, .branchl, .branchr => {
+                // Whether there's room for it depends on what was stored before it.
+                if (this.timelines.cap != null) return false;
+                // A merged minotaur's copies are split up, and each of them branches.
+                timelines += minotaur.copies;
             },
+            .set_at => {
+                const pos = minotaur.peekSetAt() orelse return false;
+                const entry = try this.planned_writes.getOrPut(this.allocator, pos);
+                if (!entry.found_existing) entry.value_ptr.* = id;
+            },
+            else => if (!isParallelSafe(function)) return false,
         }
     }
+
+    if (this.planned_writes.count() == 0) return true;
+
+    // Minotaurs that are part way through a trace might have to be settled when a cell's written,
+    // which is only exact if it happens in the order minotaurs are ticked.
+    if (this.traces.inFlight() != 0) return false;
+
+    // Make sure nothing reads a cell that an earlier minotaur's going to write to.
+    for (awake) |id| {
+        const peek = slice.get(id).peek(&this.maze).?; // we peeked it above.
+        const writer = this.planned_writes.get(peek.pos) orelse continue;
+        if (writer < id) return false;
+    }
+
+    return true;
+}
+
+/// Ticks the current generation across `pool`, after `planParallelGeneration` said it's ok, and
+/// then applies each chunk's effects in order.
+fn stepParallel(this: *Labyrinth) !void {
+    const pool = this.pool.?;
+    const slice = this.minotaurs.slice();
+    const n_chunks = std.math.divCeil(usize, this.awake.items.len, chunk_size) catch unreachable;
+
+    var next_chunk = std.atomic.Value(usize).init(0);
+    var wait_group = std.Thread.WaitGroup{};
+
+    for (0..@min(n_chunks, this.options.threads)) |_| {
+        wait_group.start();
+        pool.spawn(parallelWorker, .{ this, slice, n_chunks, &next_chunk, &wait_group }) catch |err| {
+            wait_group.finish();
+            wait_group.wait();
+            return err;
+        };
+    }
+
+    wait_group.wait();
+
+    for (this.chunks.items[0..n_chunks], 0..) |*chunk, i| {
+        const err = chunk.err;
+        try chunk.apply(this);
+
+        if (err) |e| {
+            for (this.chunks.items[i + 1 .. n_chunks]) |*rest| rest.clear();
+            return e;
+        }
+    }
+}
+
+/// Ticks chunks of minotaurs until there's none left. Chunks are handed out one at a time, so
+/// threads that finish early keep on taking work from the rest.
+fn parallelWorker(
+    this: *Labyrinth,
+    slice_: MinotaurList.Slice,
+    n_chunks: usize,
+    next_chunk: *std.atomic.Value(usize),
+    wait_group: *std.Thread.WaitGroup,
+) void {
+    defer wait_group.finish();
+    var slice = slice_;
+
+    while (true) {
+        const chunk = next_chunk.fetchAdd(1, .monotonic);
+        if (n_chunks <= chunk) return;
+
+        const effects = &this.chunks.items[chunk];
+        const start = chunk * chunk_size;
+        this.tickRange(&slice, start, start + chunk_size, effects) catch |err| {
+            effects.err = err;
+        };
+    }
+}
+
+/// Parks every awake minotaur that's fallen asleep, wakes up the ones that are due next generation,
+/// and slays every minotaur that's exited, compacting the survivors down. Then puts the copies that
+/// were split off merged minotaurs back in after them, and adds in all the minotaurs that were
+/// spawned during this generation.
+///
+/// Only awake minotaurs can have done anything, so sleepers aren't touched unless something exited.
+fn nextGeneration(this: *Labyrinth) Allocator.Error!void {
+    const alloc = this.allocator;
+    const next = this.generation + 1;
+    const slice = this.minotaurs.slice();
+    const exit_statuses = slice.items(.exit_status);
+    const wake_ats = slice.items(.wake_at);
+    var last_exit_status: ?u8 = null;
+    var last_slain: ?MinotaurId = null;
+
+    this.slain.clearRetainingCapacity();
+    this.next_awake.clearRetainingCapacity();
+    for (this.awake.items) |id| {
+        if (exit_statuses[id]) |status| {
+            try this.slain.append(alloc, id);
+            last_exit_status = status;
+            last_slain = id;
+        } else if (next < wake_ats[id]) {
+            try this.sleepers.insert(alloc, id, wake_ats[id]);
+        } else {
+            try this.next_awake.append(alloc, id);
+        }
+    }
+
+    try mergeInto(alloc, &this.next_awake, try this.sleepers.wake(alloc, next, wake_ats));
+
+    // Copies that exited are slain straight away. They had their turn right after the minotaur they
+    // were split off, so their exit status only wins over the ones after that.
+    const split = &this.effects.split;
+    var kept: usize = 0;
+    for (split.items) |*copy| {
+        if (copy.minotaur.exit_status) |status| {
+            if (last_slain == null or last_slain.? <= copy.after) last_exit_status = status;
+            copy.minotaur.deinit();
+            continue;
+        }
+
+        split.items[kept] = copy.*;
+        kept += 1;
+    }
+    split.shrinkRetainingCapacity(kept);
+
+    this.removeMinotaurs(this.slain.items, &this.next_awake);
+    try this.insertSplit(next);
+    this.traces.collect(alloc, this.generation);
+
+    const spawned = &this.effects.spawned;
+    try this.minotaurs.ensureUnusedCapacity(alloc, spawned.len);
+    if (this.recorder) |*recorder| try recorder.spawned(alloc, spawned.len);
+    for (0..spawned.len) |idx| {
+        const minotaur = spawned.get(idx);
+        const id = this.minotaurs.len;
+        this.minotaurs.appendAssumeCapacity(minotaur);
+
+        if (next < minotaur.wake_at) {
+            try this.sleepers.insert(alloc, id, minotaur.wake_at);
+        } else {
+            try this.next_awake.append(alloc, id);
+        }
+    }
+    spawned.shrinkRetainingCapacity(0);
+
+    std.mem.swap(std.ArrayListUnmanaged(MinotaurId), &this.awake, &this.next_awake);
+    try this.mergeMinotaurs();
+
+    // The program's over once the last minotaur has been slain.
+    if (this.minotaurs.len == 0) this.exit_status = last_exit_status orelse 0;
+}
+
+/// Deinitializes the minotaurs `ids`, which are sorted, and compacts the rest down. `sleepers` and
+/// `awake_ids` are renumbered to match, leaving out `ids`.
+fn removeMinotaurs(this: *Labyrinth, ids: []const MinotaurId, awake_ids: *std.ArrayListUnmanaged(MinotaurId)) void {
+    if (ids.len == 0) return;
+
+    var slice = this.minotaurs.slice();
+    var alive = ids[0];
+    var dead: usize = 0;
+
+    for (ids[0]..slice.len) |id| {
+        if (dead < ids.len and ids[dead] == id) {
+            var minotaur = slice.get(id);
+            if (minotaur.fused != null) minotaur.finishTrace(&this.traces);
+            minotaur.deinit();
+            dead += 1;
+            continue;
+        }
+
+        slice.set(alive, slice.get(id));
+        alive += 1;
+    }
+
+    this.minotaurs.shrinkRetainingCapacity(alive);
+    this.sleepers.removeIds(ids);
+    if (this.recorder) |*recorder| recorder.removed(ids);
+
+    var kept: usize = 0;
+    for (awake_ids.items) |id| {
+        const below = TimerWheel.countBelow(ids, id);
+        if (below < ids.len and ids[below] == id) continue;
+
+        awake_ids.items[kept] = id - below;
+        kept += 1;
+    }
+    awake_ids.shrinkRetainingCapacity(kept);
+}
+
+/// Puts each of `effects.split` in right after the minotaur it was split off, once `slain` have
+/// been removed, renumbering everything after it, and parks it or wakes it for `next`.
+fn insertSplit(this: *Labyrinth, next: usize) Allocator.Error!void {
+    const split = &this.effects.split;
+    if (split.items.len == 0) return;
+    const alloc = this.allocator;
+
+    // Where each copy goes, as the id of the minotaur it goes in front of. That's the one after the
+    // minotaur it was split off, which has moved down past the ones that were slain before it.
+    const at = &this.split_at;
+    at.clearRetainingCapacity();
+    try at.ensureTotalCapacity(alloc, split.items.len);
+    for (split.items) |copy| at.appendAssumeCapacity(copy.after + 1 - TimerWheel.countBelow(this.slain.items, copy.after + 1));
+
+    try this.minotaurs.ensureUnusedCapacity(alloc, split.items.len);
+    if (this.recorder) |*recorder| try recorder.inserted(alloc, at.items);
+
+    // Move everything up from the back, so nothing's overwritten before it's moved.
+    const old_len = this.minotaurs.len;
+    this.minotaurs.resize(alloc, old_len + split.items.len) catch unreachable;
+    var slice = this.minotaurs.slice();
+    var src = old_len;
+    var dst = slice.len;
+    var i = split.items.len;
+    while (i != 0) {
+        i -= 1;
+        while (at.items[i] < src) {
+            src -= 1;
+            dst -= 1;
+            slice.set(dst, slice.get(src));
+        }
+        dst -= 1;
+        slice.set(dst, split.items[i].minotaur);
+    }
+
+    for (this.next_awake.items) |*id| id.* += TimerWheel.countBelow(at.items, id.* + 1);
+    this.sleepers.shiftIds(at.items);
+
+    // The copies that are awake are collected over `at`, which is done with, to be merged in.
+    var woken: usize = 0;
+    for (split.items, 0..) |copy, idx| {
+        const id = at.items[idx] + idx;
+        if (next < copy.minotaur.wake_at) {
+            try this.sleepers.insert(alloc, id, copy.minotaur.wake_at);
+        } else {
+            at.items[woken] = id;
+            woken += 1;
+        }
+    }
+    try mergeInto(alloc, &this.next_awake, at.items[0..woken]);
+    split.clearRetainingCapacity();
+}
+
+/// Merges every awake minotaur that's indistinguishable from the one right before it into that
+/// one, for `options.merge_minotaurs`, adding its `copies` to the earlier one's. A merged minotaur
+/// ticks once for all its copies, printing what each of them would've (see
+/// `Minotaur.isReplayable`), so a fork storm that keeps making the same minotaurs over and over
+/// doesn't have to tick them all.
+///
+/// Only neighbours are merged, so the copies would've had their turns one after another anyway,
+/// and everything comes out in the same order. Copies that are split off again go back in the same
+/// place (see `Effects.split`).
+fn mergeMinotaurs(this: *Labyrinth) Allocator.Error!void {
+    if (!this.options.merge_minotaurs or this.options.debug or this.options.print_minotaurs or this.profiler != null) return;
+
+    const alloc = this.allocator;
+    const slice = this.minotaurs.slice();
+    const copies = slice.items(.copies);
+
+    this.merged.clearRetainingCapacity();
+    // The minotaur that the run of indistinguishable ones ending at `prev` is being merged into.
+    var into: ?MinotaurId = null;
+    var prev: ?MinotaurId = null;
+    for (this.awake.items) |id| {
+        defer prev = id;
+        const minotaur = slice.get(id);
+
+        // A sleeper in between has its turn between them, so they aren't neighbours.
+        if (into != null and prev.? + 1 == id and slice.get(into.?).isIndistinguishable(&minotaur)) {
+            if (std.math.add(usize, copies[into.?], copies[id])) |sum| {
+                copies[into.?] = sum;
+                try this.merged.append(alloc, id);
+                continue;
+            } else |_| {}
+        }
+        into = id;
+    }
+
+    this.removeMinotaurs(this.merged.items, &this.awake);
+}
+
+/// Merges `ids` into `list`, which are both sorted, leaving out any that are already in it.
+fn mergeInto(alloc: Allocator, list: *std.ArrayListUnmanaged(MinotaurId), ids: []const MinotaurId) Allocator.Error!void {
+    if (ids.len == 0) return;
+    try list.ensureUnusedCapacity(alloc, ids.len);
+
+    // Merge from the back, so nothing has to be moved twice.
+    var left = list.items.len;
+    var right = ids.len;
+    var out = left + right;
+    list.items.len = out;
+
+    while (right != 0) {
+        out -= 1;
+        if (left != 0 and ids[right - 1] <= list.items[left - 1]) {
+            if (ids[right - 1] == list.items[left - 1]) right -= 1;
+            list.items[out] = list.items[left - 1];
+            left -= 1;
+        } else {
+            list.items[out] = ids[right - 1];
+            right -= 1;
+        }
+    }
+
+    // Duplicates leave a gap at the front.
+    if (out != left) {
+        std.mem.copyForwards(MinotaurId, list.items[left..], list.items[out..]);
+        list.items.len -= out - left;
+    }
+}
+
+/// Rebuilds `awake` and `sleepers` from each minotaur's `wake_at`, between generations. This is how
+/// a labyrinth that's been restored from a checkpoint picks up where it left off.
+pub fn reschedule(this: *Labyrinth) Allocator.Error!void {
+    this.awake.clearRetainingCapacity();
+    this.sleepers.deinit(this.allocator);
+    this.sleepers = .{};
+
+    const next = this.generation + 1;
+    for (this.minotaurs.items(.wake_at), 0..) |wake_at, id| {
+        if (next < wake_at) {
+            try this.sleepers.insert(this.allocator, id, wake_at);
+        } else {
+            try this.awake.append(this.allocator, id);
+        }
+    }
+}
+
+/// When every minotaur's asleep, skips ahead to the generation before the next one wakes up.
+fn fastForward(this: *Labyrinth) Allocator.Error!void {
+    if (this.awake.items.len != 0) return;
+    const wake_at = this.sleepers.next(this.generation) orelse return;
+
+    this.generation = wake_at - 1;
+    try mergeInto(this.allocator, &this.awake, try this.sleepers.wake(this.allocator, wake_at, this.minotaurs.items(.wake_at)));
 }
 
 pub fn play(this: *Labyrinth) !void {
+    if (this.options.record_path) |path| try this.startRecording(path);
     try this.debugPrintMaze();
 
     while (!this.isDone()) {
-        try this.stepAllMinotaurs();
-        try this.debugPrintMaze();
+        try this.playGeneration();
+        try this.maybeCheckpoint();
+    }
+
+    try this.output.flush();
+    if (this.recorder) |*recorder| try recorder.flush();
+    if (this.options.print_maze) try this.renderer.finish(std.io.getStdOut());
+    if (this.profiler) |*profiler| try this.writeProfile(profiler, this.options.profile_path.?);
+    if (this.options.mem_stats_path) |path| if (MemStats.active) |stats| try writeMemStats(stats, path);
+}
+
+/// Starts recording to `path`, with a first frame that has the minotaurs as they are now.
+fn startRecording(this: *Labyrinth, path: []const u8) !void {
+    const file = try std.fs.cwd().createFile(path, .{});
+    this.recorder = Recorder.init(this.allocator, file, &this.maze, this.generation, this.minotaurs.len) catch |err| {
+        file.close();
+        return err;
+    };
+    this.output.tee = .{};
+    try this.recorder.?.frame(this.allocator, this.generation, this.minotaurs.slice(), "");
+}
+
+/// Writes the current generation's frame, with everything that's been printed since the last one.
+fn recordFrame(this: *Labyrinth) !void {
+    if (this.recorder) |*recorder| {
+        const printed = &this.output.tee.?;
+        try recorder.frame(this.allocator, this.generation, this.minotaurs.slice(), printed.items);
+        printed.clearRetainingCapacity();
+    }
+}
+
+/// Writes `profiler`'s report to `path`, and draws its heat map to stderr.
+fn writeProfile(this: *Labyrinth, profiler: *const Profiler, path: []const u8) !void {
+    const scratch = this.scratch.allocator();
+    {
+        const file = try std.fs.cwd().createFile(path, .{});
+        defer file.close();
+
+        var buffered = std.io.bufferedWriter(file.writer());
+        try profiler.writeJson(scratch, this.generation, buffered.writer());
+        try buffered.flush();
+    }
+
+    var stderr = std.io.bufferedWriter(std.io.getStdErr().writer());
+    try this.maze.printMaze(.{ .scratch = scratch, .highlights = try profiler.heatMap(scratch) }, stderr.writer());
+    try stderr.flush();
+}
+
+/// Writes `stats`' report to `path`, and a summary of it to stderr.
+fn writeMemStats(stats: *MemStats, path: []const u8) !void {
+    {
+        const file = try std.fs.cwd().createFile(path, .{});
+        defer file.close();
+
+        var buffered = std.io.bufferedWriter(file.writer());
+        try stats.writeJson(buffered.writer());
+        try buffered.flush();
     }
+
+    var stderr = std.io.bufferedWriter(std.io.getStdErr().writer());
+    try stats.writeText(stderr.writer());
+    try stderr.flush();
+}
+
+/// Saves a checkpoint if it's been `options.checkpoint_every` generations since the last one.
+fn maybeCheckpoint(this: *Labyrinth) !void {
+    const every = this.options.checkpoint_every orelse return;
+    if (this.isDone() or this.generation - this.last_checkpoint < every) return;
+
+    try checkpoint.save(this, this.options.checkpoint_path);
+    this.last_checkpoint = this.generation;
+}
+
+/// Plays one generation of `play`, including everything that's done between generations.
+pub fn playGeneration(this: *Labyrinth) !void {
+    try this.fastForward();
+    try this.stepAllMinotaurs();
+    try this.recordFrame();
+    try this.output.endTick();
+    try this.debugPrintMaze();
+    if (MemStats.active) |stats| try stats.endGeneration();
+    _ = this.scratch.reset(.retain_capacity);
+}
+
+/// Makes a labyrinth that merges minotaurs and keeps what they print, with a minotaur at the start
+/// of `source` for each of `tops`, which has it on its stack twice.
+fn initTest(source: []const u8, tops: []const u8) !Labyrinth {
+    const alloc = std.testing.allocator;
+    var labyrinth = try Labyrinth.init(alloc, try Maze.init(alloc, "test", source), .{
+        .program_name = "test",
+        .flush = .capture,
+        .traces = false,
+        .merge_minotaurs = true,
+    });
+    errdefer labyrinth.deinit();
+
+    labyrinth.minotaurs.items(.is_first)[0] = false;
+    for (tops, 0..) |top, id| {
+        var minotaur = if (id == 0) try labyrinth.getMinotaur(0) else try Minotaur.initCapacity(alloc, 2);
+        try minotaur.push(Value.from(top));
+        try minotaur.push(Value.from(top));
+        if (id == 0) labyrinth.setMinotaur(0, minotaur) else try labyrinth.minotaurs.append(alloc, minotaur);
+    }
+    try labyrinth.reschedule();
+    return labyrinth;
+}
+
+test "only neighbours are merged, so output stays in order" {
+    var apart = try initTest(" ppQ", "aba");
+    defer apart.deinit();
+    try apart.stepAllMinotaurs();
+    try std.testing.expectEqual(@as(usize, 3), apart.minotaurs.len);
+    try apart.stepAllMinotaurs();
+    try std.testing.expectEqualStrings("abaaba", apart.output.buffer.items);
+
+    var together = try initTest(" ppQ", "aab");
+    defer together.deinit();
+    try together.stepAllMinotaurs();
+    try std.testing.expectEqual(@as(usize, 2), together.minotaurs.len);
+    try std.testing.expectEqual(@as(usize, 2), together.minotaurs.items(.copies)[0]);
+    try together.stepAllMinotaurs();
+    try std.testing.expectEqualStrings("aabaab", together.output.buffer.items);
+}
+
+test "copies split off before branching go back in order, with timelines of their own" {
+    var labyrinth = try initTest(" BQ", "xy");
+    defer labyrinth.deinit();
+    labyrinth.minotaurs.items(.copies)[0] = 3;
+    try labyrinth.stepAllMinotaurs();
+
+    try std.testing.expectEqual(@as(usize, 4), labyrinth.minotaurs.len);
+    for (labyrinth.minotaurs.items(.stack), labyrinth.minotaurs.items(.copies), 0..) |*stack, copies, id| {
+        try std.testing.expectEqual(@as(usize, 1), copies);
+        try std.testing.expectEqual(@as(IntType, @intCast(id)), try stack.peek(0).toInt());
+        try std.testing.expectEqual(@as(IntType, if (id < 3) 'x' else 'y'), try stack.peek(1).toInt());
+    }
+}
+
+test "merged minotaurs spawn merged minotaurs" {
+    var labyrinth = try initTest(" OQ", "a");
+    defer labyrinth.deinit();
+    labyrinth.minotaurs.items(.copies)[0] = 2;
+    try labyrinth.stepAllMinotaurs();
+
+    try std.testing.expectEqual(@as(usize, 2), labyrinth.minotaurs.len);
+    try std.testing.expectEqualSlices(usize, &.{ 2, 2 }, labyrinth.minotaurs.items(.copies));
 }
@@ -0,0 +1,206 @@
+//! Interns the string and integer literals in the maze, so minotaurs don't build them up one cell at
+//! a time every time they go over one.
+//!
+//! Literals are scanned ahead of time, from the cell they start at in the direction they're read.
+//! A minotaur reading one still spends a tick on each of its cells, but all it does is count them
+//! down and then push the shared value (see `Minotaur.Mode.literal`). When one of a literal's cells
+//! is changed, it's invalidated, and minotaurs part way through it go back to reading the rest of
+//! it one cell at a time.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Coordinate = @import("Coordinate.zig");
+const Vector = @import("Vector.zig");
+const Value = @import("Value.zig");
+const Array = @import("Array.zig");
+const Maze = @import("Maze.zig");
+const IntType = @import("types.zig").IntType;
+const LiteralCache = @This();
+
+/// Literals with more cells than this are read one cell at a time.
+pub const max_len = 4096;
+
+pub const Key = struct { pos: Coordinate, velocity: Vector };
+
+pub const Literal = struct {
+    refcount: u32 = 1,
+    /// Cleared once one of the literal's cells has changed.
+    valid: bool = true,
+    kind: Kind,
+    /// What the literal pushes, which every minotaur reading it shares.
+    value: Value,
+    /// A string's contents, or all of an integer's digits.
+    bytes: []const u8,
+    start: Coordinate,
+    velocity: Vector,
+
+    pub const Kind = enum { string, integer };
+
+    pub fn increment(literal: *Literal) void {
+        _ = @atomicRmw(u32, &literal.refcount, .Add, 1, .monotonic);
+    }
+
+    pub fn decrement(literal: *Literal, alloc: Allocator) void {
+        if (@atomicRmw(u32, &literal.refcount, .Sub, 1, .acq_rel) != 1) return;
+
+        literal.value.deinit(alloc);
+        alloc.free(literal.bytes);
+        alloc.destroy(literal);
+    }
+
+    /// How many cells the literal is read from, including the opening quote or first digit. Strings
+    /// include their closing quote, and integers include the cell after them, as it's executed on
+    /// the same tick the integer's pushed.
+    pub fn cellCount(literal: *const Literal) usize {
+        return switch (literal.kind) {
+            .string => literal.bytes.len + 2,
+            .integer => literal.bytes.len + 1,
+        };
+    }
+
+    fn covers(literal: *const Literal, pos: Coordinate) bool {
+        var cell = literal.start;
+        for (0..literal.cellCount()) |_| {
+            if (cell.x == pos.x and cell.y == pos.y) return true;
+            cell = cell.moveBy(literal.velocity) catch return false;
+        }
+        return false;
+    }
+};
+
+/// Every literal that's been scanned, or `null` where scanning one failed (because it's too long,
+/// or would've run into an error).
+literals: std.AutoHashMapUnmanaged(Key, ?*Literal) = .{},
+/// The cells that are covered by any literal in `literals`. It may contain cells that no longer are.
+covered: std.AutoHashMapUnmanaged(Coordinate, void) = .{},
+/// How many entries in `literals` are `null`; they're all dropped whenever the maze changes.
+failures: usize = 0,
+
+pub fn deinit(cache: *LiteralCache, alloc: Allocator) void {
+    var iter = cache.literals.valueIterator();
+    while (iter.next()) |literal| if (literal.*) |l| l.decrement(alloc);
+
+    cache.literals.deinit(alloc);
+    cache.covered.deinit(alloc);
+    cache.* = undefined;
+}
+
+/// Gets the literal starting at `key`, without scanning it if it's not there. This is safe to call
+/// from multiple threads at once, as long as nothing's modifying the cache.
+pub fn get(cache: *const LiteralCache, key: Key) ?*Literal {
+    return cache.literals.get(key) orelse null;
+}
+
+/// Gets the literal starting at `key`, scanning it if it hasn't been yet.
+pub fn getOrScan(cache: *LiteralCache, alloc: Allocator, maze: *const Maze, key: Key) Allocator.Error!?*Literal {
+    const entry = try cache.literals.getOrPut(alloc, key);
+    if (entry.found_existing) return entry.value_ptr.*;
+    errdefer cache.literals.removeByPtr(entry.key_ptr);
+
+    const literal = try scan(alloc, maze, key) orelse {
+        entry.value_ptr.* = null;
+        cache.failures += 1;
+        return null;
+    };
+    errdefer literal.decrement(alloc);
+
+    try cache.covered.ensureUnusedCapacity(alloc, @intCast(literal.cellCount()));
+    var cell = literal.start;
+    for (0..literal.cellCount()) |_| {
+        cache.covered.putAssumeCapacity(cell, {});
+        cell = cell.moveBy(literal.velocity) catch break;
+    }
+
+    entry.value_ptr.* = literal;
+    return literal;
+}
+
+/// Reads the literal starting at `key` out of `maze`, the same way a minotaur would. Returns `null`
+/// if a minotaur would run into an error part way through it, or it's longer than `max_len`.
+fn scan(alloc: Allocator, maze: *const Maze, key: Key) Allocator.Error!?*Literal {
+    const first = maze.getFunction(key.pos) orelse return null;
+    const kind: Literal.Kind = if (first == .str) .string else if (first.toDigit() != null) .integer else return null;
+
+    var bytes = std.ArrayListUnmanaged(u8){};
+    defer bytes.deinit(alloc);
+    if (kind == .integer) try bytes.append(alloc, maze.get(key.pos).?);
+
+    var pos = key.pos;
+    while (true) {
+        if (max_len <= bytes.items.len) return null;
+        pos = pos.moveBy(key.velocity) catch return null;
+        const function = maze.getFunction(pos) orelse return null;
+
+        const done = switch (kind) {
+            .string => function == .str,
+            .integer => function.toDigit() == null,
+        };
+        if (done) break;
+        try bytes.append(alloc, maze.get(pos).?);
+    }
+
+    const value = switch (kind) {
+        .string => Value.from(try Array.fromString(alloc, bytes.items)),
+        .integer => Value.from(std.fmt.parseInt(IntType, bytes.items, 10) catch return null),
+    };
+    errdefer value.deinit(alloc);
+
+    const literal = try alloc.create(Literal);
+    literal.* = .{
+        .kind = kind,
+        .value = value,
+        .bytes = try bytes.toOwnedSlice(alloc),
+        .start = key.pos,
+        .velocity = key.velocity,
+    };
+    return literal;
+}
+
+/// Invalidates every literal which goes through `pos`, which is about to change. Minotaurs that are
+/// reading them keep them alive until they notice.
+pub fn invalidate(cache: *LiteralCache, alloc: Allocator, pos: Coordinate) void {
+    // Any of these might work now, so they have to be scanned again.
+    if (cache.failures != 0) {
+        var iter = cache.literals.iterator();
+        while (iter.next()) |entry| if (entry.value_ptr.* == null) cache.literals.removeByPtr(entry.key_ptr);
+        cache.failures = 0;
+    }
+
+    if (!cache.covered.remove(pos)) return;
+
+    var iter = cache.literals.iterator();
+    while (iter.next()) |entry| {
+        const literal = entry.value_ptr.* orelse continue;
+        if (!literal.covers(pos)) continue;
+
+        literal.valid = false;
+        literal.decrement(alloc);
+        cache.literals.removeByPtr(entry.key_ptr);
+    }
+}
+
+test "literals are scanned in the direction they're read, and invalidated" {
+    const alloc = std.testing.allocator;
+    var maze = try Maze.init(alloc, "test", "\"ab c\"-123+\n\n----\"");
+    defer maze.deinit(alloc);
+
+    var cache = LiteralCache{};
+    defer cache.deinit(alloc);
+
+    const string = (try cache.getOrScan(alloc, &maze, .{ .pos = .{}, .velocity = Vector.Right })).?;
+    try std.testing.expectEqualStrings("ab c", string.bytes);
+    try std.testing.expectEqual(@as(usize, 6), string.cellCount());
+
+    const int = (try cache.getOrScan(alloc, &maze, .{ .pos = .{ .x = 7 }, .velocity = Vector.Right })).?;
+    try std.testing.expectEqual(@as(IntType, 123), try int.value.toInt());
+
+    // Runs off the end of the maze.
+    try std.testing.expectEqual(@as(?*Literal, null), try cache.getOrScan(alloc, &maze, .{ .pos = .{ .x = 5 }, .velocity = Vector.Right }));
+
+    int.increment();
+    defer int.decrement(alloc);
+    cache.invalidate(alloc, .{ .x = 10 });
+    try std.testing.expect(!int.valid);
+    try std.testing.expect(string.valid);
+    try std.testing.expectEqual(@as(usize, 0), cache.failures);
+}
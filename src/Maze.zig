@@ -1,79 +1,306 @@
 const std = @import("std");
+const builtin = @import("builtin");
 const Allocator = std.mem.Allocator;
 const Function = @import("function.zig").Function;
 const Minotaur = @import("Minotaur.zig");
 const Coordinate = @import("Coordinate.zig");
+const MemStats = @import("MemStats.zig");
+const CoordInt = Coordinate.CoordInt;
 const utils = @import("utils.zig");
 const Maze = @This();
 
 // Note that on the maze, `(0,0)` is the upper left; `y` is the line and `x` is the col.
 filename: []const u8,
-lines: std.ArrayListUnmanaged([]u8),
+
+/// What the lines of the maze point into until they're written to. `deinit` frees it; set it after
+/// `init` to hand over ownership of the source.
+source: Source = .none,
+
+/// Each line of the maze. They're borrowed from the source when the maze is created, and are only
+/// copied when `set` first writes to them, so loading a maze doesn't copy it.
+lines: std.ArrayListUnmanaged(Line) = .{},
+
+/// The widest of `lines`. Cells in `tiles` aren't counted, as they aren't printed.
 max_x: usize = 0,
 
-/// Creates a new Maze with the given `filename` and `source` code.
+/// Writes at or past these go in `tiles` instead of `lines`; it's the original program, and a
+/// `tile_size` margin around it.
+dense_width: CoordInt = tile_size,
+dense_height: CoordInt = tile_size,
+
+/// Cells that have been written to far away from the original program, in `tile_size` squares
+/// keyed by `pos / tile_size`, which are allocated when they're first written to.
+tiles: std.AutoHashMapUnmanaged(Coordinate, *Tile) = .{},
+
+/// The length of every line that has cells in `tiles`, including any cells it has in `lines`.
+far_lens: std.AutoHashMapUnmanaged(CoordInt, usize) = .{},
+
+pub const tile_size = 64;
+pub const Tile = [tile_size * tile_size]u8;
+
+pub const Line = struct {
+    ptr: [*]const u8 = undefined,
+    len: u32 = 0,
+    /// How many bytes have been allocated for the line, or `0` if it still points into the source.
+    /// A copied line is followed by as many decoded cells (see `cells`).
+    capacity: u32 = 0,
+
+    pub inline fn slice(line: Line) []const u8 {
+        return line.ptr[0..line.len];
+    }
+
+    /// The line's bytes, decoded ahead of time, once it's been copied. The lines being written to
+    /// are usually the ones being run, so they don't have to be decoded on every tick; the rest
+    /// are decoded as they're read, so loading a maze doesn't double its memory.
+    inline fn cells(line: Line) [*]const Function {
+        std.debug.assert(line.capacity != 0);
+        return @ptrCast(line.ptr + line.capacity);
+    }
+
+    /// Everything allocated for a copied line.
+    fn allocation(line: Line) []u8 {
+        return @constCast(line.ptr)[0 .. 2 * @as(usize, line.capacity)];
+    }
+};
+
+/// Where a maze's source code came from.
+pub const Source = union(enum) {
+    /// Owned by someone else.
+    none,
+    /// Allocated with the maze's allocator.
+    owned: []u8,
+    /// A file that's been mapped into memory.
+    mapped: []align(std.mem.page_size) const u8,
+
+    /// Reads the source code at `path`, or from stdin if it's `-`. Regular files are mapped into
+    /// memory, so pages are only read in as they're needed and are never copied; anything else
+    /// (like a pipe) is read in chunks until its end.
+    pub fn read(alloc: Allocator, path: []const u8) !Source {
+        const is_stdin = std.mem.eql(u8, path, "-");
+        const file = if (is_stdin) std.io.getStdIn() else try std.fs.cwd().openFile(path, .{});
+        defer if (!is_stdin) file.close();
+
+        const stat = file.stat() catch null;
+        const size = if (stat) |st| st.size else 0;
+
+        if (can_map and stat != null and stat.?.kind == .file and size != 0) map: {
+            const len = std.math.cast(usize, size) orelse break :map;
+            const mapped = std.posix.mmap(null, len, std.posix.PROT.READ, .{ .TYPE = .PRIVATE }, file.handle, 0) catch break :map;
+            return .{ .mapped = mapped };
+        }
+
+        var contents = try std.ArrayListUnmanaged(u8).initCapacity(alloc, std.math.cast(usize, size) orelse 0);
+        errdefer contents.deinit(alloc);
+        while (true) {
+            try contents.ensureUnusedCapacity(alloc, 64 * 1024);
+            const amount = try file.read(contents.unusedCapacitySlice());
+            if (amount == 0) break;
+            contents.items.len += amount;
+        }
+
+        return .{ .owned = try contents.toOwnedSlice(alloc) };
+    }
+
+    const can_map = builtin.os.tag != .windows and builtin.os.tag != .wasi;
+
+    pub fn bytes(source: Source) []const u8 {
+        return switch (source) {
+            .none => &.{},
+            .owned => |owned| owned,
+            .mapped => |mapped| mapped,
+        };
+    }
+
+    pub fn deinit(source: Source, alloc: Allocator) void {
+        switch (source) {
+            .none => {},
+            .owned => |owned| alloc.free(owned),
+            .mapped => |mapped| std.posix.munmap(mapped),
+        }
+    }
+};
+
+/// Creates a new Maze with the given `filename` and `source` code. The lines of the maze point
+/// into `source`, so it has to outlive the maze (see `Maze.source`).
 ///
 /// The `Maze.deinit` function must be called to free the memory associated with it.
 pub fn init(alloc: Allocator, filename: []const u8, source: []const u8) Allocator.Error!Maze {
-    var maze = Maze{
-        .filename = filename,
-        .lines = try std.ArrayListUnmanaged([]u8).initCapacity(alloc, 8),
-    };
+    var maze = Maze{ .filename = filename };
     errdefer maze.deinit(alloc);
 
-    var line_iter = std.mem.split(u8, source, "\n");
-    while (line_iter.next()) |line| {
-        var dup = try alloc.dupe(u8, line);
-        errdefer alloc.free(dup);
+    // Lines longer than a coordinate can reach can't be part of the maze anyway.
+    var start: usize = 0;
+    while (true) {
+        const end = std.mem.indexOfScalarPos(u8, source, start, '\n') orelse source.len;
+        const len: u32 = @intCast(@min(end - start, std.math.maxInt(u32)));
+        try maze.lines.append(alloc, .{ .ptr = source.ptr + start, .len = len });
+        maze.max_x = @max(maze.max_x, len);
 
-        maze.max_x = @max(dup.len, maze.max_x);
-        try maze.lines.append(alloc, @as([]u8, @ptrCast(dup)));
+        if (end == source.len) break;
+        start = end + 1;
     }
 
+    maze.dense_width = @as(CoordInt, @intCast(maze.max_x)) +| tile_size;
+    maze.dense_height = @as(CoordInt, @intCast(@min(maze.lines.items.len, std.math.maxInt(CoordInt)))) +| tile_size;
     return maze;
 }
 
+/// Returns a copy of `maze` whose lines point at the same bytes as `maze`'s, so like a maze that's
+/// just been created, each line's only copied once it's written to. `maze` mustn't be changed or
+/// freed while the copy's still around.
+pub fn share(maze: *const Maze, alloc: Allocator) Allocator.Error!Maze {
+    var copy = Maze{
+        .filename = maze.filename,
+        .max_x = maze.max_x,
+        .dense_width = maze.dense_width,
+        .dense_height = maze.dense_height,
+    };
+    errdefer copy.deinit(alloc);
+
+    try copy.lines.ensureTotalCapacity(alloc, maze.lines.items.len);
+    for (maze.lines.items) |line| copy.lines.appendAssumeCapacity(.{ .ptr = line.ptr, .len = line.len });
+
+    copy.far_lens = try maze.far_lens.clone(alloc);
+    try copy.tiles.ensureTotalCapacity(alloc, maze.tiles.count());
+    var tiles = maze.tiles.iterator();
+    while (tiles.next()) |entry| {
+        const tile = try alloc.create(Tile);
+        tile.* = entry.value_ptr.*.*;
+        copy.tiles.putAssumeCapacity(entry.key_ptr.*, tile);
+    }
+
+    return copy;
+}
+
 /// Deinitializes the maze. This does not free `maze` itself, but just the data associated.
 pub fn deinit(maze: *Maze, alloc: Allocator) void {
-    for (maze.lines.items) |line| alloc.free(line);
+    for (maze.lines.items) |line| {
+        if (line.capacity != 0) alloc.free(line.allocation());
+    }
     maze.lines.deinit(alloc);
+
+    var tiles = maze.tiles.valueIterator();
+    while (tiles.next()) |tile| alloc.destroy(tile.*);
+    maze.tiles.deinit(alloc);
+    maze.far_lens.deinit(alloc);
+
+    maze.source.deinit(alloc);
     maze.* = undefined;
 }
 
+/// Returns the amount of lines in the maze, not counting ones that only have cells in `tiles`.
+pub inline fn lineCount(maze: *const Maze) usize {
+    return maze.lines.items.len;
+}
+
+/// Returns the `y`th line of the maze, without any of its cells in `tiles`. `y` must be less than
+/// `lineCount()`.
+pub fn getLine(maze: *const Maze, y: usize) []const u8 {
+    return maze.lines.items[y].slice();
+}
+
 /// Gets the byte at `pos`. If `pos` is out of bounds, `null` is returned.
 pub fn get(maze: *const Maze, pos: Coordinate) ?u8 {
-    const line = utils.safeIndex(maze.lines.items, pos.y) orelse return null;
-    return utils.safeIndex(line, pos.x);
+    if (utils.safeIndex(maze.lines.items, pos.y)) |line| {
+        if (pos.x < line.len) return line.ptr[pos.x];
+    }
+
+    if (maze.far_lens.count() == 0) return null;
+    return maze.getFar(pos);
 }
 
-/// Sets the position `pos` to `val`, (re)allocating lines if needed.
+/// Gets the byte at `pos` when it's not in `lines`.
+fn getFar(maze: *const Maze, pos: Coordinate) ?u8 {
+    const len = maze.far_lens.get(pos.y) orelse return null;
+    if (len <= pos.x) return null;
+
+    const tile = maze.tiles.get(tileOf(pos)) orelse return 0;
+    return tile[indexInTile(pos)];
+}
+
+inline fn tileOf(pos: Coordinate) Coordinate {
+    return .{ .x = pos.x / tile_size, .y = pos.y / tile_size };
+}
+
+inline fn indexInTile(pos: Coordinate) usize {
+    return @as(usize, pos.y % tile_size) * tile_size + pos.x % tile_size;
+}
+
+/// Gets the function at `pos`. If `pos` is out of bounds, `null` is returned. Bytes that aren't
+/// functions are `Function.invalid`.
+pub fn getFunction(maze: *const Maze, pos: Coordinate) ?Function {
+    if (utils.safeIndex(maze.lines.items, pos.y)) |line| {
+        if (pos.x < line.len and line.capacity != 0) return line.cells()[pos.x];
+    }
+    return Function.decode(maze.get(pos) orelse return null);
+}
+
+/// Makes sure `line` is a copy with room for at least `len` bytes and their cells, growing it
+/// geometrically so filling a line isn't quadratic.
+fn reserve(alloc: Allocator, line: *Line, len: u32) Allocator.Error!void {
+    if (len <= line.capacity) return;
+
+    const capacity: u32 = @intCast(@min(@max(len, line.len +| line.len / 2, 8), std.math.maxInt(u32)));
+    const bytes = try alloc.alloc(u8, 2 * @as(usize, capacity));
+    @memcpy(bytes[0..line.len], line.slice());
+    const cells: []Function = @ptrCast(bytes[capacity..][0..line.len]);
+    for (cells, line.slice()) |*cell, byte| cell.* = Function.decode(byte);
+
+    if (line.capacity != 0) alloc.free(line.allocation());
+    line.ptr = bytes.ptr;
+    line.capacity = capacity;
+}
+
+/// Sets the position `pos` to `val`, copying or growing its line if needed. Positions far away from
+/// the original program are put in `tiles`, so they don't need everything up to them allocated.
 ///
 /// Extra lines are empty, and padding on a line is `\0`.
 pub fn set(maze: *Maze, alloc: Allocator, pos: Coordinate, val: u8) Allocator.Error!void {
-    // Add more lines if needed
-    if (maze.lines.items.len <= pos.y) {
-        var to_alloc = pos.y - maze.lines.items.len + 1;
-        try maze.lines.ensureTotalCapacity(alloc, @as(usize, pos.y));
+    MemStats.count(.maze_sets);
+    const scope = MemStats.enter(.maze);
+    defer scope.leave();
 
-        while (to_alloc != 0) : (to_alloc -= 1) {
-            const line = alloc.alloc(u8, 0) catch unreachable; // alloc 0 never fails
-            maze.lines.append(alloc, line) catch unreachable; // we ensured we had enough capacity.
-        }
-    }
+    if (maze.dense_width <= pos.x or maze.dense_height <= pos.y) return maze.setFar(alloc, pos, val);
+
+    // Add more lines if needed
+    while (maze.lines.items.len <= pos.y)
+        try maze.lines.append(alloc, .{});
 
     const line = &maze.lines.items[pos.y];
+    const len = @max(line.len, std.math.cast(u32, @as(usize, pos.x) + 1) orelse return error.OutOfMemory);
+    try reserve(alloc, line, len);
+
+    const bytes = @constCast(line.ptr);
+    const cells = @constCast(line.cells());
+    @memset(bytes[line.len..len], 0);
+    @memset(cells[line.len..len], .invalid);
+    bytes[pos.x] = val;
+    cells[pos.x] = Function.decode(val);
+    line.len = len;
+    maze.max_x = @max(maze.max_x, len);
+
+    if (maze.far_lens.getPtr(pos.y)) |far_len| far_len.* = @max(far_len.*, len);
+}
+
+fn setFar(maze: *Maze, alloc: Allocator, pos: Coordinate, val: u8) Allocator.Error!void {
+    try maze.far_lens.ensureUnusedCapacity(alloc, 1);
 
-    // Resize line if needed.
-    if (line.len <= pos.x) {
-        const size = line.len;
-        line.* = try alloc.realloc(line.*, pos.x + 1);
-        @memset(line.*[size..], '\x00');
+    const entry = try maze.tiles.getOrPut(alloc, tileOf(pos));
+    if (!entry.found_existing) {
+        errdefer maze.tiles.removeByPtr(entry.key_ptr);
+        entry.value_ptr.* = try alloc.create(Tile);
+        @memset(entry.value_ptr.*, 0);
     }
+    entry.value_ptr.*[indexInTile(pos)] = val;
 
-    line.*[pos.x] = val;
+    const dense_len = if (utils.safeIndex(maze.lines.items, pos.y)) |line| line.len else 0;
+    const len = maze.far_lens.getOrPutAssumeCapacity(pos.y);
+    if (!len.found_existing) len.value_ptr.* = dense_len;
+    len.value_ptr.* = @max(len.value_ptr.*, @as(usize, pos.x) + 1);
 }
 
-fn printXHeadings(writer: anytype, max_x: usize, max_y_len: usize) std.os.WriteError!void {
+/// Prints the x axis above a maze `max_x` wide, indented past a `max_y_len` wide y axis.
+pub fn printXHeadings(writer: anytype, max_x: usize, max_y_len: usize) @TypeOf(writer).Error!void {
     var range = std.math.log10(max_x) + 1;
 
     while (range != 0) : (range -= 1) {
@@ -90,36 +317,45 @@ fn printXHeadings(writer: anytype, max_x: usize, max_y_len: usize) std.os.WriteE
     }
 }
 
+/// A cell that `printMaze` gives a background colour.
+pub const Highlight = struct { pos: Coordinate, colour: u8 };
+
 /// Options for `printMaze`.
 pub const PrintOptions = struct {
-    /// The minotaurs whose positions will be printed.
-    minotaurs: []*const Minotaur = &.{},
+    /// Where temporary buffers are allocated; they're freed before `printMaze` returns.
+    scratch: Allocator,
+    /// The positions of the minotaurs to print, newest first (ie `Minotaur.positions`).
+    positions: []const [Minotaur.positions_count]Coordinate = &.{},
+    /// The colour of each minotaur in `positions`.
+    colours: []const u8 = &.{},
     /// Whether to print out the filename.
     filename: bool = true,
     /// Whether to print the axes with their coordinates.
     axes: bool = true,
     /// Whether to print the tails of minotaurs; If false, only heads are printed.
     tails: bool = true,
+    /// Cells to colour in underneath the minotaurs, eg `--profile`'s heat map, sorted by row.
+    highlights: []const Highlight = &.{},
 };
 
 /// Prints out `maze` to `writer` with the given options.
-pub fn printMaze(maze: *const Maze, opts: PrintOptions, writer: anytype) std.os.WriteError!void {
+pub fn printMaze(maze: *const Maze, opts: PrintOptions, writer: anytype) @TypeOf(writer).Error!void {
     const Cursor = struct {
         idx: usize,
-        id: usize,
-        age: usize,
-        pub fn colour(cursor: @This()) u8 {
-            return @as(u8, @truncate((cursor.id % 36))) + 16 + 36 * (5 - @as(u8, @truncate(cursor.age)));
-        }
+        colour: u8,
+        /// Which cursor's drawn when there's more than one on a cell; lower ranks go on top.
+        rank: usize,
 
         fn cmp(_: void, l: @This(), r: @This()) bool {
-            return l.idx < r.idx;
+            return if (l.idx != r.idx) l.idx < r.idx else l.rank < r.rank;
         }
     };
 
-    var arena = std.heap.ArenaAllocator.init(std.heap.page_allocator);
-    defer arena.deinit();
-    var indices = std.ArrayList(Cursor).initCapacity(arena.allocator(), opts.minotaurs.len) catch @panic("too many minotaurs?");
+    var indices = std.ArrayList(Cursor).initCapacity(
+        opts.scratch,
+        opts.positions.len * Minotaur.positions_count + opts.highlights.len,
+    ) catch @panic("too many minotaurs?");
+    defer indices.deinit();
 
     if (opts.filename) {
         try writer.print("file: {s}\n", .{maze.filename});
@@ -128,26 +364,38 @@ pub fn printMaze(maze: *const Maze, opts: PrintOptions, writer: anytype) std.os.
     var max_y_len: usize = undefined;
 
     if (opts.axes) {
-        max_y_len = std.math.log10(maze.lines.items.len) + 1;
+        max_y_len = std.math.log10(maze.lineCount()) + 1;
         try printXHeadings(writer, maze.max_x, max_y_len);
     }
 
-    for (maze.lines.items, 0..) |line, col| {
+    var highlights = opts.highlights;
+    for (0..maze.lineCount()) |col| {
+        const line = maze.getLine(col);
         indices.clearRetainingCapacity();
 
-        for (opts.minotaurs) |minotaur| {
-            for (minotaur.positions, 0..) |pos, i| {
+        for (opts.positions, opts.colours) |positions, colour| {
+            for (positions, 0..) |pos, i| {
                 if (1 <= i and !opts.tails) break;
-                if (pos.y != col) continue;
+                if (pos.y != col or line.len <= pos.x) continue;
 
-                indices.append(.{
+                indices.appendAssumeCapacity(.{
                     .idx = @as(usize, @intCast(pos.x)),
-                    .age = i,
-                    .id = minotaur.colour,
-                }) catch unreachable;
+                    .colour = @as(u8, @truncate(colour % 36)) + 16 + 36 * (5 - @as(u8, @truncate(i))),
+                    .rank = i,
+                });
             }
         }
 
+        while (highlights.len != 0 and highlights[0].pos.y <= col) : (highlights = highlights[1..]) {
+            const highlight = highlights[0];
+            if (highlight.pos.y != col or line.len <= highlight.pos.x) continue;
+            indices.appendAssumeCapacity(.{
+                .idx = highlight.pos.x,
+                .colour = highlight.colour,
+                .rank = Minotaur.positions_count,
+            });
+        }
+
         if (opts.axes) {
             try writer.print("{[c]d: >[l]} ", .{ .c = col, .l = max_y_len });
         }
@@ -166,7 +414,7 @@ pub fn printMaze(maze: *const Maze, opts: PrintOptions, writer: anytype) std.os.
             const start = if (i == 0) 0 else indices.items[i - 1].idx + 1;
             try writer.print(
                 "{s}\x1B[48;5;{}m{c}\x1B[0m",
-                .{ line[start..index.idx], index.colour(), line[index.idx] },
+                .{ line[start..index.idx], index.colour, line[index.idx] },
             );
         }
 
@@ -245,4 +493,68 @@ test "set out of bounds works." {
     try expectGet(&maze, null, c(6, 0)); // unspecified lines are null.
 }
 
+test "cells are decoded, and updated by set." {
+    var maze = try Maze.init(std.testing.allocator, "", "1 \n>");
+    defer maze.deinit(std.testing.allocator);
+
+    try std.testing.expectEqual(@as(?Function, .int1), maze.getFunction(c(0, 0)));
+    try std.testing.expectEqual(@as(?Function, .invalid), maze.getFunction(c(0, 1)));
+    try std.testing.expectEqual(@as(?Function, .right), maze.getFunction(c(1, 0)));
+    try std.testing.expectEqual(@as(?Function, null), maze.getFunction(c(1, 1)));
+
+    try maze.set(std.testing.allocator, c(0, 1), '<');
+    try maze.set(std.testing.allocator, c(3, 5), 'Q');
+    try std.testing.expectEqual(@as(?Function, .left), maze.getFunction(c(0, 1)));
+    try std.testing.expectEqual(@as(?Function, .quit0), maze.getFunction(c(3, 5)));
+    try std.testing.expectEqual(@as(?Function, .invalid), maze.getFunction(c(3, 4)));
+}
+
+test "lines are only copied once they're written to" {
+    const source = "12\n345";
+    var maze = try Maze.init(std.testing.allocator, "", source);
+    defer maze.deinit(std.testing.allocator);
+
+    try maze.set(std.testing.allocator, c(1, 4), 'A');
+    try std.testing.expectEqual(@as([*]const u8, source), maze.lines.items[0].ptr);
+    try std.testing.expectEqual(@as(?Function, Function.decode('5')), maze.getFunction(c(1, 2)));
+    try std.testing.expectEqual(@as(?Function, .invalid), maze.getFunction(c(1, 3)));
+    try std.testing.expectEqualStrings("345\x00A", maze.getLine(1));
+    try std.testing.expectEqualStrings("12\n345", source);
+}
+
+test "shared mazes only copy the lines that are written to" {
+    var maze = try Maze.init(std.testing.allocator, "test", "abc\ndef");
+    defer maze.deinit(std.testing.allocator);
+
+    var copy = try maze.share(std.testing.allocator);
+    defer copy.deinit(std.testing.allocator);
+    try copy.set(std.testing.allocator, .{ .x = 1, .y = 1 }, 'X');
+
+    try std.testing.expectEqualStrings("dXf", copy.getLine(1));
+    try std.testing.expectEqualStrings("def", maze.getLine(1));
+    try std.testing.expectEqual(maze.lines.items[0].ptr, copy.lines.items[0].ptr);
+}
+
+test "far away writes don't allocate everything up to them" {
+    var maze = try Maze.init(std.testing.allocator, "", "12\n345");
+    defer maze.deinit(std.testing.allocator);
+
+    try maze.set(std.testing.allocator, c(1, 4_000_000), 'A');
+    try maze.set(std.testing.allocator, c(4_000_000, 4_000_000), 'B');
+    try std.testing.expectEqual(@as(usize, 2), maze.lineCount());
+
+    try expectGet(&maze, '5', c(1, 2));
+    try expectGet(&maze, '\x00', c(1, 3));
+    try expectGet(&maze, 'A', c(1, 4_000_000));
+    try expectGet(&maze, null, c(1, 4_000_001));
+    try expectGet(&maze, null, c(3_999_999, 0));
+    try expectGet(&maze, '\x00', c(4_000_000, 0));
+    try expectGet(&maze, 'B', c(4_000_000, 4_000_000));
+
+    // Lines that have far cells still grow normally.
+    try maze.set(std.testing.allocator, c(1, 5), 'C');
+    try expectGet(&maze, 'C', c(1, 5));
+    try expectGet(&maze, '\x00', c(1, 6));
+}
+
 // No testing the print because that's a huge pain.
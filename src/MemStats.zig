@@ -0,0 +1,358 @@
+//! Counts allocations and refcount operations for `--mem-stats`: how many allocations and bytes go
+//! to each `Category` of object and are made by each function, how many bytes are live at most at
+//! once, how many refcount operations each generation does, and which arrays are the biggest.
+//!
+//! Allocations are counted by wrapping the labyrinth's allocator (see `allocator`), and attributed
+//! to whatever category and function are current on the thread making them (see `enter`). Arrays
+//! don't know which labyrinth they belong to, so the stats being collected are `active` for the
+//! whole process, and everything that counts checks it first.
+
+const std = @import("std");
+const builtin = @import("builtin");
+const Allocator = std.mem.Allocator;
+const Array = @import("Array.zig");
+const Function = @import("function.zig").Function;
+const MemStats = @This();
+
+/// The stats that are being collected, if any.
+pub var active: ?*MemStats = null;
+
+/// Arrays with at least this many elements are kept track of while they're alive, so the biggest
+/// ones can be reported.
+pub const tracked_len = 1024;
+/// How many of the biggest live arrays are reported.
+pub const largest_count = 10;
+
+pub const Category = enum {
+    /// Array nodes and their value buffers.
+    array,
+    /// Stack tops and shared segments (see `Stack`).
+    stack,
+    /// Cloned minotaurs.
+    minotaur,
+    /// Timelines, including ones read back in after being spilled.
+    timeline,
+    /// Maze rows and tiles that are written to.
+    maze,
+    other,
+};
+
+pub const Counts = struct {
+    allocations: u64 = 0,
+    bytes: u64 = 0,
+};
+
+/// Events that are counted by `count`.
+pub const Event = enum { increments, decrements, clones, maze_sets };
+
+threadlocal var current_category: Category = .other;
+threadlocal var current_function: ?Function = null;
+
+/// Set by `SIGUSR1`, so the report's printed at the end of the generation.
+var report_requested = std.atomic.Value(bool).init(false);
+
+child: Allocator,
+categories: std.EnumArray(Category, Counts) = std.EnumArray(Category, Counts).initFill(.{}),
+functions: std.EnumArray(Function, Counts) = std.EnumArray(Function, Counts).initFill(.{}),
+/// Allocations made while no function was executing, eg between generations.
+outside_functions: Counts = .{},
+frees: u64 = 0,
+live_bytes: u64 = 0,
+peak_bytes: u64 = 0,
+increments: u64 = 0,
+decrements: u64 = 0,
+clones: u64 = 0,
+maze_sets: u64 = 0,
+generations: u64 = 0,
+/// How many refcount operations had been done as of the end of the last generation, and the most
+/// that were done in a single generation.
+refcount_ops_before: u64 = 0,
+peak_refcount_ops: u64 = 0,
+/// Every live array with at least `tracked_len` elements.
+live_arrays: std.AutoHashMapUnmanaged(*const Array, void) = .{},
+mutex: std.Thread.Mutex = .{},
+
+pub fn init(child: Allocator) MemStats {
+    return .{ .child = child };
+}
+
+pub fn deinit(stats: *MemStats) void {
+    if (active) |current| {
+        if (current == stats) active = null;
+    }
+    stats.live_arrays.deinit(stats.child);
+    stats.* = undefined;
+}
+
+/// Returns an allocator that counts everything that's allocated with it, and then passes it on to
+/// `child`.
+pub fn allocator(stats: *MemStats) Allocator {
+    return .{
+        .ptr = stats,
+        .vtable = &.{ .alloc = alloc, .resize = resize, .free = free },
+    };
+}
+
+fn alloc(ctx: *anyopaque, len: usize, log2_align: u8, ret_addr: usize) ?[*]u8 {
+    const stats: *MemStats = @ptrCast(@alignCast(ctx));
+    const ptr = stats.child.rawAlloc(len, log2_align, ret_addr) orelse return null;
+    stats.grow(len, 1);
+    return ptr;
+}
+
+fn resize(ctx: *anyopaque, buf: []u8, log2_align: u8, new_len: usize, ret_addr: usize) bool {
+    const stats: *MemStats = @ptrCast(@alignCast(ctx));
+    if (!stats.child.rawResize(buf, log2_align, new_len, ret_addr)) return false;
+
+    if (buf.len < new_len) stats.grow(new_len - buf.len, 0) else stats.shrink(buf.len - new_len);
+    return true;
+}
+
+fn free(ctx: *anyopaque, buf: []u8, log2_align: u8, ret_addr: usize) void {
+    const stats: *MemStats = @ptrCast(@alignCast(ctx));
+    stats.child.rawFree(buf, log2_align, ret_addr);
+    stats.shrink(buf.len);
+    _ = @atomicRmw(u64, &stats.frees, .Add, 1, .monotonic);
+}
+
+/// Counts `bytes` more being allocated in `allocations` new allocations.
+fn grow(stats: *MemStats, bytes: usize, allocations: u64) void {
+    const counts = [_]*Counts{
+        stats.categories.getPtr(current_category),
+        if (current_function) |function| stats.functions.getPtr(function) else &stats.outside_functions,
+    };
+    for (counts) |c| {
+        _ = @atomicRmw(u64, &c.allocations, .Add, allocations, .monotonic);
+        _ = @atomicRmw(u64, &c.bytes, .Add, bytes, .monotonic);
+    }
+
+    const live = @atomicRmw(u64, &stats.live_bytes, .Add, bytes, .monotonic) + bytes;
+    _ = @atomicRmw(u64, &stats.peak_bytes, .Max, live, .monotonic);
+}
+
+fn shrink(stats: *MemStats, bytes: usize) void {
+    _ = @atomicRmw(u64, &stats.live_bytes, .Sub, bytes, .monotonic);
+}
+
+/// What was current before a call to `enter`, which `leave` puts back.
+pub const Scope = struct {
+    entered: bool = false,
+    category: Category = .other,
+    function: ?Function = null,
+
+    pub inline fn leave(scope: Scope) void {
+        if (!scope.entered) return;
+        current_category = scope.category;
+        current_function = scope.function;
+    }
+};
+
+/// Attributes what this thread allocates to `category` until the returned scope's left.
+pub inline fn enter(category: Category) Scope {
+    if (active == null) return .{};
+    defer current_category = category;
+    return .{ .entered = true, .category = current_category, .function = current_function };
+}
+
+/// Attributes what this thread allocates to `function` until the returned scope's left.
+pub inline fn enterFunction(function: Function) Scope {
+    if (active == null) return .{};
+    defer current_function = function;
+    return .{ .entered = true, .category = current_category, .function = current_function };
+}
+
+/// Counts one `event`.
+pub inline fn count(comptime event: Event) void {
+    const stats = active orelse return;
+    _ = @atomicRmw(u64, &@field(stats, @tagName(event)), .Add, 1, .monotonic);
+}
+
+/// Keeps track of `ary`, which was just created or grown in place, if it's big enough.
+pub fn arrayCreated(ary: *const Array) void {
+    const stats = active orelse return;
+    if (ary.len < tracked_len) return;
+
+    stats.mutex.lock();
+    defer stats.mutex.unlock();
+    // It just isn't reported if there's no room for it.
+    stats.live_arrays.put(stats.child, ary, {}) catch {};
+}
+
+/// Stops keeping track of `ary`, which is about to be freed. Arrays that nothing else refers to can
+/// shrink in place, so this is looked up whatever `ary`'s length is now.
+pub fn arrayFreed(ary: *const Array) void {
+    const stats = active orelse return;
+
+    stats.mutex.lock();
+    defer stats.mutex.unlock();
+    _ = stats.live_arrays.remove(ary);
+}
+
+/// Asks for the report to be printed to stderr at the end of each generation that `SIGUSR1` is
+/// received in. This does nothing where there aren't signals.
+pub fn reportOnSignal() void {
+    if (builtin.os.tag == .windows or builtin.os.tag == .wasi) return;
+
+    const action = std.posix.Sigaction{
+        .handler = .{ .handler = handleSignal },
+        .mask = std.posix.empty_sigset,
+        .flags = std.posix.SA.RESTART,
+    };
+    std.posix.sigaction(std.posix.SIG.USR1, &action, null) catch {};
+}
+
+fn handleSignal(_: i32) callconv(.C) void {
+    report_requested.store(true, .monotonic);
+}
+
+/// Counts the end of a generation, and prints the report to stderr if it was asked for.
+pub fn endGeneration(stats: *MemStats) !void {
+    stats.generations += 1;
+    const ops = @atomicLoad(u64, &stats.increments, .monotonic) + @atomicLoad(u64, &stats.decrements, .monotonic);
+    stats.peak_refcount_ops = @max(stats.peak_refcount_ops, ops - stats.refcount_ops_before);
+    stats.refcount_ops_before = ops;
+
+    if (!report_requested.swap(false, .monotonic)) return;
+    var stderr = std.io.bufferedWriter(std.io.getStdErr().writer());
+    try stats.writeText(stderr.writer());
+    try stderr.flush();
+}
+
+const Largest = struct { len: usize, refcount: u32, tag: Array.Tag };
+
+/// Copies out the biggest live arrays, biggest first, into `buffer`.
+fn largestArrays(stats: *MemStats, buffer: *[largest_count]Largest) []const Largest {
+    stats.mutex.lock();
+    defer stats.mutex.unlock();
+
+    var len: usize = 0;
+    var iter = stats.live_arrays.keyIterator();
+    while (iter.next()) |ary| {
+        const entry = Largest{ .len = ary.*.len, .refcount = @atomicLoad(u32, &ary.*.refcount, .monotonic), .tag = ary.*.tag };
+        // Insertion sort, dropping whatever falls off the end.
+        var idx = len;
+        while (idx != 0 and buffer[idx - 1].len < entry.len) : (idx -= 1) {
+            if (idx < largest_count) buffer[idx] = buffer[idx - 1];
+        }
+        if (idx < largest_count) buffer[idx] = entry;
+        len = @min(len + 1, largest_count);
+    }
+    return buffer[0..len];
+}
+
+fn refcountOpsPerGeneration(stats: *const MemStats) f64 {
+    if (stats.generations == 0) return 0;
+    return @as(f64, @floatFromInt(stats.increments + stats.decrements)) / @as(f64, @floatFromInt(stats.generations));
+}
+
+/// Writes the report as JSON to `writer`.
+pub fn writeJson(stats: *MemStats, writer: anytype) !void {
+    var json = std.json.writeStream(writer, .{ .whitespace = .indent_2 });
+    defer json.deinit();
+
+    try json.beginObject();
+    try json.objectField("generations");
+    try json.write(stats.generations);
+    try json.objectField("live_bytes");
+    try json.write(stats.live_bytes);
+    try json.objectField("peak_bytes");
+    try json.write(stats.peak_bytes);
+    try json.objectField("frees");
+    try json.write(stats.frees);
+
+    try json.objectField("categories");
+    try json.beginObject();
+    for (std.enums.values(Category)) |category| {
+        try json.objectField(@tagName(category));
+        try json.write(stats.categories.get(category));
+    }
+    try json.endObject();
+
+    try json.objectField("functions");
+    try json.beginObject();
+    for (std.enums.values(Function)) |function| {
+        const counts = stats.functions.get(function);
+        if (counts.allocations == 0) continue;
+        try json.objectField(@tagName(function));
+        try json.write(counts);
+    }
+    try json.endObject();
+    try json.objectField("outside_functions");
+    try json.write(stats.outside_functions);
+
+    try json.objectField("refcounts");
+    try json.write(.{
+        .increments = stats.increments,
+        .decrements = stats.decrements,
+        .per_generation = stats.refcountOpsPerGeneration(),
+        .peak_per_generation = stats.peak_refcount_ops,
+    });
+    try json.objectField("minotaur_clones");
+    try json.write(stats.clones);
+    try json.objectField("maze_sets");
+    try json.write(stats.maze_sets);
+
+    var buffer: [largest_count]Largest = undefined;
+    try json.objectField("largest_arrays");
+    try json.beginArray();
+    for (stats.largestArrays(&buffer)) |ary| try json.write(.{ .len = ary.len, .refcount = ary.refcount, .tag = @tagName(ary.tag) });
+    try json.endArray();
+
+    try json.endObject();
+    try writer.writeByte('\n');
+}
+
+/// Writes a summary of the report that's meant to be read by people to `writer`.
+pub fn writeText(stats: *MemStats, writer: anytype) !void {
+    try writer.print("memory after {d} generations: {d} bytes live, {d} at peak, {d} frees\n", .{
+        stats.generations,
+        stats.live_bytes,
+        stats.peak_bytes,
+        stats.frees,
+    });
+
+    for (std.enums.values(Category)) |category| {
+        const counts = stats.categories.get(category);
+        try writer.print("  {s:<10} {d:>12} allocations {d:>14} bytes\n", .{ @tagName(category), counts.allocations, counts.bytes });
+    }
+
+    try writer.print("refcounts: {d} increments, {d} decrements, {d:.1} a generation ({d} at most)\n", .{
+        stats.increments,
+        stats.decrements,
+        stats.refcountOpsPerGeneration(),
+        stats.peak_refcount_ops,
+    });
+    try writer.print("minotaurs cloned: {d}, maze cells set: {d}\n", .{ stats.clones, stats.maze_sets });
+
+    var buffer: [largest_count]Largest = undefined;
+    const largest = stats.largestArrays(&buffer);
+    if (largest.len == 0) return;
+    try writer.writeAll("largest live arrays:\n");
+    for (largest) |ary| try writer.print("  {d} elements ({s}, {d} references)\n", .{ ary.len, @tagName(ary.tag), ary.refcount });
+}
+
+test "allocations are counted by category and function" {
+    var stats = MemStats.init(std.testing.allocator);
+    defer stats.deinit();
+    active = &stats;
+    const counted = stats.allocator();
+
+    const a = try counted.alloc(u8, 100);
+    {
+        const scope = enter(.maze);
+        defer scope.leave();
+        const function_scope = enterFunction(.set_at);
+        defer function_scope.leave();
+
+        const b = try counted.alloc(u8, 50);
+        counted.free(b);
+    }
+    counted.free(a);
+
+    try std.testing.expectEqual(Counts{ .allocations = 1, .bytes = 100 }, stats.categories.get(.other));
+    try std.testing.expectEqual(Counts{ .allocations = 1, .bytes = 50 }, stats.categories.get(.maze));
+    try std.testing.expectEqual(Counts{ .allocations = 1, .bytes = 50 }, stats.functions.get(.set_at));
+    try std.testing.expectEqual(@as(u64, 150), stats.peak_bytes);
+    try std.testing.expectEqual(@as(u64, 0), stats.live_bytes);
+    try std.testing.expectEqual(Category.other, current_category);
+}
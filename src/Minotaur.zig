@@ -10,74 +10,148 @@ const ForeignFunction = @import("function.zig").ForeignFunction;
 const IntType = @import("types.zig").IntType;
 const Array = @import("Array.zig");
 const Maze = @import("Maze.zig");
+const Effects = @import("Effects.zig");
+const Stack = @import("Stack.zig");
+const TraceCache = @import("TraceCache.zig");
+const LiteralCache = @import("LiteralCache.zig");
+const TimelineStore = @import("TimelineStore.zig");
+const MemStats = @import("MemStats.zig");
 
 const utils = @import("utils.zig");
 const build_options = @import("build-options");
-const positions_count = build_options.prev_positions + 1;
+pub const positions_count = build_options.prev_positions + 1;
 
 allocator: Allocator,
-stack: std.ArrayListUnmanaged(Value),
+stack: Stack,
 
 velocity: Vector = Vector.Right,
 positions: [positions_count]Coordinate = .{Coordinate.Origin} ** positions_count,
 
 // We keep arguments here so we can check them in the debugger.
 args: [Function.MaxArgc]Value = undefined,
-mode: union(enum) { normal, integer: IntType, string: *Array } = .normal,
-sleep_duration: usize = 0,
+mode: Mode = .normal,
+/// The generation this minotaur next gets to run in; it's asleep until then. See `sleepFor`.
+wake_at: usize = 0,
 is_first: bool = false,
 colour: u8 = 0,
 exit_status: ?u8 = null,
+/// The trace this minotaur ran ahead of time, if it's still sleeping through it.
+fused: ?*Fused = null,
+/// How many more ticks to go before trying to run a trace again, after one failed part way through.
+trace_cooldown: u8 = 0,
+/// How many identical minotaurs this one stands for, once they've been merged together; see
+/// `Labyrinth.mergeMinotaurs`. Everything it prints is printed this many times.
+copies: usize = 1,
+
+/// What a minotaur does with the cells it reads.
+pub const Mode = union(enum) {
+    /// Executes them.
+    normal,
+    /// Reads digits into an integer, until it reaches something else.
+    integer: IntType,
+    /// Reads bytes into a string, until it reaches a `"`.
+    string: std.ArrayListUnmanaged(u8),
+    /// Goes over a literal that's been interned in `Labyrinth.literals`, without reading it.
+    literal: struct {
+        literal: *LiteralCache.Literal,
+        /// How many more cells there are until the literal's value is pushed.
+        remaining: usize,
+    },
+};
+
+/// A trace that a minotaur has run ahead of time, and what it was like before it did.
+pub const Fused = struct {
+    trace: *const TraceCache.Trace,
+    stack: Stack,
+    positions: [positions_count]Coordinate,
+    velocity: Vector,
+};
 
 /// Creates a new `Minotaur` with the given starting stack capacity.
-pub fn initCapacity(alloc: Allocator, cap: usize) Allocator.Error!*Minotaur {
-    var minotaur = try alloc.create(Minotaur);
-    errdefer alloc.destroy(minotaur);
-
-    minotaur.* = .{
-        .stack = try std.ArrayListUnmanaged(Value).initCapacity(alloc, cap),
+///
+/// Minotaurs are plain values; `Labyrinth` keeps them in a `std.MultiArrayList`.
+pub fn initCapacity(alloc: Allocator, cap: usize) Allocator.Error!Minotaur {
+    return .{
+        .stack = try Stack.initCapacity(alloc, cap),
         .allocator = alloc,
     };
-
-    return minotaur;
 }
-/// Deinitializes the minotaur and all associated items.
-pub fn deinit(minotaur: *Minotaur) void {
-    switch (minotaur.mode) {
-        .string => |ary| ary.decrement(minotaur.allocator),
-        else => {},
-    }
 
-    for (minotaur.stack.items) |item|
-        item.deinit(minotaur.allocator);
+/// Deinitializes the minotaur and all associated items. One that's part way through a trace has to
+/// `finishTrace` first, so the labyrinth's trace cache knows it's done with it.
+pub fn deinit(minotaur: *Minotaur) void {
+    std.debug.assert(minotaur.fused == null);
+    minotaur.resetMode();
     minotaur.stack.deinit(minotaur.allocator);
-
-    const alloc = minotaur.allocator;
     minotaur.* = undefined;
-    alloc.destroy(minotaur);
 }
 
-pub fn clone(minotaur: *const Minotaur) Allocator.Error!*Minotaur {
-    var new = try Minotaur.initCapacity(minotaur.allocator, minotaur.stack.items.len);
+/// Returns a copy of `minotaur`. Their stacks are shared until they're modified, so this doesn't
+/// depend on how big the stack is; see `Stack.clone`.
+pub fn clone(minotaur: *Minotaur) Allocator.Error!Minotaur {
+    MemStats.count(.clones);
+    const scope = MemStats.enter(.minotaur);
+    defer scope.leave();
 
-    for (minotaur.stack.items) |value|
-        new.push(value.clone()) catch unreachable; // we ensured we had enough capacity.
+    var new = Minotaur{ .allocator = minotaur.allocator, .stack = try minotaur.stack.clone(minotaur.allocator) };
+    errdefer new.stack.deinit(minotaur.allocator);
 
     new.positions = minotaur.positions;
     new.velocity = minotaur.velocity;
     new.colour = minotaur.colour +% 3;
 
-    new.mode = minotaur.mode;
-    new.sleep_duration = minotaur.sleep_duration;
+    new.mode = switch (minotaur.mode) {
+        .string => |bytes| .{ .string = try bytes.clone(minotaur.allocator) },
+        .literal => |reading| blk: {
+            reading.literal.increment();
+            break :blk minotaur.mode;
+        },
+        else => minotaur.mode,
+    };
+    new.wake_at = minotaur.wake_at;
     new.is_first = minotaur.is_first;
     new.exit_status = minotaur.exit_status;
     new.args = minotaur.args;
+    new.copies = minotaur.copies;
 
     return new;
 }
 
+/// Returns a copy of `minotaur` that's indistinguishable from it, unlike `clone`, with a single copy.
+pub fn duplicate(minotaur: *Minotaur) Allocator.Error!Minotaur {
+    var copy = try minotaur.clone();
+    copy.colour = minotaur.colour;
+    copy.trace_cooldown = minotaur.trace_cooldown;
+    copy.copies = 1;
+    return copy;
+}
+
+/// Returns whether `minotaur` and `other` will always do the same things as each other, so they can
+/// be merged. Minotaurs that are part way through a trace never are.
+pub fn isIndistinguishable(minotaur: *const Minotaur, other: *const Minotaur) bool {
+    if (minotaur.fused != null or other.fused != null) return false;
+    if (!std.meta.eql(minotaur.positions, other.positions) or !std.meta.eql(minotaur.velocity, other.velocity)) return false;
+    if (minotaur.colour != other.colour or minotaur.wake_at != other.wake_at or minotaur.is_first != other.is_first) return false;
+    if (!std.meta.eql(minotaur.exit_status, other.exit_status)) return false;
+
+    const same_mode = switch (minotaur.mode) {
+        .normal => other.mode == .normal,
+        .integer => |int| other.mode == .integer and other.mode.integer == int,
+        .string => |bytes| other.mode == .string and std.mem.eql(u8, bytes.items, other.mode.string.items),
+        .literal => |reading| other.mode == .literal and
+            other.mode.literal.literal == reading.literal and other.mode.literal.remaining == reading.remaining,
+    };
+    return same_mode and minotaur.stack.equals(&other.stack);
+}
+
+/// Roughly how many bytes `minotaur` keeps alive; see `Stack.footprint`.
+pub fn footprint(minotaur: *const Minotaur) usize {
+    const mode_bytes = if (minotaur.mode == .string) minotaur.mode.string.capacity else 0;
+    return @sizeOf(Minotaur) + minotaur.stack.footprint() + mode_bytes;
+}
+
 /// The same as `Minotaur.clone`, except it also rotates in the given direction.
-pub fn cloneRotate(minotaur: *const Minotaur, dir: Vector.Direction) Allocator.Error!*Minotaur {
+pub fn cloneRotate(minotaur: *Minotaur, dir: Vector.Direction) Allocator.Error!Minotaur {
     var copy = try minotaur.clone();
     copy.velocity = copy.velocity.rotate(dir);
     return copy;
@@ -106,30 +180,26 @@ pub fn advance(minotaur: *Minotaur) Coordinate.MoveError!void {
 
 pub const StackError = error{StackTooSmall};
 
-/// Helper function to return an index from the end, or an error if it's too small.
-inline fn offset(minotaur: *const Minotaur, fromEnd: usize) StackError!usize {
-    if (minotaur.stack.items.len <= fromEnd) return error.StackTooSmall;
-    return minotaur.stack.items.len - fromEnd - 1;
+/// Helper function to make sure there's a `fromEnd`th element, or return an error if it's too small.
+inline fn checkDepth(minotaur: *const Minotaur, fromEnd: usize) StackError!void {
+    if (minotaur.stack.len() <= fromEnd) return error.StackTooSmall;
 }
 
 /// Pushes `value` onto the end of the stack.
 pub fn push(minotaur: *Minotaur, value: Value) Allocator.Error!void {
-    try minotaur.stack.append(minotaur.allocator, value);
+    try minotaur.stack.push(minotaur.allocator, value);
 }
 
 /// Get the `idx`th element from the top of the stack, or return an error.
 pub fn dup(minotaur: *const Minotaur, fromEnd: usize) StackError!Value {
-    return minotaur.stack.items[try minotaur.offset(fromEnd)].clone();
+    try minotaur.checkDepth(fromEnd);
+    return minotaur.stack.peek(fromEnd).clone();
 }
 
 /// Removes the `fromEnd`th element from the stack, returning an error if that's not possible.
-pub fn pop(minotaur: *Minotaur, fromEnd: usize) StackError!Value {
-    const index = try minotaur.offset(fromEnd);
-    return switch (fromEnd) {
-        0 => minotaur.stack.pop(),
-        1 => minotaur.stack.swapRemove(index),
-        else => minotaur.stack.orderedRemove(index),
-    };
+pub fn pop(minotaur: *Minotaur, fromEnd: usize) (StackError || Allocator.Error)!Value {
+    try minotaur.checkDepth(fromEnd);
+    return minotaur.stack.remove(minotaur.allocator, fromEnd);
 }
 
 /// Prints a debug representation of `minotaur` out.
@@ -138,58 +208,178 @@ pub fn format(
     comptime _: []const u8,
     _: std.fmt.FormatOptions,
     writer: anytype,
-) std.os.WriteError!void {
+) @TypeOf(writer).Error!void {
     try writer.print(
         "Minotaur{{position={any},velocity={any},colour={d},stack=[",
         .{ minotaur.positions[0], minotaur.velocity, minotaur.colour },
     );
 
-    for (minotaur.stack.items, 0..) |*value, idx| {
+    for (0..minotaur.stack.len()) |idx| {
         if (idx != 0) try writer.writeAll(", ");
-        try writer.print("{}", .{value});
+        try writer.print("{}", .{minotaur.stack.at(idx)});
     }
 
     try writer.writeAll("]}");
 }
 
+/// What a minotaur's going to do on its next tick; see `peek`.
+pub const Peek = struct {
+    /// The position it'll read from the maze.
+    pos: Coordinate,
+    /// The function it'll execute, or `null` if it's in the middle of a literal.
+    function: ?Function,
+};
+
+/// Predicts what `minotaur` will do on its next tick without changing anything, or returns `null`
+/// if it'll run into an error. `minotaur` must not be asleep.
+pub fn peek(minotaur: *const Minotaur, maze: *const Maze) ?Peek {
+    const pos = if (minotaur.is_first)
+        minotaur.positions[0]
+    else
+        minotaur.positions[0].moveBy(minotaur.velocity) catch return null;
+    const function = maze.getFunction(pos) orelse return null;
+
+    return .{ .pos = pos, .function = switch (minotaur.mode) {
+        .string => null,
+        .integer => if (function.toDigit() != null) null else function,
+        .literal => |reading| if (reading.remaining != 0 or reading.literal.kind == .string or function.toDigit() != null)
+            null
+        else
+            function,
+        .normal => function,
+    } };
+}
+
+/// Returns the position a `set_at` would write to if it were executed right now, or `null` if it'd
+/// fail or can't be known ahead of time.
+pub fn peekSetAt(minotaur: *const Minotaur) ?Coordinate {
+    if (minotaur.mode != .normal) return null;
+
+    if (minotaur.stack.len() < 3) return null;
+
+    const x = minotaur.stack.peek(0).toInt() catch return null;
+    const y = minotaur.stack.peek(1).toInt() catch return null;
+    return .{
+        .x = std.math.cast(u32, x) orelse return null,
+        .y = std.math.cast(u32, y) orelse return null,
+    };
+}
+
 //
-const PlayError = error{
+pub const PlayError = error{
     TooFewArgumentsForFunction,
     IntOutOfBounds,
     IntLiteralOverflow,
     UnknownForeignFunction,
     EmptyArray,
-} || StackError || std.os.WriteError || Allocator.Error ||
+    IndexOutOfBounds,
+} || StackError || std.posix.WriteError || Allocator.Error ||
     Array.ParseIntError || Function.ValidateError || Value.OrdError || Value.MathError ||
-    Coordinate.MoveError || Labyrinth.MinotaurGetError;
+    Coordinate.MoveError || Labyrinth.MinotaurGetError || TimelineStore.Error;
 
-pub fn tick(minotaur: *Minotaur, labyrinth: *Labyrinth) PlayError!void {
-    // If we're currently sleeping, then continue sleeping.
-    if (utils.unlikely(minotaur.sleep_duration != 0)) {
-        minotaur.sleep_duration -= 1;
-        return;
-    }
+/// Ticks `minotaur` once; anything it does to the rest of `labyrinth` goes through `effects`.
+pub fn tick(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects) PlayError!void {
+    // If we're currently sleeping, then continue sleeping. The labyrinth doesn't usually tick
+    // sleeping minotaurs at all, but the debugger can.
+    if (utils.unlikely(labyrinth.generation < minotaur.wake_at)) return;
 
+    if (minotaur.fused != null) minotaur.finishTrace(&labyrinth.traces);
+    if (minotaur.copies != 1) return minotaur.tickMerged(labyrinth, effects);
+    try minotaur.step(labyrinth, effects);
+}
+
+/// Moves `minotaur` on to its next cell and executes it, or runs a trace from there.
+fn step(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects) PlayError!void {
     // If it's the very first time any minotaur in the entire program has moved,
     // then don't actually move. This is so we don't skip the first step.
     if (utils.unlikely(minotaur.is_first)) {
         minotaur.is_first = false;
     } else {
+        if (try minotaur.runTrace(labyrinth, effects)) return;
         try minotaur.advance();
     }
 
-    // Get the byte we're looking at.
-    const byte = labyrinth.maze.get(minotaur.positions[0]) orelse return error.CoordinateOutOfBounds;
+    // Get the function we're looking at; the maze has already decoded it for us.
+    const pos = minotaur.positions[0];
+    const function = labyrinth.maze.getFunction(pos) orelse return error.CoordinateOutOfBounds;
+    try minotaur.execute(labyrinth, effects, pos, function);
+}
+
+/// Returns whether a merged minotaur can execute `function` once for all of its copies. Functions
+/// that'd give each copy something different (the rng, stdin, timeline ids) can't, and neither can
+/// ones that print the labyrinth, since each copy's print would show the ones before it.
+fn isReplayable(function: Function) bool {
+    return switch (function) {
+        .rand, .randdir, .gets, .branch, .branchl, .branchr, .foreign, .dump, .dumpq => false,
+        else => true,
+    };
+}
+
+/// Ticks a merged minotaur. If it's about to execute a function that isn't replayable, each of its
+/// other copies is split off into a minotaur of its own first, and they're ticked straight after
+/// it, in the order they would've been if they'd never been merged; see `Effects.split`.
+fn tickMerged(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects) PlayError!void {
+    const replayable = if (minotaur.peek(&labyrinth.maze)) |peeked|
+        isReplayable(peeked.function orelse .invalid)
+    else
+        true; // it'll fail the same way for all of them.
+    if (replayable) return minotaur.step(labyrinth, effects);
+
+    const copies = minotaur.copies;
+    minotaur.copies = 1;
+    const first = effects.split.items.len;
+    try effects.split.ensureUnusedCapacity(labyrinth.allocator, copies - 1);
+    for (1..copies) |_| {
+        effects.split.appendAssumeCapacity(.{ .after = effects.ticking, .minotaur = try minotaur.duplicate() });
+    }
+
+    try minotaur.step(labyrinth, effects);
+    for (effects.split.items[first..]) |*split| try split.minotaur.step(labyrinth, effects);
+}
+
+/// Executes `function`, which is at `pos`, counting it if the labyrinth's being profiled.
+fn execute(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects, pos: Coordinate, function: Function) PlayError!void {
+    const scope = MemStats.enterFunction(function);
+    defer scope.leave();
+
+    const profiler = if (labyrinth.profiler) |*p| p else return minotaur.interpret(labyrinth, effects, pos, function);
+
+    const class = if (minotaur.mode == .normal) function.class() else .literal;
+    const execution = try profiler.enter(labyrinth.allocator, pos, function, class);
+    const spawned = effects.spawned.len;
+    try minotaur.interpret(labyrinth, effects, pos, function);
+    profiler.leave(execution, effects.spawned.len - spawned, minotaur.hasExited());
+}
+
+/// Executes `function`, which is at `pos`, taking into account whether we're in a literal.
+fn interpret(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects, pos: Coordinate, function: Function) PlayError!void {
+    if (minotaur.mode == .literal and !minotaur.mode.literal.literal.valid) try minotaur.unintern();
 
     switch (minotaur.mode) {
-        .string => |*ary| {
+        .literal => |*reading| {
+            if (reading.remaining != 0) {
+                reading.remaining -= 1;
+                return;
+            }
+
+            const literal = reading.literal;
+            try minotaur.push(literal.value.clone());
+            minotaur.mode = .normal;
+            literal.decrement(minotaur.allocator);
+
+            // Like below, integers are followed by a function that's executed on the same tick.
+            if (literal.kind == .string) return;
+        },
+
+        .string => |*bytes| {
             // If it's not the end quote, then just push it to the end.
-            if (byte != comptime Function.str.toByte()) {
-                ary.* = try ary.*.prependNoIncrement(minotaur.allocator, Value.from(@as(IntType, @intCast(byte))));
+            if (function != .str) {
+                const byte = labyrinth.maze.get(pos).?; // `getFunction` already bounds checked.
+                try bytes.append(minotaur.allocator, byte);
             } else {
                 // It's the closing quote, then push it onto the list of chars and return.
-                try minotaur.push(Value.from(try ary.*.reverse(minotaur.allocator)));
-                ary.*.decrement(minotaur.allocator);
+                try minotaur.push(Value.from(try Array.fromString(minotaur.allocator, bytes.items)));
+                bytes.deinit(minotaur.allocator);
                 minotaur.mode = .normal;
             }
 
@@ -198,7 +388,7 @@ pub fn tick(minotaur: *Minotaur, labyrinth: *Labyrinth) PlayError!void {
 
         .integer => |*int| {
             // If it's another digit, continue adding it to the integer.
-            if (std.fmt.charToDigit(byte, 10) catch null) |digit| {
+            if (function.toDigit()) |digit| {
                 int.* = std.math.add(
                     IntType,
                     std.math.mul(IntType, 10, int.*) catch return error.IntLiteralOverflow,
@@ -215,7 +405,229 @@ pub fn tick(minotaur: *Minotaur, labyrinth: *Labyrinth) PlayError!void {
         .normal => {},
     }
 
-    try minotaur.tickFunction(labyrinth, try Function.fromByte(byte));
+    if (function == .invalid) return error.NotAValidFunction;
+    try minotaur.tickFunction(labyrinth, effects, function);
+}
+
+/// Returns the mode to start reading the literal at `minotaur`'s position in: going over the
+/// interned one in `labyrinth.literals` if there is one, and `otherwise` if not.
+fn startLiteral(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects, otherwise: Mode) Allocator.Error!Mode {
+    // Only scan literals when we're the only thread touching the cache.
+    const key = LiteralCache.Key{ .pos = minotaur.positions[0], .velocity = minotaur.velocity };
+    const literal = (if (effects.immediate)
+        try labyrinth.literals.getOrScan(labyrinth.allocator, &labyrinth.maze, key)
+    else
+        labyrinth.literals.get(key)) orelse return otherwise;
+
+    literal.increment();
+    return .{ .literal = .{ .literal = literal, .remaining = literal.cellCount() - 2 } };
+}
+
+/// Goes back to reading a literal that's been invalidated one cell at a time, as if that's how it
+/// had been read all along.
+pub fn unintern(minotaur: *Minotaur) Allocator.Error!void {
+    const reading = minotaur.mode.literal;
+    const literal = reading.literal;
+    const read = literal.cellCount() - 2 - reading.remaining;
+
+    const mode: Mode = switch (literal.kind) {
+        .string => .{ .string = blk: {
+            var bytes = try std.ArrayListUnmanaged(u8).initCapacity(minotaur.allocator, read);
+            bytes.appendSliceAssumeCapacity(literal.bytes[0..read]);
+            break :blk bytes;
+        } },
+        .integer => .{ .integer = std.fmt.parseInt(IntType, literal.bytes[0 .. read + 1], 10) catch unreachable },
+    };
+
+    literal.decrement(minotaur.allocator);
+    minotaur.mode = mode;
+}
+
+/// Frees anything the current mode owns, and goes back to `.normal`.
+fn resetMode(minotaur: *Minotaur) void {
+    switch (minotaur.mode) {
+        .string => |*bytes| bytes.deinit(minotaur.allocator),
+        .literal => |reading| reading.literal.decrement(minotaur.allocator),
+        else => {},
+    }
+    minotaur.mode = .normal;
+}
+
+/// If there's a trace starting where `minotaur` is, runs all of it and then sleeps for the rest of
+/// its steps; see `TraceCache`. Returns whether it did.
+///
+/// If any step fails, `minotaur` is put back how it was, and traces aren't tried again until the
+/// failing step's been reached, so the error happens on the tick it would've anyways.
+fn runTrace(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects) PlayError!bool {
+    if (!labyrinth.traces.enabled or minotaur.mode != .normal) return false;
+    if (minotaur.trace_cooldown != 0) {
+        minotaur.trace_cooldown -= 1;
+        return false;
+    }
+
+    // Only compile traces when we're the only thread touching the cache.
+    const key = TraceCache.Key{ .pos = minotaur.positions[0], .velocity = minotaur.velocity };
+    const trace = (if (effects.immediate)
+        try labyrinth.traces.getOrCompile(labyrinth.allocator, &labyrinth.maze, key)
+    else
+        labyrinth.traces.get(key)) orelse return false;
+
+    const fused = try minotaur.allocator.create(Fused);
+    errdefer minotaur.allocator.destroy(fused);
+    fused.* = .{
+        .trace = trace,
+        .stack = try minotaur.stack.clone(minotaur.allocator),
+        .positions = minotaur.positions,
+        .velocity = minotaur.velocity,
+    };
+
+    for (trace.steps, 0..) |step, i| {
+        minotaur.runStep(labyrinth, effects, step) catch {
+            minotaur.rewind(fused);
+            minotaur.allocator.destroy(fused);
+            minotaur.trace_cooldown = @intCast(i);
+            return false;
+        };
+    }
+
+    minotaur.fused = fused;
+    minotaur.sleepFor(labyrinth, trace.steps.len - 1);
+    labyrinth.traces.started();
+    return true;
+}
+
+fn runStep(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects, step: TraceCache.Step) PlayError!void {
+    minotaur.jumpTo(step.pos);
+    try minotaur.execute(labyrinth, effects, step.pos, step.function);
+}
+
+/// Puts `minotaur` back how it was before it ran the trace in `fused`, which is freed.
+fn rewind(minotaur: *Minotaur, fused: *Fused) void {
+    minotaur.resetMode();
+
+    minotaur.stack.deinit(minotaur.allocator);
+    minotaur.stack = fused.stack;
+    minotaur.positions = fused.positions;
+    minotaur.velocity = fused.velocity;
+}
+
+/// Releases the trace `minotaur` ran from `cache`, once it's slept through all of it or is about to
+/// be deinitialized.
+pub fn finishTrace(minotaur: *Minotaur, cache: *TraceCache) void {
+    const fused = minotaur.fused.?;
+    fused.stack.deinit(minotaur.allocator);
+    cache.finished();
+    minotaur.allocator.destroy(fused);
+    minotaur.fused = null;
+}
+
+/// Returns the steps of the trace `minotaur` is part way through which it hasn't reached yet, when
+/// it's got `sleep_left` ticks left to sleep through (see `Labyrinth.sleepLeft`).
+pub fn pendingSteps(minotaur: *const Minotaur, sleep_left: usize) []const TraceCache.Step {
+    std.debug.assert(minotaur.fused != null and sleep_left != 0);
+    const steps = minotaur.fused.?.trace.steps;
+    return steps[steps.len - sleep_left ..];
+}
+
+/// Puts a minotaur that's part way through a trace into the state it'd be in if it had executed
+/// the trace one cell at a time, ie only up to the cell it's reached so far. It's then awake, which
+/// the labyrinth has to take care of.
+pub fn settle(minotaur: *Minotaur, labyrinth: *Labyrinth, sleep_left: usize) PlayError!void {
+    std.debug.assert(minotaur.fused != null and sleep_left != 0);
+    const fused = minotaur.fused.?;
+    const steps = fused.trace.steps[0 .. fused.trace.steps.len - sleep_left];
+
+    minotaur.rewind(fused);
+    labyrinth.traces.finished();
+    minotaur.allocator.destroy(fused);
+    minotaur.fused = null;
+    minotaur.wake_at = 0;
+
+    // These all succeeded the first time around, and the cells haven't changed since.
+    for (steps) |step| try minotaur.runStep(labyrinth, &labyrinth.effects, step);
+}
+
+/// Puts `minotaur` to sleep for the `ticks` generations after the current one.
+fn sleepFor(minotaur: *Minotaur, labyrinth: *const Labyrinth, ticks: usize) void {
+    minotaur.wake_at = labyrinth.generation +| ticks +| 1;
+}
+
+/// Executes `function` straight on the top of the stack instead of popping its arguments into
+/// `args`, if it only works on the stack; returns whether it did. Each function gets its own copy
+/// of `runInPlace` at comptime. The debugger looks at `args`, so this isn't used when debugging.
+fn tickInPlace(minotaur: *Minotaur, function: Function) PlayError!bool {
+    switch (function) {
+        inline .swap, .pop1, .pop2, .not, .eql, .lth, .gth, .cmp, .neg, .inc, .dec, .add, .sub, .mul, .div, .mod => |f| {
+            try minotaur.runInPlace(f);
+            return true;
+        },
+        else => return false,
+    }
+}
+
+fn runInPlace(minotaur: *Minotaur, comptime function: Function) PlayError!void {
+    const alloc = minotaur.allocator;
+    const stack = &minotaur.stack;
+    const count = comptime switch (function) {
+        .swap, .pop2 => 2,
+        else => function.arity(),
+    };
+
+    // This is the only bounds check. Like `setArguments`, whatever arguments there are have been
+    // popped by the time it fails.
+    const top = stack.topValues(alloc, count) catch |err| switch (err) {
+        error.StackTooSmall => {
+            if (function.arity() == 0) return error.StackTooSmall;
+            while (stack.len() != 0) (try stack.remove(alloc, 0)).deinit(alloc);
+            return error.TooFewArgumentsForFunction;
+        },
+        else => |e| return e,
+    };
+
+    switch (function) {
+        .swap => return std.mem.swap(Value, &top[0], &top[1]),
+        .pop1 => {
+            top[0].deinit(alloc);
+            stack.top.items.len -= 1;
+            return;
+        },
+        .pop2 => {
+            top[0].deinit(alloc);
+            top[0] = top[1];
+            stack.top.items.len -= 1;
+            return;
+        },
+        else => {},
+    }
+
+    // The arguments are taken off before anything can fail, the same as if they'd been popped.
+    // Their slots stay where they are until the result's put in the first one.
+    stack.top.items.len -= count;
+    const result = switch (function) {
+        .not => blk: {
+            defer top[0].deinit(alloc);
+            break :blk Value.from(!top[0].isTruthy());
+        },
+        .eql, .lth, .gth, .cmp => blk: {
+            defer for (top) |arg| arg.deinit(alloc);
+            break :blk switch (function) {
+                .eql => Value.from(top[0].equals(top[1])),
+                .lth => Value.from(top[0].cmp(top[1]) < 0),
+                .gth => Value.from(top[0].cmp(top[1]) > 0),
+                else => Value.from(top[0].cmp(top[1])),
+            };
+        },
+        .neg => try Value.mapReusing(top[0], alloc, Value.from(-1), .mul),
+        .inc => try Value.mapReusing(top[0], alloc, Value.from(1), .add),
+        .dec => try Value.mapReusing(top[0], alloc, Value.from(1), .sub),
+        .add => try Value.mapReusing(top[0], alloc, top[1], .add),
+        .sub => try Value.mapReusing(top[0], alloc, top[1], .sub),
+        .mul => try Value.mapReusing(top[0], alloc, top[1], .mul),
+        .div => try Value.mapReusing(top[0], alloc, top[1], .div),
+        .mod => try Value.mapReusing(top[0], alloc, top[1], .mod),
+        else => comptime unreachable,
+    };
+    stack.top.appendAssumeCapacity(result);
 }
 
 fn setArguments(minotaur: *Minotaur, arity: usize) PlayError!void {
@@ -223,7 +635,10 @@ fn setArguments(minotaur: *Minotaur, arity: usize) PlayError!void {
     errdefer minotaur.deinitArgs(i);
 
     while (i < arity) : (i += 1)
-        minotaur.args[i] = minotaur.pop(0) catch return error.TooFewArgumentsForFunction;
+        minotaur.args[i] = minotaur.pop(0) catch |err| return switch (err) {
+            error.StackTooSmall => error.TooFewArgumentsForFunction,
+            else => |e| e,
+        };
 }
 
 fn deinitArgs(minotaur: *Minotaur, arity: usize) void {
@@ -231,10 +646,31 @@ fn deinitArgs(minotaur: *Minotaur, arity: usize) void {
         arg.deinit(minotaur.allocator);
 }
 
+/// Takes argument `idx` over from `args`, so if nothing else refers to it, it can be reused in place.
+fn takeArg(minotaur: *Minotaur, idx: usize) Value {
+    defer minotaur.args[idx] = Value.from(0);
+    return minotaur.args[idx];
+}
+
+/// Takes argument `idx` over from `args` as an array.
+fn takeArray(minotaur: *Minotaur, idx: usize) Allocator.Error!*Array {
+    const arg = minotaur.takeArg(idx);
+    defer arg.deinit(minotaur.allocator);
+    return arg.toArray(minotaur.allocator);
+}
+
 fn castInt(comptime T: type, int: IntType) PlayError!T {
     return std.math.cast(T, int) orelse return error.IntOutOfBounds;
 }
 
+/// Converts `start` and `count` into bounds for `Array.slice`, making sure they're within `ary`.
+fn sliceBounds(ary: *const Array, start: Value, count: Value) PlayError!struct { usize, usize } {
+    const s = try castInt(usize, try start.toInt());
+    const c = try castInt(usize, try count.toInt());
+    if (ary.len < s or ary.len - s < c) return error.IndexOutOfBounds;
+    return .{ s, c };
+}
+
 fn jumpn(minotaur: *Minotaur, n: Value) PlayError!void {
     const CoordInt = i32;
     const int = try n.toInt();
@@ -242,7 +678,7 @@ fn jumpn(minotaur: *Minotaur, n: Value) PlayError!void {
     minotaur.positions[0] = try minotaur.positions[0].moveBy(minotaur.velocity.scale(scalar));
 }
 
-fn randomVelocity(rng: *std.rand.DefaultPrng) Vector {
+fn randomVelocity(rng: *std.Random.DefaultPrng) Vector {
     return switch (rng.random().int(u2)) {
         0b00 => Vector.Up,
         0b01 => Vector.Down,
@@ -257,23 +693,26 @@ fn foreign(minotaur: *Minotaur, labyrinth: *Labyrinth, function: ForeignFunction
             labyrinth.allocator,
             labyrinth.maze.filename,
         ))),
-        .print_maze => try labyrinth.printMaze(labyrinth.stdout.writer()),
-        .print_minotaurs => try labyrinth.printMinotaurs(labyrinth.stdout.writer()),
+        .print_maze => try labyrinth.printMaze(labyrinth.output.writer()),
+        .print_minotaurs => try labyrinth.printMinotaurs(labyrinth.output.writer()),
     }
 }
 
-fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function) PlayError!void {
-    std.debug.assert(minotaur.sleep_duration == 0);
+fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, effects: *Effects, function: Function) PlayError!void {
+    std.debug.assert(minotaur.wake_at <= labyrinth.generation);
+    if (!labyrinth.options.debug and try minotaur.tickInPlace(function)) return;
 
     try minotaur.setArguments(function.arity());
     defer minotaur.deinitArgs(function.arity());
     var ret: ?Value = null;
 
     switch (function) {
-        .int0, .int1, .int2, .int3, .int4, .int5, .int6, .int7, .int8, .int9 => minotaur.mode = .{
-            .integer = std.fmt.charToDigit(function.toByte(), 10) catch unreachable,
-        },
-        .str => minotaur.mode = .{ .string = Array.empty },
+        .int0, .int1, .int2, .int3, .int4, .int5, .int6, .int7, .int8, .int9 => minotaur.mode = try minotaur.startLiteral(
+            labyrinth,
+            effects,
+            .{ .integer = function.toDigit().? },
+        ),
+        .str => minotaur.mode = try minotaur.startLiteral(labyrinth, effects, .{ .string = .{} }),
 
         .dup1 => ret = try minotaur.dup(0),
         .dup2 => ret = try minotaur.dup(1),
@@ -284,7 +723,7 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
         .swap => ret = try minotaur.pop(1),
         .stacklen => ret = Value.from(
             // on no computer I know if can this actually occur
-            std.math.cast(IntType, minotaur.stack.items.len) orelse @panic("this should never happen"),
+            std.math.cast(IntType, minotaur.stack.len()) orelse @panic("this should never happen"),
         ),
         .ifpop => _ = try minotaur.pop(if (minotaur.args[0].isTruthy()) 1 else 0),
 
@@ -292,20 +731,22 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
         .moveh, .movev => {
             const perp = 0 != if (function == .moveh) minotaur.velocity.x else minotaur.velocity.y;
             if (utils.unlikely(!perp)) {
-                try labyrinth.spawnMinotaur(try minotaur.cloneRotate(.left));
+                try effects.spawn(labyrinth.allocator, try minotaur.cloneRotate(.left));
                 minotaur.velocity = minotaur.velocity.rotate(.right);
             }
         },
-        .spawnl => try labyrinth.spawnMinotaur(try minotaur.cloneRotate(.left)),
-        .spawnr => try labyrinth.spawnMinotaur(try minotaur.cloneRotate(.right)),
+        .spawnl => try effects.spawn(labyrinth.allocator, try minotaur.cloneRotate(.left)),
+        .spawnr => try effects.spawn(labyrinth.allocator, try minotaur.cloneRotate(.right)),
         .branchl, .branchr => {
             var cl = try minotaur.cloneRotate(if (function == .branchl) .left else .right);
             errdefer cl.deinit();
-            const id = try labyrinth.addTimeline(cl);
+            const id = try effects.addTimeline(labyrinth, cl);
             ret = Value.from(@as(IntType, @intCast(id)));
         },
         .branch => {
-            const id = try labyrinth.addTimeline(try minotaur.clone());
+            var cl = try minotaur.clone();
+            errdefer cl.deinit();
+            const id = try effects.addTimeline(labyrinth, cl);
             ret = Value.from(@as(IntType, @intCast(id)));
         },
         .travel, .travelq => {
@@ -313,10 +754,11 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
             var alternate_reality = try (try labyrinth.getTimeline(id)).clone();
             errdefer alternate_reality.deinit();
             try alternate_reality.push(minotaur.args[1].clone());
+            alternate_reality.copies = minotaur.copies;
             if (function == .travelq) {
                 minotaur.exit_status = 0;
             }
-            try labyrinth.spawnMinotaur(alternate_reality);
+            try effects.spawn(labyrinth.allocator, alternate_reality);
         },
 
         // Movement
@@ -329,12 +771,7 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
         .jump1 => try minotaur.advance(),
         .jump => try minotaur.jumpn(minotaur.args[0]),
         .randdir => minotaur.velocity = randomVelocity(&labyrinth.rng),
-        .x_to_neg1 => minotaur.velocity = .{ .x = minotaur.velocity.x}
-            if minotaur.velocity.x == 1 {
-                minotaur.velocity.rotate(.right)
-            }
-            minotaur.velocity = minotaur.velocity.rotate(.right),
-        }
+        .x_to_neg1 => minotaur.velocity = minotaur.velocity.rotate(.right),
         .neg_x_to_neg1 => minotaur.velocity = minotaur.velocity.rotate(.left),
 
         .get_at => {
@@ -345,8 +782,8 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
         .set_at => {
             const x = try castInt(u32, try minotaur.args[0].toInt());
             const y = try castInt(u32, try minotaur.args[1].toInt());
-            try labyrinth.maze.set(
-                labyrinth.allocator,
+            try effects.setAt(
+                labyrinth,
                 .{ .x = x, .y = y },
                 try castInt(u8, try minotaur.args[2].toInt()),
             );
@@ -372,8 +809,8 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
         },
 
         // Misc
-        .sleep1 => minotaur.sleep_duration = 1,
-        .sleep => minotaur.sleep_duration = try castInt(usize, try minotaur.args[0].toInt()),
+        .sleep1 => minotaur.sleepFor(labyrinth, 1),
+        .sleep => minotaur.sleepFor(labyrinth, try castInt(usize, try minotaur.args[0].toInt())),
         .getcolour => ret = Value.from(minotaur.colour),
         .setcolour => minotaur.colour = @as(u8, @bitCast(@as(i8, @truncate(try minotaur.args[0].toInt())))),
         .foreign => {
@@ -382,14 +819,14 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
         },
 
         // Math
-        .neg => ret = try minotaur.args[0].mul(minotaur.allocator, Value.from(-1)),
-        .inc => ret = try minotaur.args[0].add(minotaur.allocator, Value.from(1)),
-        .dec => ret = try minotaur.args[0].sub(minotaur.allocator, Value.from(1)),
-        .add => ret = try minotaur.args[1].add(minotaur.allocator, minotaur.args[0]),
-        .sub => ret = try minotaur.args[1].sub(minotaur.allocator, minotaur.args[0]),
-        .mul => ret = try minotaur.args[1].mul(minotaur.allocator, minotaur.args[0]),
-        .div => ret = try minotaur.args[1].div(minotaur.allocator, minotaur.args[0]),
-        .mod => ret = try minotaur.args[1].mod(minotaur.allocator, minotaur.args[0]),
+        .neg => ret = try Value.mapReusing(minotaur.takeArg(0), minotaur.allocator, Value.from(-1), .mul),
+        .inc => ret = try Value.mapReusing(minotaur.takeArg(0), minotaur.allocator, Value.from(1), .add),
+        .dec => ret = try Value.mapReusing(minotaur.takeArg(0), minotaur.allocator, Value.from(1), .sub),
+        .add => ret = try Value.mapReusing(minotaur.takeArg(1), minotaur.allocator, minotaur.takeArg(0), .add),
+        .sub => ret = try Value.mapReusing(minotaur.takeArg(1), minotaur.allocator, minotaur.takeArg(0), .sub),
+        .mul => ret = try Value.mapReusing(minotaur.takeArg(1), minotaur.allocator, minotaur.takeArg(0), .mul),
+        .div => ret = try Value.mapReusing(minotaur.takeArg(1), minotaur.allocator, minotaur.takeArg(0), .div),
+        .mod => ret = try Value.mapReusing(minotaur.takeArg(1), minotaur.allocator, minotaur.takeArg(0), .mod),
         .rand => ret = Value.from(labyrinth.rng.random().int(IntType)),
 
         // Logic
@@ -406,48 +843,119 @@ fn tickFunction(minotaur: *Minotaur, labyrinth: *Labyrinth, function: Function)
             var ary = try minotaur.args[0].toArray(minotaur.allocator);
             defer ary.decrement(minotaur.allocator);
 
-            ret = Value.from(std.math.cast(IntType, ary.len()) orelse return error.IntOutOfBounds);
+            ret = Value.from(std.math.cast(IntType, ary.len) orelse return error.IntOutOfBounds);
         },
-        .toi => ret = Value.from(try minotaur.args[0].toInt()),
+        .toi => ret = try minotaur.args[0].toNumber(minotaur.allocator),
         .tos => ret = Value.from(try minotaur.args[0].toArray(minotaur.allocator)),
         .head => {
             const ary = try minotaur.args[0].toArray(minotaur.allocator);
             defer ary.decrement(minotaur.allocator);
-            var iter = ary.iter();
-            ret = (iter.next() orelse return error.EmptyArray).clone();
+            if (ary.isEmpty()) return error.EmptyArray;
+            ret = ary.get(0).clone();
         },
         .tail => {
-            const ary = try minotaur.args[0].toArray(minotaur.allocator);
-            defer ary.decrement(minotaur.allocator);
-            var next = ary.next orelse return error.EmptyArray;
-            next.increment();
-            ret = Value.from(next);
+            const ary = try minotaur.takeArray(0);
+            if (ary.isEmpty()) {
+                ary.decrement(minotaur.allocator);
+                return error.EmptyArray;
+            }
+            ret = Value.from(try ary.tailReusing(minotaur.allocator));
         },
         .cons => {
-            const begin = try minotaur.args[1].toArray(minotaur.allocator);
-            defer begin.decrement(minotaur.allocator);
-
             const end = try minotaur.args[0].toArray(minotaur.allocator);
             defer end.decrement(minotaur.allocator);
 
-            ret = Value.from(try begin.cons(minotaur.allocator, end));
+            ret = Value.from(try Array.consReusing(minotaur.allocator, try minotaur.takeArray(1), end));
+        },
+        .get => {
+            const ary = try minotaur.args[2].toArray(minotaur.allocator);
+            defer ary.decrement(minotaur.allocator);
+
+            const start, const count = try sliceBounds(ary, minotaur.args[1], minotaur.args[0]);
+            ret = Value.from(try ary.slice(minotaur.allocator, start, count));
+        },
+        .set => {
+            const ary = try minotaur.args[3].toArray(minotaur.allocator);
+            defer ary.decrement(minotaur.allocator);
+
+            const replacement = try minotaur.args[0].toArray(minotaur.allocator);
+            defer replacement.decrement(minotaur.allocator);
+
+            const start, const count = try sliceBounds(ary, minotaur.args[2], minotaur.args[1]);
+            ret = Value.from(try ary.splice(minotaur.allocator, start, count, replacement));
         },
 
         // io
-        .print => try labyrinth.stdout.writer().print("{s}", .{minotaur.args[0]}),
-        .printnl => try labyrinth.stdout.writer().print("{s}\n", .{minotaur.args[0]}),
-        .dumpval => try labyrinth.stdout.writer().print("{d}", .{minotaur.args[0]}),
-        .dumpvalnl => try labyrinth.stdout.writer().print("{d}\n", .{minotaur.args[0]}),
+        .print => for (0..minotaur.copies) |_| try effects.printString(labyrinth, minotaur.args[0], false),
+        .printnl => for (0..minotaur.copies) |_| try effects.printString(labyrinth, minotaur.args[0], true),
+        .dumpval => for (0..minotaur.copies) |_| try effects.print(labyrinth, "{d}", .{minotaur.args[0]}),
+        .dumpvalnl => for (0..minotaur.copies) |_| try effects.print(labyrinth, "{d}\n", .{minotaur.args[0]}),
         .dumpq, .dump => {
-            try labyrinth.stdout.writer().print("{}\n", .{labyrinth});
+            try labyrinth.settleAll();
+            try labyrinth.output.writer().print("{}\n", .{labyrinth});
             if (function == .dumpq) minotaur.exit_status = 0;
         },
         .quit0 => minotaur.exit_status = 0,
         .quit => minotaur.exit_status = try castInt(u8, try minotaur.args[0].toInt()),
 
         // to implement:
-        .ary, .ary_end, .slay1, .gets, .get, .set => @panic("todo"),
+        .ary, .ary_end, .slay1, .gets => @panic("todo"),
+        .invalid => unreachable, // `tick` rejects invalid functions.
     }
 
     if (ret) |value| try minotaur.push(value);
 }
+
+/// Makes a minotaur with `values` on its stack, the last one on top.
+fn initTest(values: []const IntType) !Minotaur {
+    var minotaur = try Minotaur.initCapacity(std.testing.allocator, values.len);
+    errdefer minotaur.deinit();
+    for (values) |value| try minotaur.push(Value.from(value));
+    return minotaur;
+}
+
+fn expectStack(minotaur: *const Minotaur, expected: []const IntType) !void {
+    try std.testing.expectEqual(expected.len, minotaur.stack.len());
+    for (expected, 0..) |value, idx| try std.testing.expectEqual(value, try minotaur.stack.at(idx).toInt());
+}
+
+test "functions run in place take their arguments in the order they'd be popped" {
+    const cases = [_]struct { Function, IntType }{
+        .{ .sub, 5 }, .{ .div, 3 }, .{ .mod, 1 }, .{ .lth, 0 }, .{ .gth, 1 }, .{ .cmp, 1 },
+    };
+    for (cases) |case| {
+        var minotaur = try initTest(&.{ 4, 7, 2 });
+        defer minotaur.deinit();
+        try std.testing.expect(try minotaur.tickInPlace(case[0]));
+        try expectStack(&minotaur, &.{ 4, case[1] });
+    }
+
+    var minotaur = try initTest(&.{ 1, 2, 3 });
+    defer minotaur.deinit();
+    try std.testing.expect(try minotaur.tickInPlace(.swap));
+    try expectStack(&minotaur, &.{ 1, 3, 2 });
+    try std.testing.expect(try minotaur.tickInPlace(.pop2));
+    try expectStack(&minotaur, &.{ 1, 2 });
+}
+
+test "functions run in place leave clones alone" {
+    var minotaur = try initTest(&.{ 7, 2 });
+    defer minotaur.deinit();
+    var copy = try minotaur.clone();
+    defer copy.deinit();
+
+    _ = try copy.tickInPlace(.add);
+    try expectStack(&copy, &.{9});
+    _ = try minotaur.tickInPlace(.swap);
+    try expectStack(&minotaur, &.{ 2, 7 });
+    try expectStack(&copy, &.{9});
+}
+
+test "functions run in place fail the same way as popping their arguments" {
+    var minotaur = try initTest(&.{5});
+    defer minotaur.deinit();
+    try std.testing.expectError(error.StackTooSmall, minotaur.tickInPlace(.swap));
+    try expectStack(&minotaur, &.{5});
+    try std.testing.expectError(error.TooFewArgumentsForFunction, minotaur.tickInPlace(.add));
+    try expectStack(&minotaur, &.{});
+}
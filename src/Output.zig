@@ -0,0 +1,147 @@
+//! A buffered sink for everything minotaurs print.
+//!
+//! Output is kept in a buffer and only written to `file` according to the `FlushPolicy`, so
+//! programs which print one character at a time don't make one syscall per character.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Value = @import("Value.zig");
+const IntType = @import("types.zig").IntType;
+const Output = @This();
+
+/// When the buffered output is written out.
+pub const FlushPolicy = union(enum) {
+    /// Flush whenever a newline is printed.
+    line,
+    /// Flush at the end of every generation.
+    tick,
+    /// Only flush once the program's exited.
+    exit,
+    /// Flush whenever at least this many bytes are buffered.
+    size: usize,
+    /// Never write anything to the file; it all stays in `buffer`, so it can be read once the
+    /// program's exited.
+    capture,
+
+    /// The buffer size used when output isn't going to a terminal.
+    pub const default_size = 64 * 1024;
+
+    /// Parses `line`, `tick`, `exit`, or a size in bytes.
+    pub fn parse(string: []const u8) ?FlushPolicy {
+        if (std.meta.stringToEnum(std.meta.Tag(FlushPolicy), string)) |tag| return switch (tag) {
+            .line => .line,
+            .tick => .tick,
+            .exit => .exit,
+            .size, .capture => null,
+        };
+
+        return .{ .size = std.fmt.parseInt(usize, string, 10) catch return null };
+    }
+};
+
+pub const Error = std.posix.WriteError || Allocator.Error;
+
+file: std.fs.File,
+allocator: Allocator,
+policy: FlushPolicy,
+buffer: std.ArrayListUnmanaged(u8) = .{},
+/// How many bytes have been written to `file` so far.
+written: usize = 0,
+/// If set, everything that's printed is copied into it too, for `Recorder`.
+tee: ?std.ArrayListUnmanaged(u8) = null,
+
+/// Creates a new `Output` writing to `file`. If `policy` is null, it's line-buffered when `file` is
+/// a terminal, and buffered by size otherwise.
+pub fn init(alloc: Allocator, file: std.fs.File, policy: ?FlushPolicy) Output {
+    return .{
+        .file = file,
+        .allocator = alloc,
+        .policy = policy orelse if (file.isTty()) .line else .{ .size = FlushPolicy.default_size },
+    };
+}
+
+/// Flushes anything remaining, and then deinitializes `output`.
+pub fn deinit(output: *Output) void {
+    output.flush() catch {};
+    output.buffer.deinit(output.allocator);
+    if (output.tee) |*tee| tee.deinit(output.allocator);
+    output.* = undefined;
+}
+
+/// Writes everything that's buffered to the file.
+pub fn flush(output: *Output) std.posix.WriteError!void {
+    if (output.buffer.items.len == 0 or output.policy == .capture) return;
+    defer output.buffer.clearRetainingCapacity();
+    try output.file.writeAll(output.buffer.items);
+    output.written += output.buffer.items.len;
+}
+
+/// Called at the end of every generation.
+pub fn endTick(output: *Output) std.posix.WriteError!void {
+    if (output.policy == .tick) try output.flush();
+}
+
+/// Flushes if the policy says so, now that everything from `start` onwards has been added.
+fn added(output: *Output, start: usize) Error!void {
+    if (output.tee) |*tee| try tee.appendSlice(output.allocator, output.buffer.items[start..]);
+    switch (output.policy) {
+        .line => if (std.mem.indexOfScalar(u8, output.buffer.items[start..], '\n') != null) try output.flush(),
+        .size => |size| if (size <= output.buffer.items.len) try output.flush(),
+        .tick, .exit, .capture => {},
+    }
+}
+
+pub fn writeAll(output: *Output, bytes: []const u8) Error!void {
+    const start = output.buffer.items.len;
+    try output.buffer.appendSlice(output.allocator, bytes);
+    try output.added(start);
+}
+
+/// Writes `value` as a string, ie the same as printing it with `{s}`.
+pub fn writeString(output: *Output, value: Value) Error!void {
+    const start = output.buffer.items.len;
+    try encodeString(&output.buffer, output.allocator, value);
+    try output.added(start);
+}
+
+pub const Writer = std.io.Writer(*Output, Error, write);
+
+pub fn writer(output: *Output) Writer {
+    return .{ .context = output };
+}
+
+fn write(output: *Output, bytes: []const u8) Error!usize {
+    try output.writeAll(bytes);
+    return bytes.len;
+}
+
+/// Appends `value` to `buffer` as a string, the same as formatting it with `{s}`.
+///
+/// Strings (arrays of ints) are UTF-8 encoded straight into `buffer` in one pass, instead of going
+/// through `std.fmt` for every character.
+pub fn encodeString(buffer: *std.ArrayListUnmanaged(u8), alloc: Allocator, value: Value) Error!void {
+    const ary = switch (value.classify()) {
+        .int => |int| return encodeCodepoint(buffer, alloc, int),
+        .ary => |ary| ary,
+        .big => return error.Unexpected,
+    };
+
+    var iter = ary.iter();
+    while (iter.next()) |element| switch (element.classify()) {
+        .int => |int| try encodeCodepoint(buffer, alloc, int),
+        .big => return error.Unexpected,
+        .ary => {
+            try encodeString(buffer, alloc, element);
+            try buffer.append(alloc, '\n');
+        },
+    };
+}
+
+fn encodeCodepoint(buffer: *std.ArrayListUnmanaged(u8), alloc: Allocator, int: IntType) Error!void {
+    const codepoint = std.math.cast(u21, int) orelse return error.Unexpected;
+    try buffer.ensureUnusedCapacity(alloc, 4);
+
+    const len = std.unicode.utf8Encode(codepoint, buffer.allocatedSlice()[buffer.items.len..]) catch
+        return error.Unexpected;
+    buffer.items.len += len;
+}
@@ -0,0 +1,203 @@
+//! Counts what minotaurs execute for `--profile`: how many times each cell's executed as each
+//! function, how many minotaurs are forked and slain on it, and roughly how long each class of
+//! function takes (see `Function.Class`).
+//!
+//! Timing every cell would take longer than most cells take to execute, so only about one in
+//! `sample_every` executions is timed, at random so loops can't line up with it, and each class's
+//! total time is estimated from its samples.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Coordinate = @import("Coordinate.zig");
+const Function = @import("function.zig").Function;
+const Maze = @import("Maze.zig");
+const Profiler = @This();
+
+pub const sample_every = 64;
+
+/// The colours of the heat map, from the coldest cells to the hottest.
+const heat_colours = [_]u8{ 52, 88, 124, 160, 196, 208, 220, 226 };
+
+pub const Key = struct { pos: Coordinate, function: Function };
+
+pub const Counts = struct {
+    executions: u64 = 0,
+    /// How many minotaurs were spawned.
+    forks: u64 = 0,
+    /// How many minotaurs exited.
+    slays: u64 = 0,
+};
+
+pub const ClassStats = struct {
+    executions: u64 = 0,
+    /// How many of `executions` were timed, and how long they took in total.
+    samples: u64 = 0,
+    sampled_ns: u64 = 0,
+
+    /// Roughly how long all of `executions` took.
+    pub fn estimatedNs(stats: ClassStats) u64 {
+        if (stats.samples == 0) return 0;
+        const total = @as(u128, stats.sampled_ns) * stats.executions / stats.samples;
+        return std.math.cast(u64, total) orelse std.math.maxInt(u64);
+    }
+};
+
+cells: std.AutoHashMapUnmanaged(Key, Counts) = .{},
+classes: std.EnumArray(Function.Class, ClassStats) = std.EnumArray(Function.Class, ClassStats).initFill(.{}),
+/// How many more executions there are until the next one that's timed.
+until_sample: u32 = 0,
+prng: std.Random.DefaultPrng = std.Random.DefaultPrng.init(0),
+
+/// An execution that's in progress; see `enter`.
+pub const Execution = struct {
+    counts: *Counts,
+    class: Function.Class,
+    start: ?std.time.Instant,
+};
+
+pub fn deinit(profiler: *Profiler, alloc: Allocator) void {
+    profiler.cells.deinit(alloc);
+    profiler.* = undefined;
+}
+
+/// Counts an execution of `function` at `pos`, which is in `class`. Once it's done, it has to be
+/// passed to `leave`, before anything else is counted.
+pub fn enter(profiler: *Profiler, alloc: Allocator, pos: Coordinate, function: Function, class: Function.Class) Allocator.Error!Execution {
+    const entry = try profiler.cells.getOrPutValue(alloc, .{ .pos = pos, .function = function }, .{});
+    entry.value_ptr.executions += 1;
+    profiler.classes.getPtr(class).executions += 1;
+
+    var start: ?std.time.Instant = null;
+    if (profiler.until_sample == 0) {
+        profiler.until_sample = profiler.prng.random().uintLessThan(u32, 2 * sample_every);
+        start = std.time.Instant.now() catch null;
+    } else {
+        profiler.until_sample -= 1;
+    }
+
+    return .{ .counts = entry.value_ptr, .class = class, .start = start };
+}
+
+/// Finishes `execution`, during which `forks` minotaurs were spawned, and the minotaur exited if
+/// `slain` is set.
+pub fn leave(profiler: *Profiler, execution: Execution, forks: usize, slain: bool) void {
+    execution.counts.forks += forks;
+    execution.counts.slays += @intFromBool(slain);
+
+    const start = execution.start orelse return;
+    const now = std.time.Instant.now() catch return;
+    const stats = profiler.classes.getPtr(execution.class);
+    stats.samples += 1;
+    stats.sampled_ns += now.since(start);
+}
+
+/// Writes the report as JSON to `writer`: every cell that was executed, hottest first, and then the
+/// totals for each class of function. `alloc` is only used for temporary buffers.
+pub fn writeJson(profiler: *const Profiler, alloc: Allocator, generations: usize, writer: anytype) !void {
+    const Cell = struct { key: Key, counts: Counts };
+    var cells = try std.ArrayListUnmanaged(Cell).initCapacity(alloc, profiler.cells.count());
+    defer cells.deinit(alloc);
+
+    var iter = profiler.cells.iterator();
+    while (iter.next()) |entry| cells.appendAssumeCapacity(.{ .key = entry.key_ptr.*, .counts = entry.value_ptr.* });
+    std.mem.sort(Cell, cells.items, {}, struct {
+        fn hotter(_: void, l: Cell, r: Cell) bool {
+            if (l.counts.executions != r.counts.executions) return l.counts.executions > r.counts.executions;
+            return rowOrder({}, l.key.pos, r.key.pos);
+        }
+    }.hotter);
+
+    var json = std.json.writeStream(writer, .{ .whitespace = .indent_2 });
+    defer json.deinit();
+
+    try json.beginObject();
+    try json.objectField("generations");
+    try json.write(generations);
+    try json.objectField("sample_every");
+    try json.write(@as(u32, sample_every));
+
+    try json.objectField("cells");
+    try json.beginArray();
+    for (cells.items) |cell| try json.write(.{
+        .x = cell.key.pos.x,
+        .y = cell.key.pos.y,
+        .function = @tagName(cell.key.function),
+        .executions = cell.counts.executions,
+        .forks = cell.counts.forks,
+        .slays = cell.counts.slays,
+    });
+    try json.endArray();
+
+    try json.objectField("classes");
+    try json.beginObject();
+    for (std.enums.values(Function.Class)) |class| {
+        const stats = profiler.classes.get(class);
+        try json.objectField(@tagName(class));
+        try json.write(.{
+            .executions = stats.executions,
+            .samples = stats.samples,
+            .estimated_ns = stats.estimatedNs(),
+        });
+    }
+    try json.endObject();
+
+    try json.endObject();
+    try writer.writeByte('\n');
+}
+
+/// Returns a colour for every cell that was executed, for `Maze.PrintOptions.highlights`. Hotter
+/// cells are brighter, on a log scale up to the hottest cell.
+pub fn heatMap(profiler: *const Profiler, alloc: Allocator) Allocator.Error![]Maze.Highlight {
+    var totals = std.AutoArrayHashMapUnmanaged(Coordinate, u64){};
+    defer totals.deinit(alloc);
+
+    var hottest: u64 = 1;
+    var iter = profiler.cells.iterator();
+    while (iter.next()) |entry| {
+        const total = try totals.getOrPutValue(alloc, entry.key_ptr.pos, 0);
+        total.value_ptr.* += entry.value_ptr.executions;
+        hottest = @max(hottest, total.value_ptr.*);
+    }
+
+    const highlights = try alloc.alloc(Maze.Highlight, totals.count());
+    const top = @log2(@as(f64, @floatFromInt(hottest)) + 1);
+    for (highlights, totals.keys(), totals.values()) |*highlight, pos, total| {
+        const level = @log2(@as(f64, @floatFromInt(total)) + 1) / top;
+        const idx: usize = @intFromFloat(level * heat_colours.len);
+        highlight.* = .{ .pos = pos, .colour = heat_colours[@min(idx, heat_colours.len - 1)] };
+    }
+
+    std.mem.sort(Maze.Highlight, highlights, {}, struct {
+        fn lessThan(_: void, l: Maze.Highlight, r: Maze.Highlight) bool {
+            return rowOrder({}, l.pos, r.pos);
+        }
+    }.lessThan);
+    return highlights;
+}
+
+fn rowOrder(_: void, l: Coordinate, r: Coordinate) bool {
+    return if (l.y != r.y) l.y < r.y else l.x < r.x;
+}
+
+test "executions are counted per cell and function, and the hottest cells are brightest" {
+    const alloc = std.testing.allocator;
+    var profiler = Profiler{};
+    defer profiler.deinit(alloc);
+
+    for (0..10) |_| profiler.leave(try profiler.enter(alloc, .{ .x = 1 }, .add, .math), 0, false);
+    profiler.leave(try profiler.enter(alloc, .{ .x = 1 }, .sub, .math), 0, false);
+    profiler.leave(try profiler.enter(alloc, .{ .y = 2 }, .spawnl, .minotaur), 1, true);
+
+    const add = profiler.cells.get(.{ .pos = .{ .x = 1 }, .function = .add }).?;
+    try std.testing.expectEqual(@as(u64, 10), add.executions);
+    const spawn = profiler.cells.get(.{ .pos = .{ .y = 2 }, .function = .spawnl }).?;
+    try std.testing.expectEqual(Counts{ .executions = 1, .forks = 1, .slays = 1 }, spawn);
+    try std.testing.expectEqual(@as(u64, 11), profiler.classes.get(.math).executions);
+
+    const highlights = try profiler.heatMap(alloc);
+    defer alloc.free(highlights);
+    try std.testing.expectEqual(@as(usize, 2), highlights.len);
+    try std.testing.expectEqual(Coordinate{ .x = 1 }, highlights[0].pos);
+    try std.testing.expectEqual(heat_colours[heat_colours.len - 1], highlights[0].colour);
+    try std.testing.expect(highlights[1].colour < highlights[0].colour);
+}
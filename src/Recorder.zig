@@ -0,0 +1,336 @@
+//! Records a compact binary trace of a run for `--record`, which `replay` plays back afterwards
+//! without running anything.
+//!
+//! The trace is laid out as:
+//!
+//!   header  `magic`, `version`, `Minotaur.positions_count`, the generation it starts at, and the
+//!           maze, the same way a checkpoint has it (see `binary.writeMaze`)
+//!   frames  one per generation, until the end of the file
+//!
+//! Numbers in frames are LEB128 (signed ones for differences), so most of them take a byte. Each
+//! frame only has what changed since the last one:
+//!
+//!   generations  how many went by since the last frame (more than one after a fast forward)
+//!   removed      the ids of the minotaurs that were slain or merged, as of the last frame
+//!   changed      each survivor whose head, trail, velocity, or colour changed (see `Changed`),
+//!                by where it is among the survivors
+//!   spawned      every new minotaur, in full, after its id; copies split off merged minotaurs
+//!                go in the middle, so they aren't all on the end
+//!   writes       every `set_at`, in order
+//!   output       everything that was printed
+//!
+//! Ids are written as the difference from the one before, and a head that moved is written as
+//! the difference from where it was. The trail behind it is only written when it isn't just the
+//! last one shifted along behind the new head (see `follow`).
+//!
+//! While minotaurs are being ticked, only `set_at` writes and output are recorded. Everything else
+//! is found between generations by comparing every minotaur with the last frame, so the hot path
+//! doesn't change.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const leb = std.leb;
+const Labyrinth = @import("Labyrinth.zig");
+const Minotaur = @import("Minotaur.zig");
+const Maze = @import("Maze.zig");
+const Coordinate = @import("Coordinate.zig");
+const Vector = @import("Vector.zig");
+const binary = @import("binary.zig");
+const Recorder = @This();
+
+pub const magic = "NREC";
+pub const version: u32 = 3;
+
+/// How much of the trace is buffered before it's written to the file.
+const flush_size = 64 * 1024;
+
+/// What `origins` has for minotaurs that were spawned since the last frame.
+const spawned_origin = std.math.maxInt(usize);
+
+pub const Trail = [Minotaur.positions_count]Coordinate;
+
+/// Everything about a minotaur that's recorded.
+pub const State = struct {
+    positions: Trail,
+    velocity: Vector,
+    colour: u8,
+};
+
+/// What's written for a survivor that changed.
+pub const Changed = packed struct(u8) {
+    /// Its head's position, as the difference from the last one.
+    head: bool = false,
+    /// Its whole trail, when it doesn't follow from the last one and the new head.
+    trail: bool = false,
+    velocity: bool = false,
+    colour: bool = false,
+    _: u4 = 0,
+};
+
+pub const Write = struct { pos: Coordinate, byte: u8 };
+
+/// Where the trace goes; `null` leaves it in `buffer`.
+file: ?std.fs.File,
+/// The trace that hasn't been written to `file` yet.
+buffer: std.ArrayListUnmanaged(u8) = .{},
+/// The survivors that changed in the frame being written, which go after how many there are.
+changes: std.ArrayListUnmanaged(u8) = .{},
+/// Each minotaur as of the last frame.
+last: std.MultiArrayList(State) = .{},
+/// The id in `last` of each current minotaur, or `spawned_origin` for new ones. Survivors keep
+/// their order, so apart from new minotaurs this is sorted.
+origins: std.ArrayListUnmanaged(usize) = .{},
+/// The `set_at` writes since the last frame.
+writes: std.ArrayListUnmanaged(Write) = .{},
+/// The generation of the last frame.
+generation: usize,
+
+/// Starts a trace of `maze` at `generation`, in which there are `minotaurs` minotaurs, who are all
+/// written out in full in the first frame.
+pub fn init(alloc: Allocator, file: ?std.fs.File, maze: *const Maze, generation: usize, minotaurs: usize) Allocator.Error!Recorder {
+    // The file's only handed over once nothing else can fail.
+    var recorder = Recorder{ .file = null, .generation = generation };
+    errdefer recorder.deinit(alloc);
+
+    const writer = recorder.buffer.writer(alloc);
+    try writer.writeAll(magic);
+    try writer.writeInt(u32, version, .little);
+    try leb.writeULEB128(writer, @as(usize, Minotaur.positions_count));
+    try leb.writeULEB128(writer, generation);
+
+    try binary.writeMaze(maze, writer);
+
+    try recorder.origins.appendNTimes(alloc, spawned_origin, minotaurs);
+    recorder.file = file;
+    return recorder;
+}
+
+/// Writes out what's left of the trace, and closes the file.
+pub fn deinit(recorder: *Recorder, alloc: Allocator) void {
+    recorder.flush() catch {};
+    if (recorder.file) |file| file.close();
+    recorder.buffer.deinit(alloc);
+    recorder.changes.deinit(alloc);
+    recorder.last.deinit(alloc);
+    recorder.origins.deinit(alloc);
+    recorder.writes.deinit(alloc);
+    recorder.* = undefined;
+}
+
+/// Writes everything that's buffered to the file.
+pub fn flush(recorder: *Recorder) std.fs.File.WriteError!void {
+    const file = recorder.file orelse return;
+    defer recorder.buffer.clearRetainingCapacity();
+    try file.writeAll(recorder.buffer.items);
+}
+
+/// Called when the minotaurs `ids`, which are sorted, are removed and the rest compacted down.
+pub fn removed(recorder: *Recorder, ids: []const usize) void {
+    var kept: usize = 0;
+    var dead: usize = 0;
+    for (recorder.origins.items, 0..) |origin, id| {
+        if (dead < ids.len and ids[dead] == id) {
+            dead += 1;
+            continue;
+        }
+
+        recorder.origins.items[kept] = origin;
+        kept += 1;
+    }
+    recorder.origins.shrinkRetainingCapacity(kept);
+}
+
+/// Called when `count` new minotaurs are added on the end.
+pub fn spawned(recorder: *Recorder, alloc: Allocator, count: usize) Allocator.Error!void {
+    try recorder.origins.appendNTimes(alloc, spawned_origin, count);
+}
+
+/// Called when a new minotaur is put in front of each of the minotaurs `at`, which is sorted and
+/// numbered from before any of them were.
+pub fn inserted(recorder: *Recorder, alloc: Allocator, at: []const usize) Allocator.Error!void {
+    const old_len = recorder.origins.items.len;
+    try recorder.origins.resize(alloc, old_len + at.len);
+    const origins = recorder.origins.items;
+
+    // Move everything up from the back, so nothing's overwritten before it's moved.
+    var src = old_len;
+    var dst = origins.len;
+    var i = at.len;
+    while (i != 0) {
+        i -= 1;
+        while (at[i] < src) {
+            src -= 1;
+            dst -= 1;
+            origins[dst] = origins[src];
+        }
+        dst -= 1;
+        origins[dst] = spawned_origin;
+    }
+}
+
+/// Called when `set_at` writes `byte` at `pos`.
+pub fn wrote(recorder: *Recorder, alloc: Allocator, pos: Coordinate, byte: u8) Allocator.Error!void {
+    try recorder.writes.append(alloc, .{ .pos = pos, .byte = byte });
+}
+
+/// Writes a frame for `generation`, in which the minotaurs are `minotaurs` and `output` was
+/// printed. This has to be done between generations.
+pub fn frame(
+    recorder: *Recorder,
+    alloc: Allocator,
+    generation: usize,
+    minotaurs: Labyrinth.MinotaurList.Slice,
+    output: []const u8,
+) !void {
+    std.debug.assert(recorder.origins.items.len == minotaurs.len);
+    const writer = recorder.buffer.writer(alloc);
+    try leb.writeULEB128(writer, generation - recorder.generation);
+    recorder.generation = generation;
+
+    // Every minotaur in `last` that doesn't have a survivor was removed.
+    const origins = recorder.origins.items;
+    const survivors = origins.len - std.mem.count(usize, origins, &.{spawned_origin});
+    const removed_count = recorder.last.len - survivors;
+    try leb.writeULEB128(writer, removed_count);
+    if (removed_count != 0) {
+        var old = recorder.last.slice();
+        var kept: usize = 0;
+        var next: usize = 0;
+        var after: usize = 0;
+        for (origins) |origin| {
+            if (origin == spawned_origin) continue;
+            while (next < origin) : (next += 1) {
+                try leb.writeULEB128(writer, next - after);
+                after = next + 1;
+            }
+            next = origin + 1;
+            old.set(kept, old.get(origin));
+            kept += 1;
+        }
+        while (next < old.len) : (next += 1) {
+            try leb.writeULEB128(writer, next - after);
+            after = next + 1;
+        }
+        recorder.last.shrinkRetainingCapacity(survivors);
+    }
+
+    const positions = minotaurs.items(.positions);
+    const velocities = minotaurs.items(.velocity);
+    const colours = minotaurs.items(.colour);
+
+    const changed = try recorder.changedSurvivors(alloc, minotaurs);
+    try leb.writeULEB128(writer, changed);
+    try writer.writeAll(recorder.changes.items);
+
+    try leb.writeULEB128(writer, minotaurs.len - survivors);
+    var after: usize = 0;
+    for (origins, 0..) |origin, id| {
+        if (origin != spawned_origin) continue;
+        try leb.writeULEB128(writer, id - after);
+        after = id + 1;
+        for (positions[id]) |pos| try writeCoordinate(writer, pos);
+        try leb.writeILEB128(writer, velocities[id].x);
+        try leb.writeILEB128(writer, velocities[id].y);
+        try writer.writeByte(colours[id]);
+    }
+
+    // Survivors move up past the new minotaurs in front of them, so `last` is filled in from the
+    // back. Once there aren't any new minotaurs left in front, the rest are already in place.
+    try recorder.last.resize(alloc, minotaurs.len);
+    var last = recorder.last.slice();
+    var ordinal = survivors;
+    var current = minotaurs.len;
+    while (ordinal != current) {
+        current -= 1;
+        if (origins[current] == spawned_origin) {
+            last.set(current, .{ .positions = positions[current], .velocity = velocities[current], .colour = colours[current] });
+        } else {
+            ordinal -= 1;
+            last.set(current, last.get(ordinal));
+        }
+    }
+
+    try leb.writeULEB128(writer, recorder.writes.items.len);
+    for (recorder.writes.items) |write| {
+        try writeCoordinate(writer, write.pos);
+        try writer.writeByte(write.byte);
+    }
+    recorder.writes.clearRetainingCapacity();
+
+    try writeBytes(writer, output);
+
+    recorder.origins.clearRetainingCapacity();
+    for (0..minotaurs.len) |id| recorder.origins.appendAssumeCapacity(id);
+
+    if (flush_size <= recorder.buffer.items.len) try recorder.flush();
+}
+
+/// Writes each survivor that's changed since the last frame into `changes`, by where it is among
+/// the survivors, updating `last`, and returns how many there were.
+fn changedSurvivors(recorder: *Recorder, alloc: Allocator, minotaurs: Labyrinth.MinotaurList.Slice) Allocator.Error!usize {
+    recorder.changes.clearRetainingCapacity();
+    const writer = recorder.changes.writer(alloc);
+    const last = recorder.last.slice();
+    const last_positions = last.items(.positions);
+    const last_velocities = last.items(.velocity);
+    const last_colours = last.items(.colour);
+
+    var count: usize = 0;
+    var after: usize = 0;
+    var ordinal: usize = 0;
+    for (recorder.origins.items, minotaurs.items(.positions), minotaurs.items(.velocity), minotaurs.items(.colour)) |origin, trail, velocity, colour| {
+        if (origin == spawned_origin) continue;
+        defer ordinal += 1;
+
+        const old_trail = &last_positions[ordinal];
+        var changed = Changed{
+            .velocity = !std.meta.eql(velocity, last_velocities[ordinal]),
+            .colour = colour != last_colours[ordinal],
+        };
+        if (!std.meta.eql(trail, old_trail.*)) {
+            if (std.meta.eql(trail, follow(old_trail.*, trail[0]))) changed.head = true else changed.trail = true;
+        }
+        if (@as(u8, @bitCast(changed)) == 0) continue;
+
+        count += 1;
+
+        try leb.writeULEB128(writer, ordinal - after);
+        after = ordinal + 1;
+        try writer.writeByte(@bitCast(changed));
+        if (changed.head) {
+            try leb.writeILEB128(writer, @as(i64, trail[0].x) - old_trail[0].x);
+            try leb.writeILEB128(writer, @as(i64, trail[0].y) - old_trail[0].y);
+        }
+        if (changed.trail) for (trail) |pos| try writeCoordinate(writer, pos);
+        if (changed.velocity) {
+            try leb.writeILEB128(writer, velocity.x);
+            try leb.writeILEB128(writer, velocity.y);
+        }
+        if (changed.colour) try writer.writeByte(colour);
+
+        old_trail.* = trail;
+        last_velocities[ordinal] = velocity;
+        last_colours[ordinal] = colour;
+    }
+
+    return count;
+}
+
+/// Returns `trail` after its head's moved to `head`, ie what a minotaur's trail is after it takes
+/// one step.
+pub fn follow(trail: Trail, head: Coordinate) Trail {
+    var result: Trail = undefined;
+    result[0] = head;
+    @memcpy(result[1..], trail[0 .. trail.len - 1]);
+    return result;
+}
+
+fn writeCoordinate(writer: anytype, pos: Coordinate) !void {
+    try leb.writeULEB128(writer, pos.x);
+    try leb.writeULEB128(writer, pos.y);
+}
+
+fn writeBytes(writer: anytype, bytes: []const u8) !void {
+    try leb.writeULEB128(writer, bytes.len);
+    try writer.writeAll(bytes);
+}
@@ -0,0 +1,224 @@
+//! Draws the maze to a terminal for `--output-maze`.
+//!
+//! The last frame is kept around, so each new one only moves the cursor to, and redraws, the cells
+//! that changed since then (usually just the minotaurs' heads and tails, and anything `set_at`).
+//! The whole frame is only redrawn when the maze changes size, or when the program printed
+//! something and scrolled the terminal.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Maze = @import("Maze.zig");
+const Minotaur = @import("Minotaur.zig");
+const Coordinate = @import("Coordinate.zig");
+const Renderer = @This();
+
+/// A single character of the maze on screen.
+const Cell = struct {
+    byte: u8 = ' ',
+    /// The background colour, if a minotaur's on it.
+    colour: ?u8 = null,
+
+    fn eql(l: Cell, r: Cell) bool {
+        return l.byte == r.byte and l.colour == r.colour;
+    }
+};
+
+/// Everything that's drawn in a frame.
+pub const Frame = struct {
+    generation: usize,
+    maze: *const Maze,
+    /// The positions of the minotaurs, newest first (ie `Minotaur.positions`).
+    positions: []const [Minotaur.positions_count]Coordinate,
+    /// The colour of each minotaur in `positions`.
+    colours: []const u8,
+    /// Drawn below the maze, eg the minotaurs for `--output-minotaurs`.
+    footer: []const u8 = "",
+    /// How many bytes the program's printed so far.
+    output_written: usize = 0,
+};
+
+/// If set, at most this many frames are drawn a second, and generations in between aren't drawn.
+fps: ?u32 = null,
+/// When `fps` isn't set, the least amount of time between frames.
+sleep_ms: u32 = 0,
+last_frame: ?std.time.Instant = null,
+
+/// The cells of the maze in the last frame, `width` to a row.
+cells: std.ArrayListUnmanaged(Cell) = .{},
+/// The cells of the frame being drawn; swapped with `cells` afterwards.
+next: std.ArrayListUnmanaged(Cell) = .{},
+width: usize = 0,
+height: usize = 0,
+/// The last frame's footer.
+footer: std.ArrayListUnmanaged(u8) = .{},
+/// `Frame.output_written` as of the last frame.
+output_written: usize = 0,
+/// Whether the next frame has to be drawn from scratch.
+dirty: bool = true,
+/// How many rows of the terminal the last frame took up.
+rows: usize = 0,
+/// Everything that's sent to the terminal for a frame, so it's written all at once.
+out: std.ArrayListUnmanaged(u8) = .{},
+
+pub fn deinit(renderer: *Renderer, alloc: Allocator) void {
+    renderer.cells.deinit(alloc);
+    renderer.next.deinit(alloc);
+    renderer.footer.deinit(alloc);
+    renderer.out.deinit(alloc);
+    renderer.* = undefined;
+}
+
+/// Returns whether it's time to draw another frame.
+///
+/// With `fps`, this never waits: frames are skipped until enough time has passed, so the program
+/// runs flat out in the meantime. Otherwise every frame is drawn, sleeping until `sleep_ms` has
+/// passed since the last one.
+pub fn isDue(renderer: *Renderer) bool {
+    const now = std.time.Instant.now() catch return true;
+    const elapsed = if (renderer.last_frame) |last| now.since(last) else std.math.maxInt(u64);
+
+    if (renderer.fps) |fps| {
+        if (elapsed < std.time.ns_per_s / fps) return false;
+    } else {
+        const interval = @as(u64, renderer.sleep_ms) * std.time.ns_per_ms;
+        if (elapsed < interval) std.time.sleep(interval - elapsed);
+    }
+
+    renderer.last_frame = std.time.Instant.now() catch now;
+    return true;
+}
+
+/// Draws `frame` to `file`.
+pub fn draw(renderer: *Renderer, alloc: Allocator, frame: Frame, file: std.fs.File) !void {
+    const maze = frame.maze;
+    const width = maze.max_x;
+    const height = maze.lineCount();
+
+    const full = renderer.dirty or renderer.output_written != frame.output_written or
+        width != renderer.width or height != renderer.height;
+
+    try renderer.next.resize(alloc, width * height);
+    renderer.fill(frame);
+
+    renderer.out.clearRetainingCapacity();
+    const writer = renderer.out.writer(alloc);
+
+    // The rows above the maze are the tick, filename, and x axis; the columns to its left are the
+    // y axis and a space.
+    const heading_rows = if (width == 0) 0 else std.math.log10(width) + 1;
+    const top = 2 + heading_rows;
+    const y_len = std.fmt.count("{d}", .{height - 1});
+    const margin = y_len + 1;
+
+    if (full) {
+        try writer.writeAll("\x1B[?25l\x1B[1;1H\x1B[2J");
+        try writer.print("tick {d}\nfile: {s}\n", .{ frame.generation, maze.filename });
+        if (width != 0) try Maze.printXHeadings(writer, width, y_len);
+    } else {
+        try writer.print("\x1B[1;1Htick {d}", .{frame.generation});
+    }
+
+    var colour: ?u8 = null;
+    for (0..height) |y| {
+        const row = renderer.next.items[y * width ..][0..width];
+        // The column the terminal's cursor is at, if it's known.
+        var at: ?usize = null;
+
+        if (full) {
+            try moveTo(writer, top + y, 0);
+            try writer.print("{[y]d: >[l]} ", .{ .y = y, .l = y_len });
+            at = 0;
+        }
+
+        for (row, 0..) |cell, x| {
+            if (!full and cell.eql(renderer.cells.items[y * width + x])) continue;
+            if (at != x) try moveTo(writer, top + y, margin + x);
+
+            if (cell.colour != colour) {
+                if (cell.colour) |c| try writer.print("\x1B[48;5;{d}m", .{c}) else try writer.writeAll("\x1B[0m");
+                colour = cell.colour;
+            }
+
+            try writer.writeByte(cell.byte);
+            at = x + 1;
+        }
+    }
+
+    if (colour != null) try writer.writeAll("\x1B[0m");
+    try renderer.drawFooter(alloc, frame.footer, top + height + 1, full);
+
+    std.mem.swap(std.ArrayListUnmanaged(Cell), &renderer.cells, &renderer.next);
+    renderer.width = width;
+    renderer.height = height;
+    renderer.output_written = frame.output_written;
+    renderer.dirty = false;
+
+    try file.writeAll(renderer.out.items);
+}
+
+/// Fills `next` with the maze and minotaurs in `frame`.
+fn fill(renderer: *Renderer, frame: Frame) void {
+    const maze = frame.maze;
+    const width = maze.max_x;
+
+    for (0..maze.lineCount()) |y| {
+        const line = maze.getLine(y);
+        const row = renderer.next.items[y * width ..][0..width];
+        for (row[0..line.len], line) |*cell, byte|
+            cell.* = .{ .byte = if (std.ascii.isPrint(byte)) byte else ' ' };
+        @memset(row[line.len..], .{});
+    }
+
+    // Go backwards, so that newer positions, and minotaurs earlier on, are drawn on top.
+    var id = frame.positions.len;
+    while (id != 0) {
+        id -= 1;
+        var age: usize = Minotaur.positions_count;
+        while (age != 0) {
+            age -= 1;
+            const pos = frame.positions[id][age];
+            if (width <= pos.x or maze.lineCount() <= pos.y) continue;
+
+            const colour = @as(u8, @truncate(frame.colours[id] % 36)) + 16 + 36 * (5 - @as(u8, @truncate(age)));
+            renderer.next.items[@as(usize, pos.y) * width + pos.x].colour = colour;
+        }
+    }
+}
+
+/// Draws each line of `footer` that's changed, starting at `top`.
+fn drawFooter(renderer: *Renderer, alloc: Allocator, footer: []const u8, top: usize, full: bool) !void {
+    const writer = renderer.out.writer(alloc);
+    var new_lines = std.mem.splitScalar(u8, footer, '\n');
+    var old_lines = std.mem.splitScalar(u8, renderer.footer.items, '\n');
+    var row = top;
+
+    while (new_lines.next()) |line| : (row += 1) {
+        const old = old_lines.next();
+        if (!full and old != null and std.mem.eql(u8, old.?, line)) continue;
+
+        try moveTo(writer, row, 0);
+        try writer.writeAll(line);
+        try writer.writeAll("\x1B[K");
+    }
+
+    // Clear out anything left over from a longer footer.
+    if (old_lines.next() != null) {
+        try moveTo(writer, row, 0);
+        try writer.writeAll("\x1B[J");
+    }
+
+    renderer.rows = row;
+    renderer.footer.clearRetainingCapacity();
+    try renderer.footer.appendSlice(alloc, footer);
+}
+
+fn moveTo(writer: anytype, row: usize, col: usize) !void {
+    try writer.print("\x1B[{d};{d}H", .{ row + 1, col + 1 });
+}
+
+/// Moves the cursor below the last frame and shows it again, so anything written afterwards
+/// doesn't end up on top of it.
+pub fn finish(renderer: *Renderer, file: std.fs.File) !void {
+    if (renderer.dirty) return; // nothing was ever drawn.
+    try file.writer().print("\x1B[{d};1H\x1B[?25h", .{renderer.rows + 1});
+}
@@ -0,0 +1,173 @@
+//! A size-class slab allocator for the small objects the interpreter churns through, mainly
+//! `Array` nodes and short value buffers.
+//!
+//! Small allocations are rounded up to a size class and carved out of large slabs from `child`.
+//! Freed objects go onto their class's free list to be reused, and are only returned to `child`
+//! once the whole allocator's deinitialized. Anything bigger than the largest class (or that needs
+//! a stricter alignment) goes straight to `child`.
+//!
+//! When runtime safety is on, the amount of live objects in each class is tracked so that leaks
+//! are still reported by `deinit`, even though `child` only ever sees whole slabs.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const SlabAllocator = @This();
+
+/// The size of each class; allocations are rounded up to the smallest one that fits.
+pub const class_sizes = [_]usize{ 16, 32, 48, 64, 96, 128, 192, 256 };
+const max_class_size = class_sizes[class_sizes.len - 1];
+
+/// How much memory is requested from `child` at a time.
+const slab_size = 64 * 1024;
+
+/// Every object is aligned to this, as every class size is a multiple of it.
+const slab_align = 16;
+
+const track_leaks = std.debug.runtime_safety;
+
+const FreeNode = struct { next: ?*FreeNode };
+
+const Class = struct {
+    free: ?*FreeNode = null,
+    /// The part of this class's newest slab that hasn't been handed out yet.
+    fresh: []u8 = &.{},
+    /// How many objects are currently allocated; only tracked when `track_leaks` is set.
+    live: usize = 0,
+};
+
+pub const Options = struct {
+    /// Whether the allocator can be used from multiple threads at once.
+    thread_safe: bool = false,
+};
+
+child: Allocator,
+classes: [class_sizes.len]Class = [_]Class{.{}} ** class_sizes.len,
+slabs: std.ArrayListUnmanaged([]align(slab_align) u8) = .{},
+mutex: std.Thread.Mutex = .{},
+thread_safe: bool,
+
+pub fn init(child: Allocator, options: Options) SlabAllocator {
+    return .{ .child = child, .thread_safe = options.thread_safe };
+}
+
+/// Frees every slab, returning `.leak` if any objects were never freed.
+pub fn deinit(slab: *SlabAllocator) std.heap.Check {
+    var check = std.heap.Check.ok;
+
+    if (track_leaks) for (slab.classes, class_sizes) |class, size| {
+        if (class.live == 0) continue;
+        std.log.err("slab allocator: {d} objects of size {d} leaked", .{ class.live, size });
+        check = .leak;
+    };
+
+    for (slab.slabs.items) |memory| slab.child.free(memory);
+    slab.slabs.deinit(slab.child);
+    slab.* = undefined;
+    return check;
+}
+
+pub fn allocator(slab: *SlabAllocator) Allocator {
+    return .{
+        .ptr = slab,
+        .vtable = &.{ .alloc = alloc, .resize = resize, .free = free },
+    };
+}
+
+/// Which entry of `class_sizes` an allocation of `len` bytes falls into, indexed by `len / 16`
+/// rounded up.
+const class_table = blk: {
+    var table: [max_class_size / slab_align + 1]u8 = undefined;
+    var class = 0;
+    for (&table, 0..) |*entry, i| {
+        while (class_sizes[class] < i * slab_align) class += 1;
+        entry.* = class;
+    }
+    break :blk table;
+};
+
+fn classOf(len: usize, log2_align: u8) ?usize {
+    if (max_class_size < len or slab_align < (@as(usize, 1) << @intCast(log2_align))) return null;
+    return class_table[std.math.divCeil(usize, len, slab_align) catch unreachable];
+}
+
+fn lock(slab: *SlabAllocator) void {
+    if (slab.thread_safe) slab.mutex.lock();
+}
+
+fn unlock(slab: *SlabAllocator) void {
+    if (slab.thread_safe) slab.mutex.unlock();
+}
+
+fn newSlab(slab: *SlabAllocator) ?[]u8 {
+    slab.slabs.ensureUnusedCapacity(slab.child, 1) catch return null;
+    const memory = slab.child.alignedAlloc(u8, slab_align, slab_size) catch return null;
+    slab.slabs.appendAssumeCapacity(memory);
+    return memory;
+}
+
+fn alloc(ctx: *anyopaque, len: usize, log2_align: u8, ret_addr: usize) ?[*]u8 {
+    const slab: *SlabAllocator = @ptrCast(@alignCast(ctx));
+    const idx = classOf(len, log2_align) orelse return slab.child.rawAlloc(len, log2_align, ret_addr);
+
+    slab.lock();
+    defer slab.unlock();
+
+    const class = &slab.classes[idx];
+    const ptr: [*]u8 = if (class.free) |node| blk: {
+        class.free = node.next;
+        break :blk @ptrCast(node);
+    } else blk: {
+        const size = class_sizes[idx];
+        if (class.fresh.len < size) class.fresh = slab.newSlab() orelse return null;
+        const fresh = class.fresh.ptr;
+        class.fresh = class.fresh[size..];
+        break :blk fresh;
+    };
+
+    if (track_leaks) class.live += 1;
+    return ptr;
+}
+
+fn resize(ctx: *anyopaque, buf: []u8, log2_align: u8, new_len: usize, ret_addr: usize) bool {
+    const slab: *SlabAllocator = @ptrCast(@alignCast(ctx));
+    const old_class = classOf(buf.len, log2_align);
+    const new_class = classOf(new_len, log2_align);
+
+    // Objects can only change size within their class, and big ones can't become small.
+    if (old_class == null and new_class == null) return slab.child.rawResize(buf, log2_align, new_len, ret_addr);
+    return old_class != null and new_class != null and old_class.? == new_class.?;
+}
+
+fn free(ctx: *anyopaque, buf: []u8, log2_align: u8, ret_addr: usize) void {
+    const slab: *SlabAllocator = @ptrCast(@alignCast(ctx));
+    const idx = classOf(buf.len, log2_align) orelse return slab.child.rawFree(buf, log2_align, ret_addr);
+
+    slab.lock();
+    defer slab.unlock();
+
+    const class = &slab.classes[idx];
+    if (track_leaks) class.live -= 1;
+
+    const node: *FreeNode = @ptrCast(@alignCast(buf.ptr));
+    node.* = .{ .next = class.free };
+    class.free = node;
+}
+
+test "freed objects are reused, and big ones go to the child" {
+    var slab = SlabAllocator.init(std.testing.allocator, .{});
+    defer std.debug.assert(slab.deinit() == .ok);
+    const a = slab.allocator();
+
+    const first = try a.create([40]u8);
+    a.destroy(first);
+    const second = try a.create([33]u8);
+    try std.testing.expectEqual(@intFromPtr(first), @intFromPtr(second));
+    a.destroy(second);
+
+    const big = try a.alloc(u8, max_class_size + 1);
+    defer a.free(big);
+    try std.testing.expectEqual(@as(usize, 1), slab.slabs.items.len);
+
+    try std.heap.testAllocator(a);
+    try std.heap.testAlignedAllocator(a);
+}
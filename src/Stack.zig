@@ -0,0 +1,306 @@
+//! A minotaur's stack, which can be cloned in O(1).
+//!
+//! Cloning freezes the values pushed since the last clone into an immutable, refcounted `Segment`,
+//! which both the original and the clone then share. Each stack only owns what's been pushed since
+//! then (`top`); values are copied out of the shared segments lazily, once something below `top`
+//! is popped or removed, and only as many as are needed.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Value = @import("Value.zig");
+const IntType = @import("types.zig").IntType;
+const MemStats = @import("MemStats.zig");
+const Stack = @This();
+
+/// Chains of segments deeper than this are flattened into one segment when cloning, so that
+/// indexing into the shared part of a stack doesn't get slower forever.
+const max_depth = 32;
+
+/// An immutable run of values which is shared between stacks.
+pub const Segment = struct {
+    refcount: u32 = 1,
+    /// How many segments are below this one, including itself.
+    depth: u32,
+    /// The segment below this one, if any.
+    parent: ?*Segment,
+    /// How many values are below `values`, ie the index of `values[0]` in the stack.
+    base: usize,
+    values: []Value,
+    /// What the arrays and big integers in `values` were charged the first time the segment's
+    /// footprint was taken (see `Stack.footprint`), so they're only walked once.
+    value_bytes: ?usize = null,
+
+    pub fn increment(segment: *Segment) void {
+        _ = @atomicRmw(u32, &segment.refcount, .Add, 1, .monotonic);
+    }
+
+    pub fn decrement(segment: *Segment, alloc: Allocator) void {
+        var current: ?*Segment = segment;
+
+        // Loop instead of recursing, so long chains can't overflow the stack.
+        while (current) |seg| {
+            if (@atomicRmw(u32, &seg.refcount, .Sub, 1, .acq_rel) != 1) return;
+
+            current = seg.parent;
+            for (seg.values) |value| value.deinit(alloc);
+            alloc.free(seg.values);
+            alloc.destroy(seg);
+        }
+    }
+};
+
+/// The shared values at the bottom of the stack, if any.
+shared: ?*Segment = null,
+/// How many values of `shared` (and the segments below it) are on the stack; anything past this
+/// was popped after the segment was frozen.
+shared_len: usize = 0,
+/// The values that have been pushed since the stack was last cloned.
+top: std.ArrayListUnmanaged(Value) = .{},
+
+pub fn initCapacity(alloc: Allocator, cap: usize) Allocator.Error!Stack {
+    const scope = MemStats.enter(.stack);
+    defer scope.leave();
+    return .{ .top = try std.ArrayListUnmanaged(Value).initCapacity(alloc, cap) };
+}
+
+/// Deinitializes the stack and every value on it.
+pub fn deinit(stack: *Stack, alloc: Allocator) void {
+    for (stack.top.items) |value| value.deinit(alloc);
+    stack.top.deinit(alloc);
+    if (stack.shared) |shared| shared.decrement(alloc);
+    stack.* = undefined;
+}
+
+/// Returns a copy of `stack` which shares all its values with it.
+///
+/// This is why `stack` has to be mutable: everything that's been pushed onto it is moved into a new
+/// segment, which both stacks then share.
+pub fn clone(stack: *Stack, alloc: Allocator) Allocator.Error!Stack {
+    try stack.freeze(alloc);
+    if (stack.shared) |shared| shared.increment();
+    return .{ .shared = stack.shared, .shared_len = stack.shared_len };
+}
+
+fn freeze(stack: *Stack, alloc: Allocator) Allocator.Error!void {
+    if (stack.top.items.len == 0) return;
+
+    const depth = if (stack.shared) |shared| shared.depth + 1 else 1;
+    if (max_depth < depth) return stack.flatten(alloc);
+
+    const scope = MemStats.enter(.stack);
+    defer scope.leave();
+    const segment = try alloc.create(Segment);
+    errdefer alloc.destroy(segment);
+    const values = try stack.top.toOwnedSlice(alloc);
+
+    segment.* = .{ .depth = depth, .parent = stack.shared, .base = stack.shared_len, .values = values };
+    stack.shared = segment;
+    stack.shared_len += values.len;
+}
+
+/// Copies the entire stack into a single new segment.
+fn flatten(stack: *Stack, alloc: Allocator) Allocator.Error!void {
+    const scope = MemStats.enter(.stack);
+    defer scope.leave();
+    const total = stack.len();
+    const values = try alloc.alloc(Value, total);
+    errdefer alloc.free(values);
+    const segment = try alloc.create(Segment);
+
+    for (values[0..stack.shared_len], 0..) |*value, idx| value.* = stack.sharedAt(idx).clone();
+    @memcpy(values[stack.shared_len..], stack.top.items);
+    stack.top.clearRetainingCapacity();
+
+    segment.* = .{ .depth = 1, .parent = null, .base = 0, .values = values };
+    if (stack.shared) |shared| shared.decrement(alloc);
+    stack.shared = segment;
+    stack.shared_len = total;
+}
+
+pub inline fn len(stack: *const Stack) usize {
+    return stack.shared_len + stack.top.items.len;
+}
+
+/// Roughly how many bytes the stack's values take up, including the arrays and big integers they
+/// refer to (see `Value.footprint`). Each shared segment is split evenly between the stacks that
+/// refer to it at the time.
+///
+/// This isn't thread safe, as it fills in each segment's `value_bytes`.
+pub fn footprint(stack: *const Stack) usize {
+    var bytes = stack.top.capacity * @sizeOf(Value);
+    for (stack.top.items) |value| bytes += value.footprint();
+
+    var segment = stack.shared;
+    while (segment) |seg| : (segment = seg.parent) {
+        const value_bytes = seg.value_bytes orelse blk: {
+            var total: usize = 0;
+            for (seg.values) |value| total += value.footprint();
+            seg.value_bytes = total;
+            break :blk total;
+        };
+        const refcount = @atomicLoad(u32, &seg.refcount, .monotonic);
+        bytes += (@sizeOf(Segment) + seg.values.len * @sizeOf(Value) + value_bytes) / @max(refcount, 1);
+    }
+    return bytes;
+}
+
+/// Returns whether `stack` and `other` hold equal values. The bottom of them isn't looked at if it's
+/// still shared between them.
+pub fn equals(stack: *const Stack, other: *const Stack) bool {
+    if (stack.len() != other.len()) return false;
+
+    const shared = if (stack.shared == other.shared) @min(stack.shared_len, other.shared_len) else 0;
+    for (shared..stack.len()) |idx| {
+        if (!stack.at(idx).equals(other.at(idx))) return false;
+    }
+    return true;
+}
+
+/// Returns the `idx`th value from the bottom of the shared part of the stack.
+fn sharedAt(stack: *const Stack, idx: usize) Value {
+    std.debug.assert(idx < stack.shared_len);
+
+    var segment = stack.shared.?;
+    while (idx < segment.base) segment = segment.parent.?;
+    return segment.values[idx - segment.base];
+}
+
+/// Returns the `idx`th value from the bottom of the stack, without cloning it.
+pub fn at(stack: *const Stack, idx: usize) Value {
+    if (idx < stack.shared_len) return stack.sharedAt(idx);
+    return stack.top.items[idx - stack.shared_len];
+}
+
+/// Returns the `fromEnd`th value from the top of the stack, without cloning it.
+pub fn peek(stack: *const Stack, fromEnd: usize) Value {
+    return stack.at(stack.len() - fromEnd - 1);
+}
+
+pub fn push(stack: *Stack, alloc: Allocator, value: Value) Allocator.Error!void {
+    const scope = MemStats.enter(.stack);
+    defer scope.leave();
+    try stack.top.append(alloc, value);
+}
+
+/// Removes the `fromEnd`th value from the top of the stack and returns it, moving everything above
+/// it down. It must be in bounds.
+pub fn remove(stack: *Stack, alloc: Allocator, fromEnd: usize) Allocator.Error!Value {
+    std.debug.assert(fromEnd < stack.len());
+
+    if (fromEnd == 0 and stack.top.items.len == 0) {
+        const value = stack.sharedAt(stack.shared_len - 1).clone();
+        stack.dropShared(alloc, 1);
+        return value;
+    }
+
+    if (stack.top.items.len <= fromEnd) try stack.thaw(alloc, fromEnd + 1 - stack.top.items.len);
+
+    const idx = stack.top.items.len - fromEnd - 1;
+    return switch (fromEnd) {
+        0 => stack.top.pop(),
+        1 => stack.top.swapRemove(idx),
+        else => stack.top.orderedRemove(idx),
+    };
+}
+
+/// Returns the topmost `count` values, so they can be changed in place. Any of them that are shared
+/// are copied into `top` first.
+pub fn topValues(stack: *Stack, alloc: Allocator, count: usize) (error{StackTooSmall} || Allocator.Error)![]Value {
+    if (stack.len() < count) return error.StackTooSmall;
+    if (stack.top.items.len < count) try stack.thaw(alloc, count - stack.top.items.len);
+    return stack.top.items[stack.top.items.len - count ..];
+}
+
+/// Copies the topmost `count` shared values into `top`, so they can be modified.
+fn thaw(stack: *Stack, alloc: Allocator, count: usize) Allocator.Error!void {
+    const start = stack.shared_len - count;
+    const scope = MemStats.enter(.stack);
+    defer scope.leave();
+    try stack.top.ensureUnusedCapacity(alloc, count);
+
+    const old = stack.top.items.len;
+    stack.top.items.len += count;
+    std.mem.copyBackwards(Value, stack.top.items[count..], stack.top.items[0..old]);
+    for (stack.top.items[0..count], start..) |*value, idx| value.* = stack.sharedAt(idx).clone();
+
+    stack.dropShared(alloc, count);
+}
+
+/// Stops sharing the topmost `count` shared values, releasing segments that are no longer used.
+fn dropShared(stack: *Stack, alloc: Allocator, count: usize) void {
+    stack.shared_len -= count;
+
+    while (stack.shared) |shared| {
+        if (shared.base < stack.shared_len) break;
+
+        stack.shared = shared.parent;
+        if (shared.parent) |parent| parent.increment();
+        shared.decrement(alloc);
+    }
+}
+
+test "clones share values until they're modified" {
+    const alloc = std.testing.allocator;
+
+    var stack = Stack{};
+    defer stack.deinit(alloc);
+    for (0..4) |i| try stack.push(alloc, Value.from(@as(IntType, @intCast(i))));
+
+    var copy = try stack.clone(alloc);
+    defer copy.deinit(alloc);
+    try std.testing.expectEqual(@as(usize, 0), stack.top.items.len);
+    try std.testing.expectEqual(stack.shared, copy.shared);
+
+    try copy.push(alloc, Value.from(9));
+    try std.testing.expectEqual(@as(IntType, 2), (try copy.remove(alloc, 2)).toInt());
+    try std.testing.expectEqual(@as(IntType, 3), (try stack.remove(alloc, 0)).toInt());
+
+    try std.testing.expectEqual(@as(usize, 4), copy.len());
+    try std.testing.expectEqual(@as(usize, 3), stack.len());
+    for ([_]IntType{ 0, 1, 3, 9 }, 0..) |expected, idx|
+        try std.testing.expectEqual(expected, try copy.at(idx).toInt());
+}
+
+test "stacks are equal whether or not they're shared" {
+    const alloc = std.testing.allocator;
+
+    var stack = Stack{};
+    defer stack.deinit(alloc);
+    for (0..3) |i| try stack.push(alloc, Value.from(@as(IntType, @intCast(i))));
+
+    var copy = try stack.clone(alloc);
+    defer copy.deinit(alloc);
+    try std.testing.expect(stack.equals(&copy));
+
+    var other = Stack{};
+    defer other.deinit(alloc);
+    for (0..3) |i| try other.push(alloc, Value.from(@as(IntType, @intCast(i))));
+    try std.testing.expect(other.equals(&copy));
+
+    _ = try copy.remove(alloc, 0);
+    try copy.push(alloc, Value.from(7));
+    try std.testing.expect(!stack.equals(&copy));
+}
+
+test "top values are copied out of shared ones before they're changed" {
+    const alloc = std.testing.allocator;
+
+    var stack = Stack{};
+    defer stack.deinit(alloc);
+    for (0..4) |i| try stack.push(alloc, Value.from(@as(IntType, @intCast(i))));
+
+    var copy = try stack.clone(alloc);
+    defer copy.deinit(alloc);
+    try std.testing.expectError(error.StackTooSmall, copy.topValues(alloc, 5));
+
+    const top = try copy.topValues(alloc, 2);
+    try std.testing.expectEqual(@as(IntType, 2), try top[0].toInt());
+    try std.testing.expectEqual(@as(IntType, 3), try top[1].toInt());
+    top[1] = Value.from(9);
+
+    _ = try copy.topValues(alloc, 1);
+    try std.testing.expectEqual(@as(usize, 2), copy.top.items.len);
+    try std.testing.expectEqual(@as(usize, 4), copy.len());
+    try std.testing.expectEqual(@as(IntType, 9), try copy.peek(0).toInt());
+    try std.testing.expectEqual(@as(IntType, 3), try stack.peek(0).toInt());
+}
@@ -0,0 +1,326 @@
+//! The timelines minotaurs have branched off with `B`, `b`, and `V`, by id.
+//!
+//! A timeline is a clone of the minotaur that made it, so its stack shares segments with it (see
+//! `Stack`) instead of being copied. Each timeline is charged for roughly how much memory it keeps
+//! alive when it's stored (see `Minotaur.footprint`), and if there's a `cap` on the total, older
+//! timelines make room for newer ones according to `policy`: they're either evicted for good, or
+//! spilled to a file and read back in when a minotaur travels to them. The space a timeline took
+//! up in the file is reused once it's been read back in.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Minotaur = @import("Minotaur.zig");
+const Value = @import("Value.zig");
+const IntType = @import("types.zig").IntType;
+const Labyrinth = @import("Labyrinth.zig");
+const checkpoint = @import("checkpoint.zig");
+const MemStats = @import("MemStats.zig");
+const TimelineStore = @This();
+
+pub const Policy = enum {
+    /// Branching is an error once the cap's reached.
+    @"error",
+    /// The oldest timelines are dropped, and travelling to them is an error.
+    evict,
+    /// The timelines that were stored or travelled to longest ago are written to `spill`.
+    spill,
+};
+
+pub const Error = error{ TooManyTimelines, TimelineEvicted } || Labyrinth.MinotaurGetError ||
+    Allocator.Error || checkpoint.Error || std.fs.File.PReadError || std.fs.File.PWriteError;
+
+/// A run of bytes in `spill`.
+pub const Extent = struct { offset: u64, len: u64 };
+
+pub const State = union(enum) {
+    resident: Minotaur,
+    evicted,
+    /// Where the timeline's image is in `spill` (see `checkpoint.writeMinotaur`).
+    spilled: Extent,
+};
+
+pub const Entry = struct {
+    state: State,
+    /// What the timeline was charged when it was stored; only resident timelines count towards
+    /// `bytes`.
+    bytes: usize = 0,
+    /// Bumped each time the timeline's put in `queue`, so older places in it can be told apart.
+    stamp: u32 = 0,
+};
+
+const Queued = struct { id: usize, stamp: u32 };
+
+/// If set, the most `bytes` can be. A single timeline that's bigger than this is still kept.
+cap: ?usize = null,
+policy: Policy = .@"error",
+entries: std.ArrayListUnmanaged(Entry) = .{},
+/// How many bytes the resident timelines were charged in total.
+bytes: usize = 0,
+/// Resident timelines, least recently stored or travelled to first, starting at `queue_head`.
+/// Places whose stamp doesn't match their entry's are stale, and skipped.
+queue: std.ArrayListUnmanaged(Queued) = .{},
+queue_head: usize = 0,
+/// Where spilled timelines go, with `policy == .spill`; see `openSpill`.
+spill: ?std.fs.File = null,
+spill_path: []const u8 = "",
+spill_len: u64 = 0,
+/// The parts of `spill` that timelines have been read back in from, sorted by offset. Holes that
+/// touch are merged, and the file's shrunk instead of ending in one.
+holes: std.ArrayListUnmanaged(Extent) = .{},
+
+pub fn deinit(store: *TimelineStore, alloc: Allocator) void {
+    for (store.entries.items) |*entry| switch (entry.state) {
+        .resident => |*minotaur| minotaur.deinit(),
+        .evicted, .spilled => {},
+    };
+    store.entries.deinit(alloc);
+    store.queue.deinit(alloc);
+    store.holes.deinit(alloc);
+
+    if (store.spill) |file| {
+        file.close();
+        std.fs.cwd().deleteFile(store.spill_path) catch {};
+    }
+    store.* = undefined;
+}
+
+/// Creates the file at `path` that timelines are spilled to. It's deleted again by `deinit`.
+pub fn openSpill(store: *TimelineStore, path: []const u8) std.fs.File.OpenError!void {
+    store.spill = try std.fs.cwd().createFile(path, .{ .read = true, .truncate = true });
+    store.spill_path = path;
+}
+
+pub fn len(store: *const TimelineStore) usize {
+    return store.entries.items.len;
+}
+
+/// Stores `minotaur` as a new timeline, returning its id. If this fails, `minotaur` still belongs to
+/// the caller.
+pub fn add(store: *TimelineStore, alloc: Allocator, minotaur: Minotaur) Error!usize {
+    const scope = MemStats.enter(.timeline);
+    defer scope.leave();
+
+    const bytes = minotaur.footprint();
+    try store.makeRoom(alloc, bytes);
+
+    try store.entries.ensureUnusedCapacity(alloc, 1);
+    try store.queue.ensureUnusedCapacity(alloc, 1);
+    const id = store.entries.items.len;
+    store.entries.appendAssumeCapacity(.{ .state = .{ .resident = minotaur }, .bytes = bytes });
+    store.enqueue(id);
+    store.bytes += bytes;
+    return id;
+}
+
+/// Adds a timeline that was evicted, when restoring a checkpoint.
+pub fn addEvicted(store: *TimelineStore, alloc: Allocator) Allocator.Error!void {
+    try store.entries.append(alloc, .{ .state = .evicted });
+}
+
+/// Adds a timeline that was spilled as `image`, when restoring a checkpoint. It's spilled again if
+/// there's somewhere to put it, and read back in otherwise.
+pub fn addSpilled(store: *TimelineStore, alloc: Allocator, image: []const u8) Error!void {
+    if (store.spill != null) {
+        try store.entries.ensureUnusedCapacity(alloc, 1);
+        store.entries.appendAssumeCapacity(.{ .state = .{ .spilled = try store.writeSpill(image) } });
+        return;
+    }
+
+    var minotaur = try checkpoint.readMinotaur(alloc, image);
+    errdefer minotaur.deinit();
+    _ = try store.add(alloc, minotaur);
+}
+
+/// Gets timeline `id`, reading it back in if it was spilled. The pointer is only valid until the
+/// next timeline's added or read back in.
+pub fn get(store: *TimelineStore, alloc: Allocator, id: usize) Error!*Minotaur {
+    if (store.entries.items.len <= id) return error.MinotaurDoesntExist;
+
+    switch (store.entries.items[id].state) {
+        .resident => |*minotaur| return minotaur,
+        .evicted => return error.TimelineEvicted,
+        .spilled => {},
+    }
+
+    const scope = MemStats.enter(.timeline);
+    defer scope.leave();
+    const image = try store.readSpilled(alloc, id);
+    defer alloc.free(image);
+    var minotaur = try checkpoint.readMinotaur(alloc, image);
+    errdefer minotaur.deinit();
+
+    const bytes = minotaur.footprint();
+    try store.makeRoom(alloc, bytes);
+    try store.queue.ensureUnusedCapacity(alloc, 1);
+    try store.holes.ensureUnusedCapacity(alloc, 1);
+
+    const entry = &store.entries.items[id];
+    store.freeSpill(entry.state.spilled);
+    entry.* = .{ .state = .{ .resident = minotaur }, .bytes = bytes, .stamp = entry.stamp };
+    store.enqueue(id);
+    store.bytes += bytes;
+    return &entry.state.resident;
+}
+
+/// Reads the image of spilled timeline `id` into memory that's allocated with `alloc`.
+pub fn readSpilled(store: *const TimelineStore, alloc: Allocator, id: usize) Error![]u8 {
+    const spilled = store.entries.items[id].state.spilled;
+    const image = try alloc.alloc(u8, std.math.cast(usize, spilled.len) orelse return error.InvalidCheckpoint);
+    errdefer alloc.free(image);
+    if (try store.spill.?.preadAll(image, spilled.offset) != image.len) return error.InvalidCheckpoint;
+    return image;
+}
+
+/// Evicts or spills the oldest resident timelines until there's room for `bytes` more.
+fn makeRoom(store: *TimelineStore, alloc: Allocator, bytes: usize) Error!void {
+    const cap = store.cap orelse return;
+    if (store.bytes + bytes <= cap) return;
+    if (store.policy == .@"error") return error.TooManyTimelines;
+
+    while (cap < store.bytes + bytes) {
+        const id = store.dequeue() orelse return;
+        const entry = &store.entries.items[id];
+
+        if (store.policy == .spill) {
+            var image = std.ArrayList(u8).init(alloc);
+            defer image.deinit();
+            try checkpoint.writeMinotaur(alloc, &entry.state.resident, image.writer());
+            const extent = try store.writeSpill(image.items);
+
+            entry.state.resident.deinit();
+            entry.state = .{ .spilled = extent };
+        } else {
+            entry.state.resident.deinit();
+            entry.state = .evicted;
+        }
+
+        store.bytes -= entry.bytes;
+        entry.bytes = 0;
+    }
+}
+
+/// Writes `image` to `spill`, in the first hole that it fits in or else on the end, and returns
+/// where it went.
+fn writeSpill(store: *TimelineStore, image: []const u8) Error!Extent {
+    const hole_idx = for (store.holes.items, 0..) |hole, idx| {
+        if (image.len <= hole.len) break idx;
+    } else null;
+    const offset = if (hole_idx) |idx| store.holes.items[idx].offset else store.spill_len;
+    try store.spill.?.pwriteAll(image, offset);
+
+    if (hole_idx) |idx| {
+        const hole = &store.holes.items[idx];
+        hole.offset += image.len;
+        hole.len -= image.len;
+        if (hole.len == 0) _ = store.holes.orderedRemove(idx);
+    } else {
+        store.spill_len += image.len;
+    }
+    return .{ .offset = offset, .len = image.len };
+}
+
+/// Makes `extent` a hole in `spill`, merging it with the holes either side of it. `holes` must
+/// have room for one more.
+fn freeSpill(store: *TimelineStore, extent: Extent) void {
+    const holes = &store.holes;
+    var hole = extent;
+    var idx: usize = 0;
+    while (idx < holes.items.len and holes.items[idx].offset < hole.offset) idx += 1;
+
+    if (idx < holes.items.len and holes.items[idx].offset == hole.offset + hole.len)
+        hole.len += holes.orderedRemove(idx).len;
+    if (idx != 0 and holes.items[idx - 1].offset + holes.items[idx - 1].len == hole.offset) {
+        idx -= 1;
+        const before = holes.orderedRemove(idx);
+        hole = .{ .offset = before.offset, .len = before.len + hole.len };
+    }
+
+    if (hole.offset + hole.len == store.spill_len) {
+        store.spill_len = hole.offset;
+        store.spill.?.setEndPos(hole.offset) catch {};
+        return;
+    }
+    holes.insertAssumeCapacity(idx, hole);
+}
+
+/// Puts timeline `id` at the back of `queue`, which must have room for it.
+fn enqueue(store: *TimelineStore, id: usize) void {
+    const entry = &store.entries.items[id];
+    entry.stamp +%= 1;
+
+    // Drop the places that have already been taken off the front, once they're most of the queue.
+    if (store.queue.items.len / 2 < store.queue_head) {
+        const rest = store.queue.items[store.queue_head..];
+        std.mem.copyForwards(Queued, store.queue.items[0..rest.len], rest);
+        store.queue.shrinkRetainingCapacity(rest.len);
+        store.queue_head = 0;
+    }
+
+    store.queue.appendAssumeCapacity(.{ .id = id, .stamp = entry.stamp });
+}
+
+/// Takes the least recently used resident timeline off the front of `queue`.
+fn dequeue(store: *TimelineStore) ?usize {
+    while (store.queue_head < store.queue.items.len) {
+        const queued = store.queue.items[store.queue_head];
+        store.queue_head += 1;
+
+        const entry = &store.entries.items[queued.id];
+        if (entry.state == .resident and entry.stamp == queued.stamp) return queued.id;
+    }
+    return null;
+}
+
+test "timelines are spilled and read back in once there's too many" {
+    const alloc = std.testing.allocator;
+    var tmp = std.testing.tmpDir(.{});
+    defer tmp.cleanup();
+    const dir_path = try tmp.dir.realpathAlloc(alloc, ".");
+    defer alloc.free(dir_path);
+    const spill_path = try std.fs.path.join(alloc, &.{ dir_path, "timelines" });
+    defer alloc.free(spill_path);
+
+    var store = TimelineStore{ .policy = .spill };
+    defer store.deinit(alloc);
+    try store.openSpill(spill_path);
+
+    var minotaur = try Minotaur.initCapacity(alloc, 4);
+    defer minotaur.deinit();
+    for (0..3) |i| {
+        try minotaur.push(Value.from(@as(IntType, @intCast(i))));
+        var timeline = try minotaur.clone();
+        errdefer timeline.deinit();
+        _ = try store.add(alloc, timeline);
+    }
+
+    // Only room for one more of them.
+    store.cap = store.bytes - store.entries.items[0].bytes - store.entries.items[1].bytes + 1;
+    try store.makeRoom(alloc, 0);
+    try std.testing.expect(store.entries.items[0].state == .spilled);
+    try std.testing.expect(store.entries.items[1].state == .spilled);
+    try std.testing.expect(store.entries.items[2].state == .resident);
+
+    const first = try store.get(alloc, 0);
+    try std.testing.expectEqual(@as(usize, 1), first.stack.len());
+    try std.testing.expect(store.entries.items[2].state == .spilled);
+
+    try std.testing.expectEqual(@as(usize, 1), store.holes.items.len);
+
+    store.policy = .evict;
+    _ = try store.get(alloc, 1);
+    try std.testing.expect(store.entries.items[0].state == .evicted);
+    try std.testing.expectError(error.TimelineEvicted, store.get(alloc, 0));
+
+    // The second timeline goes where the first two were, and the third's taken off the end.
+    store.policy = .spill;
+    _ = try store.get(alloc, 2);
+    const second = store.entries.items[1].state.spilled;
+    try std.testing.expectEqual(@as(u64, 0), second.offset);
+    try std.testing.expectEqual(second.len, store.spill_len);
+    try std.testing.expectEqual(@as(usize, 0), store.holes.items.len);
+
+    // The spill file's deleted along with the store.
+    store.deinit(alloc);
+    store = .{};
+    try std.testing.expectError(error.FileNotFound, tmp.dir.access("timelines", .{}));
+}
@@ -0,0 +1,149 @@
+//! Keeps track of sleeping minotaurs by the generation they wake up in, so each generation only has
+//! to touch the minotaurs that are awake.
+//!
+//! It's a hashed timing wheel: a sleeper goes in the slot for its wake-up generation modulo
+//! `slot_count`, and each generation only looks at its own slot. Sleepers that are more than a lap
+//! away stay put until it comes around again, so a minotaur sleeping for `n` generations is looked
+//! at `n / slot_count` times, instead of `n`.
+//!
+//! Entries aren't removed when a minotaur is woken up early (see `Labyrinth.setCell`); instead, an
+//! entry is stale if the minotaur's `wake_at` no longer matches it, and it's dropped when it's due.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const MinotaurId = @import("Labyrinth.zig").MinotaurId;
+const TimerWheel = @This();
+
+pub const slot_count = 256;
+
+pub const Entry = struct { id: MinotaurId, wake_at: usize };
+
+slots: [slot_count]std.ArrayListUnmanaged(Entry) = [_]std.ArrayListUnmanaged(Entry){.{}} ** slot_count,
+/// How many entries there are in total, including stale ones.
+len: usize = 0,
+/// The ids returned from the last call to `wake`.
+woken: std.ArrayListUnmanaged(MinotaurId) = .{},
+
+pub fn deinit(wheel: *TimerWheel, alloc: Allocator) void {
+    for (&wheel.slots) |*slot| slot.deinit(alloc);
+    wheel.woken.deinit(alloc);
+    wheel.* = undefined;
+}
+
+/// Parks minotaur `id` until `wake_at`.
+pub fn insert(wheel: *TimerWheel, alloc: Allocator, id: MinotaurId, wake_at: usize) Allocator.Error!void {
+    try wheel.slots[wake_at % slot_count].append(alloc, .{ .id = id, .wake_at = wake_at });
+    wheel.len += 1;
+}
+
+/// Removes everything that's due at `generation`, and returns the ids of the minotaurs which are
+/// waking up, in order. Entries are stale unless `wake_ats[id]` still matches them.
+///
+/// The returned slice is only valid until the next call.
+pub fn wake(wheel: *TimerWheel, alloc: Allocator, generation: usize, wake_ats: []const usize) Allocator.Error![]const MinotaurId {
+    const slot = &wheel.slots[generation % slot_count];
+    wheel.woken.clearRetainingCapacity();
+    try wheel.woken.ensureTotalCapacity(alloc, slot.items.len);
+
+    var kept: usize = 0;
+    for (slot.items) |entry| {
+        if (entry.wake_at != generation) {
+            slot.items[kept] = entry;
+            kept += 1;
+        } else if (wake_ats[entry.id] == generation) {
+            wheel.woken.appendAssumeCapacity(entry.id);
+        }
+    }
+
+    wheel.len -= slot.items.len - kept;
+    slot.shrinkRetainingCapacity(kept);
+
+    // A minotaur that was woken early and then fell asleep again can have two entries.
+    std.mem.sort(MinotaurId, wheel.woken.items, {}, std.sort.asc(MinotaurId));
+    var unique: usize = 0;
+    for (wheel.woken.items) |id| {
+        if (unique != 0 and wheel.woken.items[unique - 1] == id) continue;
+        wheel.woken.items[unique] = id;
+        unique += 1;
+    }
+    wheel.woken.shrinkRetainingCapacity(unique);
+
+    return wheel.woken.items;
+}
+
+/// Returns the soonest generation after `generation` that something's due, if anything's asleep.
+pub fn next(wheel: *const TimerWheel, generation: usize) ?usize {
+    if (wheel.len == 0) return null;
+
+    // Usually something's due within a lap, so look for it slot by slot first.
+    for (1..slot_count + 1) |ahead| {
+        const due = generation + ahead;
+        for (wheel.slots[due % slot_count].items) |entry| {
+            if (entry.wake_at == due) return due;
+        }
+    }
+
+    var soonest: usize = std.math.maxInt(usize);
+    for (wheel.slots) |slot| {
+        for (slot.items) |entry| soonest = @min(soonest, entry.wake_at);
+    }
+    return soonest;
+}
+
+/// Drops the entries of the minotaurs in `slain`, which is sorted, and moves every other id down by
+/// how many slain minotaurs were before it; this is how `Labyrinth` compacts its minotaurs.
+pub fn removeIds(wheel: *TimerWheel, slain: []const MinotaurId) void {
+    for (&wheel.slots) |*slot| {
+        var kept: usize = 0;
+        for (slot.items) |entry| {
+            const below = countBelow(slain, entry.id);
+            if (below < slain.len and slain[below] == entry.id) continue;
+
+            slot.items[kept] = .{ .id = entry.id - below, .wake_at = entry.wake_at };
+            kept += 1;
+        }
+
+        wheel.len -= slot.items.len - kept;
+        slot.shrinkRetainingCapacity(kept);
+    }
+}
+
+/// Moves every id up by how many of `inserted`, which is sorted, are at or below it; this is how
+/// `Labyrinth` makes room for minotaurs in the middle.
+pub fn shiftIds(wheel: *TimerWheel, inserted: []const MinotaurId) void {
+    for (&wheel.slots) |*slot| {
+        for (slot.items) |*entry| entry.id += countBelow(inserted, entry.id + 1);
+    }
+}
+
+/// Returns how many of `sorted` are less than `id`.
+pub fn countBelow(sorted: []const MinotaurId, id: MinotaurId) usize {
+    var low: usize = 0;
+    var high = sorted.len;
+    while (low < high) {
+        const mid = low + (high - low) / 2;
+        if (sorted[mid] < id) low = mid + 1 else high = mid;
+    }
+    return low;
+}
+
+test "sleepers wake up in order, even when they're more than a lap away" {
+    const alloc = std.testing.allocator;
+    var wheel = TimerWheel{};
+    defer wheel.deinit(alloc);
+
+    var wake_ats = [_]usize{ 3, slot_count + 3, 3, 7 };
+    for (wake_ats, 0..) |wake_at, id| try wheel.insert(alloc, id, wake_at);
+    wake_ats[3] = 0; // stale
+
+    try std.testing.expectEqual(@as(?usize, 3), wheel.next(0));
+    try std.testing.expectEqualSlices(MinotaurId, &.{ 0, 2 }, try wheel.wake(alloc, 3, &wake_ats));
+    try std.testing.expectEqual(@as(?usize, 7), wheel.next(3));
+    try std.testing.expectEqualSlices(MinotaurId, &.{}, try wheel.wake(alloc, 7, &wake_ats));
+
+    wheel.removeIds(&.{0});
+    try std.testing.expectEqual(@as(?usize, slot_count + 3), wheel.next(7));
+    wake_ats[0] = slot_count + 3;
+    try std.testing.expectEqualSlices(MinotaurId, &.{0}, try wheel.wake(alloc, slot_count + 3, &wake_ats));
+    try std.testing.expectEqual(@as(usize, 0), wheel.len);
+}
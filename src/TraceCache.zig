@@ -0,0 +1,227 @@
+//! Caches straight-line runs of cells ("traces") which a minotaur can execute all at once.
+//!
+//! A trace starts at a position and velocity, and follows the cells a minotaur would step through
+//! for as long as they only touch the minotaur's own stack, velocity, and literals: no branches on
+//! values, no forks, no i/o, and nothing which reads or writes the maze. Each cell is one `Step`,
+//! decoded ahead of time, so a minotaur running a trace skips fetching and decoding entirely.
+//!
+//! Minotaurs run the whole trace in one go and then sleep for the rest of its steps, so they still
+//! take exactly one tick per cell. Since nothing else can observe a minotaur's state in the
+//! meantime, this is indistinguishable from executing the cells one at a time, except for when
+//! the maze is changed underneath a trace; `Labyrinth.setCell` handles that by invalidating the
+//! cache, and rewinding minotaurs which are part way through (see `Minotaur.settle`).
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Coordinate = @import("Coordinate.zig");
+const Vector = @import("Vector.zig");
+const Function = @import("function.zig").Function;
+const Maze = @import("Maze.zig");
+const TraceCache = @This();
+
+/// The most cells a trace can cover.
+pub const max_steps = 64;
+
+/// Traces shorter than this aren't worth running ahead of time.
+const min_steps = 4;
+
+pub const Key = struct { pos: Coordinate, velocity: Vector };
+
+/// A single cell in a trace, which takes one tick to execute.
+pub const Step = struct { pos: Coordinate, function: Function };
+
+pub const Trace = struct { steps: []const Step };
+
+/// Returns whether any of `steps` read from `pos`.
+pub fn covers(steps: []const Step, pos: Coordinate) bool {
+    for (steps) |step| {
+        if (step.pos.x == pos.x and step.pos.y == pos.y) return true;
+    }
+    return false;
+}
+
+const Retired = struct { trace: *Trace, generation: usize };
+
+/// Whether traces are used at all.
+enabled: bool = true,
+/// Every trace that's been compiled, or `null` for places where there isn't a worthwhile trace.
+traces: std.AutoHashMapUnmanaged(Key, ?*Trace) = .{},
+/// The cells that are covered by any trace in `traces`. It may contain cells that no longer are.
+covered: std.AutoHashMapUnmanaged(Coordinate, void) = .{},
+/// Invalidated traces, which minotaurs may still be in the middle of. They're freed once every
+/// minotaur that could be running them has finished.
+retired: std.ArrayListUnmanaged(Retired) = .{},
+/// How many minotaurs are running a trace.
+in_flight: std.atomic.Value(usize) = std.atomic.Value(usize).init(0),
+
+pub fn deinit(cache: *TraceCache, alloc: Allocator) void {
+    std.debug.assert(cache.inFlight() == 0);
+
+    var iter = cache.traces.valueIterator();
+    while (iter.next()) |trace| if (trace.*) |t| destroy(alloc, t);
+    for (cache.retired.items) |retired| destroy(alloc, retired.trace);
+
+    cache.traces.deinit(alloc);
+    cache.covered.deinit(alloc);
+    cache.retired.deinit(alloc);
+    cache.* = undefined;
+}
+
+fn destroy(alloc: Allocator, trace: *Trace) void {
+    alloc.free(trace.steps);
+    alloc.destroy(trace);
+}
+
+pub inline fn inFlight(cache: *const TraceCache) usize {
+    return cache.in_flight.load(.monotonic);
+}
+
+/// Called when a minotaur starts running a trace.
+pub fn started(cache: *TraceCache) void {
+    _ = cache.in_flight.fetchAdd(1, .monotonic);
+}
+
+/// Called when a minotaur's done with a trace.
+pub fn finished(cache: *TraceCache) void {
+    _ = cache.in_flight.fetchSub(1, .monotonic);
+}
+
+/// Gets the trace starting at `key`, without compiling it if it's not there. This is safe to call
+/// from multiple threads at once, as long as nothing's modifying the cache.
+pub fn get(cache: *const TraceCache, key: Key) ?*const Trace {
+    return cache.traces.get(key) orelse null;
+}
+
+/// Gets the trace starting at `key`, compiling it if it hasn't been yet.
+pub fn getOrCompile(cache: *TraceCache, alloc: Allocator, maze: *const Maze, key: Key) Allocator.Error!?*const Trace {
+    const entry = try cache.traces.getOrPut(alloc, key);
+    if (entry.found_existing) return entry.value_ptr.*;
+    errdefer cache.traces.removeByPtr(entry.key_ptr);
+
+    var steps = std.BoundedArray(Step, max_steps){};
+    compile(maze, key, &steps);
+    if (steps.len < min_steps) {
+        entry.value_ptr.* = null;
+        return null;
+    }
+
+    try cache.covered.ensureUnusedCapacity(alloc, steps.len);
+    const trace = try alloc.create(Trace);
+    errdefer alloc.destroy(trace);
+    trace.* = .{ .steps = try alloc.dupe(Step, steps.slice()) };
+
+    for (steps.slice()) |step| cache.covered.putAssumeCapacity(step.pos, {});
+    entry.value_ptr.* = trace;
+    return trace;
+}
+
+/// Follows the cells a minotaur at `key` would go through, until it reaches one that can't be
+/// part of a trace.
+fn compile(maze: *const Maze, key: Key, steps: *std.BoundedArray(Step, max_steps)) void {
+    var pos = key.pos;
+    var velocity = key.velocity;
+    var mode: enum { normal, integer, string } = .normal;
+
+    while (steps.len < max_steps) {
+        pos = pos.moveBy(velocity) catch return;
+        const function = maze.getFunction(pos) orelse return;
+
+        switch (mode) {
+            .string => {
+                if (function == .str) mode = .normal;
+                steps.appendAssumeCapacity(.{ .pos = pos, .function = function });
+                continue;
+            },
+            // The function after a literal is executed on the same tick the literal's pushed.
+            .integer => if (function.toDigit() == null) {
+                mode = .normal;
+            },
+            .normal => if (function.toDigit() != null) {
+                mode = .integer;
+            },
+        }
+
+        switch (function) {
+            .int0, .int1, .int2, .int3, .int4, .int5, .int6, .int7, .int8, .int9 => {},
+            .str => mode = .string,
+            .left => velocity = Vector.Left,
+            .right => velocity = Vector.Right,
+            .up => velocity = Vector.Up,
+            .down => velocity = Vector.Down,
+            .speedup => velocity = velocity.speedUp(),
+            .slowdown => velocity = velocity.slowDown(),
+            .jump1 => {
+                const skipped = pos.moveBy(velocity) catch return;
+                steps.appendAssumeCapacity(.{ .pos = pos, .function = function });
+                pos = skipped;
+                continue;
+            },
+            // These spawn a minotaur when they're not moving along them.
+            .moveh => if (velocity.x == 0) return,
+            .movev => if (velocity.y == 0) return,
+            else => if (!isPure(function)) return,
+        }
+
+        steps.appendAssumeCapacity(.{ .pos = pos, .function = function });
+    }
+}
+
+/// Returns whether `function` only ever touches the minotaur executing it, and fails with an error
+/// rather than panicking. Comparisons can still panic on arrays, and `get` and `set` aren't safe to
+/// run in parallel either (see `Labyrinth.isParallelSafe`).
+fn isPure(function: Function) bool {
+    return switch (function) {
+        .dup1, .dup2, .dup, .pop1, .pop2, .pop, .swap, .stacklen, .ifpop => true,
+        .neg, .inc, .dec, .add, .sub, .mul, .div, .mod => true,
+        .not, .eql => true,
+        .chr, .ord, .tos, .toi, .len, .head, .tail, .cons => true,
+        else => false,
+    };
+}
+
+/// Invalidates every trace which goes through `pos`. Minotaurs that are running them can keep on
+/// doing so until `collect` is called `max_steps` generations after `generation`.
+pub fn invalidate(cache: *TraceCache, alloc: Allocator, pos: Coordinate, generation: usize) Allocator.Error!void {
+    if (!cache.covered.remove(pos)) return;
+
+    var iter = cache.traces.iterator();
+    while (iter.next()) |entry| {
+        const trace = entry.value_ptr.* orelse continue;
+        if (!covers(trace.steps, pos)) continue;
+
+        try cache.retired.append(alloc, .{ .trace = trace, .generation = generation });
+        cache.traces.removeByPtr(entry.key_ptr);
+    }
+}
+
+/// Frees retired traces which no minotaur can still be running.
+pub fn collect(cache: *TraceCache, alloc: Allocator, generation: usize) void {
+    var kept: usize = 0;
+    for (cache.retired.items) |retired| {
+        if (retired.generation + max_steps < generation) {
+            destroy(alloc, retired.trace);
+        } else {
+            cache.retired.items[kept] = retired;
+            kept += 1;
+        }
+    }
+    cache.retired.shrinkRetainingCapacity(kept);
+}
+
+test "traces stop before anything impure" {
+    const alloc = std.testing.allocator;
+    var maze = try Maze.init(alloc, "test", ">12+\"ab c\".Xv\n            ,\n            p");
+    defer maze.deinit(alloc);
+
+    var cache = TraceCache{};
+    defer cache.deinit(alloc);
+
+    const trace = (try cache.getOrCompile(alloc, &maze, .{ .pos = .{}, .velocity = Vector.Right })).?;
+    try std.testing.expectEqual(@as(usize, 13), trace.steps.len);
+    try std.testing.expectEqual(Function.pop1, trace.steps[12].function);
+
+    try cache.invalidate(alloc, .{ .x = 5 }, 0);
+    try std.testing.expectEqual(@as(?*const Trace, null), cache.get(.{ .pos = .{}, .velocity = Vector.Right }));
+    cache.collect(alloc, max_steps + 1);
+    try std.testing.expectEqual(@as(usize, 0), cache.retired.items.len);
+}
@@ -1,6 +1,8 @@
 const std = @import("std");
 const Allocator = std.mem.Allocator;
 const Array = @import("Array.zig");
+const BigInt = @import("BigInt.zig");
+const kernels = @import("kernels.zig");
 const utils = @import("utils.zig");
 const assert = std.debug.assert;
 const int_type = @import("types.zig");
@@ -12,27 +14,39 @@ const Value = @This();
 pub const ValueType = union(enum) {
     int: IntType,
     ary: *Array,
+    big: *BigInt,
 };
 
 pub const DataType = i64;
 _data: DataType,
 
+/// Big integers are told apart from arrays by this bit, which is always clear in pointers to either.
+const big_tag = 2;
+
+comptime {
+    assert(@alignOf(Array) > big_tag and @alignOf(BigInt) > big_tag);
+}
+
 /// Creates a new value from `val`.
 pub fn from(ty: anytype) Value {
     return switch (@TypeOf(ty)) {
         IntType, comptime_int, u8 => .{ ._data = (@as(DataType, @intCast(ty)) << 1) | 1 },
         bool => Value.from(@as(IntType, if (ty) 1 else 0)),
         *Array => .{ ._data = @as(DataType, @intCast(@intFromPtr(ty))) },
+        *BigInt => .{ ._data = @as(DataType, @intCast(@intFromPtr(ty) | big_tag)) },
         else => @compileError("Value.from error: " ++ @typeName(@TypeOf(ty))),
     };
 }
 
 /// Returns an enum for pattern matching for `value`.
 pub inline fn classify(value: Value) ValueType {
-    return if (value._data & 1 == 1) .{
-        .int = @as(IntType, @intCast(value._data >> 1)),
+    if (value._data & 1 == 1) return .{ .int = @as(IntType, @intCast(value._data >> 1)) };
+
+    const address = @as(usize, @intCast(@as(u64, @intCast(value._data)))) & ~@as(usize, big_tag);
+    return if (value._data & big_tag == 0) .{
+        .ary = @as(*Array, @ptrFromInt(address)),
     } else .{
-        .ary = @as(*Array, @ptrFromInt(@as(usize, @intCast(@as(u64, @intCast(value._data)))))),
+        .big = @as(*BigInt, @ptrFromInt(address)),
     };
 }
 
@@ -41,6 +55,7 @@ pub fn clone(value: Value) Value {
     switch (value.classify()) {
         .int => {},
         .ary => |ary| ary.increment(),
+        .big => |int| int.increment(),
     }
 
     return value;
@@ -51,9 +66,20 @@ pub fn deinit(value: Value, alloc: Allocator) void {
     switch (value.classify()) {
         .int => {},
         .ary => |ary| ary.decrement(alloc),
+        .big => |int| int.decrement(alloc),
     }
 }
 
+/// Roughly how many bytes the array or big integer `value` refers to keeps alive, split evenly
+/// between everything that refers to it at the time; see `Array.footprint`.
+pub fn footprint(value: Value) usize {
+    return switch (value.classify()) {
+        .int => 0,
+        .ary => |ary| ary.footprint(),
+        .big => |int| (@sizeOf(BigInt) + int.limbs.len * @sizeOf(BigInt.Limb)) / @max(@atomicLoad(u32, &int.refcount, .monotonic), 1),
+    };
+}
+
 /// Checks to see if `value` is truthy.
 ///
 /// Only zero and empty arrays are falsey.
@@ -61,6 +87,7 @@ pub fn isTruthy(value: Value) bool {
     return switch (value.classify()) {
         .int => |int| int != 0,
         .ary => |ary| !ary.isEmpty(),
+        .big => true,
     };
 }
 
@@ -72,8 +99,12 @@ pub fn equals(value: Value, other: Value) bool {
     return switch (value.classify()) {
         .int => false,
         .ary => |lhs| switch (other.classify()) {
-            .int => false,
             .ary => |rhs| lhs.equals(rhs),
+            else => false,
+        },
+        .big => |lhs| switch (other.classify()) {
+            .big => |rhs| lhs.toConst().eql(rhs.toConst()),
+            else => false,
         },
     };
 }
@@ -88,9 +119,14 @@ pub fn format(
     comptime fmt: []const u8,
     opts: std.fmt.FormatOptions,
     writer: anytype,
-) std.os.WriteError!void {
+) @TypeOf(writer).Error!void {
     return switch (value.classify()) {
         .ary => |ary| ary.format(fmt, opts, writer),
+        .big => |int| switch (comptime utils.FmtEnum.mustFrom(fmt)) {
+            .d, .any => int.format(writer),
+            // Far too big to be a codepoint.
+            .s => error.Unexpected,
+        },
         .int => |int| {
             switch (comptime utils.FmtEnum.mustFrom(fmt)) {
                 .d, .any => try writer.print("{d}", .{int}),
@@ -107,11 +143,25 @@ pub fn format(
     };
 }
 
-/// Converts `value` to an integer.
+/// Converts `value` to an integer. Big integers don't fit in one, so they're an `Overflow`.
 pub fn toInt(value: Value) Array.ParseIntError!IntType {
     return switch (value.classify()) {
         .int => |int| int,
         .ary => |ary| ary.parseInt(),
+        .big => error.Overflow,
+    };
+}
+
+/// Converts `value` to a number like `toInt`, except strings whose number is too big for an int are
+/// parsed into a big integer.
+pub fn toNumber(value: Value, alloc: Allocator) (Array.ParseIntError || Allocator.Error)!Value {
+    return switch (value.classify()) {
+        .int => value,
+        .big => value.clone(),
+        .ary => |ary| if (ary.parseInt()) |int| Value.from(int) else |err| switch (err) {
+            error.Overflow => BigInt.parse(alloc, ary),
+            else => |e| e,
+        },
     };
 }
 
@@ -123,104 +173,273 @@ pub fn toArray(value: Value, alloc: Allocator) Allocator.Error!*Array {
             ary.increment();
             return ary;
         },
+        .big => |int| return int.toArray(alloc),
     }
 }
 
-pub const MathError = error{ArrayLengthMismatch} || Allocator.Error;
+pub const MathError = error{ArrayLengthMismatch} || kernels.Error || Allocator.Error;
 
-fn mapIt(
-    value: Value,
-    alloc: Allocator,
-    rhs: Value,
-    comptime func: fn (IntType, IntType) IntType,
-) MathError!Value {
-    switch (value.classify()) {
+/// Does `op` to `value` and `rhs`. Ints stay ints until the result would overflow, and then it's
+/// promoted to a big integer.
+fn mapIt(value: Value, alloc: Allocator, rhs: Value, comptime op: kernels.Op) MathError!Value {
+    const lhs_ary = switch (value.classify()) {
         .int => |l| switch (rhs.classify()) {
-            .int => |r| return Value.from(func(l, r)),
-            .ary => |a| {
-                var ary = Array.empty;
-                var iter = a.iter();
-                while (iter.next()) |item|
-                    ary = try ary.prependNoIncrement(alloc, try value.mapIt(alloc, item, func));
-                return Value.from(ary);
+            .int => |r| return if (kernels.apply(op, l, r)) |int| Value.from(int) else |err| switch (err) {
+                error.IntOverflow => mapBig(alloc, value, rhs, op),
+                else => |e| e,
             },
+            .big => return mapBig(alloc, value, rhs, op),
+            .ary => |r| return mapArray(alloc, r.len, value, rhs, op),
         },
-        .ary => |a| switch (rhs.classify()) {
-            .int => {
-                var ary = Array.empty;
-                var iter = a.iter();
-                while (iter.next()) |item|
-                    ary = try ary.prependNoIncrement(alloc, try item.mapIt(alloc, rhs, func));
-                return Value.from(ary);
-            },
-            .ary => |r| {
-                var ary = Array.empty;
-                var liter = a.iter();
-                var riter = r.iter();
-                while (liter.next()) |left| {
-                    const right = riter.next() orelse return error.ArrayLengthMismatch;
-                    ary = try ary.prependNoIncrement(alloc, try left.mapIt(alloc, right, func));
-                }
-
-                return if (riter.next() == null) Value.from(ary) else error.ArrayLengthMismatch;
-            },
+        .big => switch (rhs.classify()) {
+            .int, .big => return mapBig(alloc, value, rhs, op),
+            .ary => |r| return mapArray(alloc, r.len, value, rhs, op),
+        },
+        .ary => |l| l,
+    };
+
+    switch (rhs.classify()) {
+        .int, .big => return mapArray(alloc, lhs_ary.len, value, rhs, op),
+        .ary => |r| {
+            if (lhs_ary.len != r.len) return error.ArrayLengthMismatch;
+            return mapArray(alloc, r.len, value, rhs, op);
         },
     }
 }
 
-pub fn add(value: Value, alloc: Allocator, rhs: Value) MathError!Value {
-    return value.mapIt(alloc, rhs, struct {
-        fn it(a: IntType, b: IntType) IntType {
-            return a + b;
+/// Does `op` to two numbers, at least one of which is big or they'd overflow as ints.
+fn mapBig(alloc: Allocator, lhs: Value, rhs: Value, comptime op: kernels.Op) MathError!Value {
+    var l_limbs: BigInt.IntLimbs = undefined;
+    var r_limbs: BigInt.IntLimbs = undefined;
+    return BigInt.apply(alloc, op, lhs.toBigConst(&l_limbs), rhs.toBigConst(&r_limbs));
+}
+
+/// Returns `value`, which must be an int or a big integer, as a `big.Const`. Ints are stored in
+/// `limbs`.
+fn toBigConst(value: Value, limbs: *BigInt.IntLimbs) std.math.big.int.Const {
+    return switch (value.classify()) {
+        .int => |int| BigInt.constFromInt(limbs, int),
+        .big => |int| int.toConst(),
+        .ary => unreachable,
+    };
+}
+
+/// One side of `mapArray`, which is walked a contiguous run at a time.
+const Operand = struct {
+    /// The number that's broadcast across every element, if it's not an array.
+    int: ?Value,
+    iter: Array.Iterator,
+    run: []const Value = &.{},
+    buffer: [Array.max_small_len]Value = undefined,
+
+    fn init(value: Value) Operand {
+        return switch (value.classify()) {
+            .int, .big => .{ .int = value, .iter = undefined },
+            .ary => |ary| .{ .int = null, .iter = ary.iter() },
+        };
+    }
+
+    /// Returns the values from here on until the end of the current run; ints have a single one.
+    fn peek(operand: *Operand) []const Value {
+        if (operand.int) |*int| return @as(*const [1]Value, int);
+        if (operand.run.len == 0) operand.run = operand.iter.nextRun(&operand.buffer).?;
+        return operand.run;
+    }
+
+    fn skip(operand: *Operand, count: usize) void {
+        if (operand.int == null) operand.run = operand.run[count..];
+    }
+};
+
+/// Does `op` to each of the `len` elements of `lhs` and `rhs`, at least one of which is an array;
+/// numbers are broadcast across every element. Runs of ints are done by `kernels.run`, and anything
+/// else (ie nested arrays, big integers, and results that overflow) recurses.
+fn mapArray(alloc: Allocator, len: usize, lhs: Value, rhs: Value, comptime op: kernels.Op) MathError!Value {
+    var builder = try Array.Builder.initCapacity(alloc, len);
+    errdefer builder.deinit(alloc);
+
+    var left = Operand.init(lhs);
+    var right = Operand.init(rhs);
+
+    while (builder.values.items.len < len) {
+        const l = left.peek();
+        const r = right.peek();
+        const count = if (left.int != null) r.len else if (right.int != null) l.len else @min(l.len, r.len);
+        const out = builder.values.unusedCapacitySlice()[0..count];
+
+        const done = if (left.int != null)
+            try kernels.run(op, .lhs_broadcast, out, l, r)
+        else if (right.int != null)
+            try kernels.run(op, .rhs_broadcast, out, l, r)
+        else
+            try kernels.run(op, .both, out, l, r);
+        builder.values.items.len += done;
+        left.skip(done);
+        right.skip(done);
+        if (done == count) continue;
+
+        // One of them's an array, so recurse into it.
+        builder.appendAssumeCapacity(try left.peek()[0].mapIt(alloc, right.peek()[0], op));
+        left.skip(1);
+        right.skip(1);
+    }
+
+    return Value.from(try builder.finish(alloc));
+}
+
+/// Does `op` like `add` and friends, but takes ownership of both `lhs` and `rhs`, even on failure.
+/// If either of them is a flat array that nothing else refers to, the result's written straight
+/// over its elements instead of into a new array.
+pub fn mapReusing(lhs: Value, alloc: Allocator, rhs: Value, comptime op: kernels.Op) MathError!Value {
+    inline for (.{ true, false }) |target_is_lhs| {
+        const target = if (target_is_lhs) lhs else rhs;
+        const other = if (target_is_lhs) rhs else lhs;
+
+        if (target.uniqueArray()) |ary| {
+            errdefer {
+                lhs.deinit(alloc);
+                rhs.deinit(alloc);
+            }
+
+            if (try mapInto(ary, alloc, other, op, target_is_lhs)) {
+                other.deinit(alloc);
+                return target;
+            }
         }
-    }.it);
+    }
+
+    defer {
+        lhs.deinit(alloc);
+        rhs.deinit(alloc);
+    }
+    return lhs.mapIt(alloc, rhs, op);
+}
+
+fn uniqueArray(value: Value) ?*Array {
+    return switch (value.classify()) {
+        .int, .big => null,
+        .ary => |ary| if (ary.isUnique()) ary else null,
+    };
+}
+
+/// Does `op` to `target` and `other` (in that order if `target_is_lhs`, and the other way around if
+/// not), writing the result over `target`'s elements. Returns false without changing anything if
+/// it can't be done in place. On an error, `target` may have been partly written over, so the
+/// caller can only free it (which `mapReusing` does, as it owns it).
+fn mapInto(target: *Array, alloc: Allocator, other: Value, comptime op: kernels.Op, comptime target_is_lhs: bool) MathError!bool {
+    switch (other.classify()) {
+        .int, .big => {},
+        .ary => |ary| if (ary.len != target.len) return false,
+    }
+
+    switch (target.tag) {
+        .values => {
+            if (target.data.values.owner != null) return false;
+            return mapRuns(alloc, target.data.values.ptr[0..target.len], other, op, target_is_lhs, false);
+        },
+        .small => {
+            // The results have to fit back in as bytes.
+            var buffer: [Array.max_small_len]Value = undefined;
+            const values = buffer[0..target.len];
+            for (values, target.data.small[0..target.len]) |*value, byte| value.* = Value.from(byte);
+
+            if (!try mapRuns(alloc, values, other, op, target_is_lhs, true)) return false;
+            if (!Array.Builder.fitsSmall(values)) return false;
+            for (target.data.small[0..target.len], values) |*byte, value| byte.* = @intCast(value.classify().int);
+            return true;
+        },
+        .cons => return false,
+    }
+}
+
+/// Does `op` to each of `values` and `other` like `mapArray`, writing the results over `values`. If
+/// `flat` is set, this gives up and returns false when it reaches anything that isn't an int.
+fn mapRuns(
+    alloc: Allocator,
+    values: []Value,
+    other: Value,
+    comptime op: kernels.Op,
+    comptime target_is_lhs: bool,
+    comptime flat: bool,
+) MathError!bool {
+    var operand = Operand.init(other);
+    var idx: usize = 0;
+
+    while (idx < values.len) {
+        const o = operand.peek();
+        const count = if (operand.int != null) values.len - idx else @min(values.len - idx, o.len);
+        const out = values[idx..][0..count];
+
+        const done = if (operand.int == null)
+            try kernels.run(op, .both, out, if (target_is_lhs) out else o, if (target_is_lhs) o else out)
+        else if (target_is_lhs)
+            try kernels.run(op, .rhs_broadcast, out, out, o)
+        else
+            try kernels.run(op, .lhs_broadcast, out, o, out);
+        idx += done;
+        operand.skip(done);
+        if (done == count) continue;
+        if (flat) return false;
+
+        const old = values[idx];
+        values[idx] = try if (target_is_lhs) old.mapIt(alloc, operand.peek()[0], op) else operand.peek()[0].mapIt(alloc, old, op);
+        old.deinit(alloc);
+        idx += 1;
+        operand.skip(1);
+    }
+
+    return true;
+}
+
+pub fn add(value: Value, alloc: Allocator, rhs: Value) MathError!Value {
+    return value.mapIt(alloc, rhs, .add);
 }
 
 pub fn sub(value: Value, alloc: Allocator, rhs: Value) MathError!Value {
-    return value.mapIt(alloc, rhs, struct {
-        fn it(a: IntType, b: IntType) IntType {
-            return a - b;
-        }
-    }.it);
+    return value.mapIt(alloc, rhs, .sub);
 }
 
 pub fn mul(value: Value, alloc: Allocator, rhs: Value) MathError!Value {
-    return value.mapIt(alloc, rhs, struct {
-        fn it(a: IntType, b: IntType) IntType {
-            return a * b;
-        }
-    }.it);
+    return value.mapIt(alloc, rhs, .mul);
 }
 
 pub fn div(value: Value, alloc: Allocator, rhs: Value) MathError!Value {
-    return value.mapIt(alloc, rhs, struct {
-        fn it(a: IntType, b: IntType) IntType {
-            return @divTrunc(a, b);
-        }
-    }.it);
+    return value.mapIt(alloc, rhs, .div);
 }
 
 pub fn mod(value: Value, alloc: Allocator, rhs: Value) MathError!Value {
-    return value.mapIt(alloc, rhs, struct {
-        fn it(a: IntType, b: IntType) IntType {
-            return @mod(a, b);
-        }
-    }.it);
+    return value.mapIt(alloc, rhs, .mod);
 }
 
 pub fn cmp(value: Value, rhs: Value) IntType {
-    switch (value.classify()) {
+    const order = switch (value.classify()) {
         .int => |l| switch (rhs.classify()) {
-            .int => |r| return std.math.sign(l - r),
-            else => @panic("todo"),
+            .int => |r| std.math.order(l, r),
+            .big => |r| r.toConst().orderAgainstScalar(l).invert(),
+            .ary => @panic("todo"),
         },
-        else => @panic("todo"),
-    }
+        .big => |l| switch (rhs.classify()) {
+            .int => |r| l.toConst().orderAgainstScalar(r),
+            .big => |r| l.toConst().order(r.toConst()),
+            .ary => @panic("todo"),
+        },
+        .ary => @panic("todo"),
+    };
+
+    return switch (order) {
+        .lt => -1,
+        .eq => 0,
+        .gt => 1,
+    };
 }
 
 pub fn chr(value: Value, alloc: Allocator) Allocator.Error!Value {
     switch (value.classify()) {
-        .int => return Value.from(try Array.init(alloc, value)),
+        .int, .big => {
+            var builder = try Array.Builder.initCapacity(alloc, 1);
+            builder.appendAssumeCapacity(value.clone());
+            return Value.from(try builder.finish(alloc));
+        },
         .ary => |ary| {
             ary.increment();
             return value;
@@ -232,9 +451,7 @@ pub const OrdError = error{EmptyString};
 pub fn ord(value: Value) OrdError!Value {
     return switch (value.classify()) {
         .int => value,
-        .ary => |ary| b: {
-            var iter = ary.iter();
-            break :b if (iter.next()) |ele| ele.ord() else error.EmptyString;
-        },
+        .big => value.clone(),
+        .ary => |ary| if (ary.isEmpty()) error.EmptyString else ary.get(0).ord(),
     };
 }
@@ -0,0 +1,184 @@
+//! Runs one maze against many sets of arguments for `--batch`, in parallel, in a single process.
+//!
+//! Each line of the jobs file is a JSON object like `{"args": ["a", "b"], "max_generations": 1000}`,
+//! both of which are optional. The maze is read and split into lines once, and every job gets a
+//! `Maze.share`d copy of it, so a job only copies the lines it writes to with `set_at`. Jobs are
+//! handed out to `threads` workers one at a time, and each one runs with its own allocator and its
+//! output captured (see `Output.FlushPolicy.capture`).
+//!
+//! Once every job's done, a line of JSON is written to the results file for each, in the same order
+//! as the jobs: its index, exit status, how many generations it ran for, what it printed, and the
+//! error it stopped at, if any.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Labyrinth = @import("Labyrinth.zig");
+const Maze = @import("Maze.zig");
+const Array = @import("Array.zig");
+const Value = @import("Value.zig");
+const SlabAllocator = @import("SlabAllocator.zig");
+const utils = @import("utils.zig");
+
+pub const Job = struct {
+    args: []const []const u8 = &.{},
+    /// If set, the job's stopped once it's run for this many generations.
+    max_generations: ?u64 = null,
+};
+
+pub const Result = struct {
+    job: usize,
+    exit_status: ?u8 = null,
+    generations: u64 = 0,
+    /// Everything the job printed; allocated with the batch's allocator.
+    stdout: []const u8 = "",
+    /// Why the job stopped before it exited, if it did.
+    @"error": ?[]const u8 = null,
+};
+
+const Context = struct {
+    alloc: Allocator,
+    maze: *const Maze,
+    options: Labyrinth.Options,
+    jobs: []const Job,
+    results: []Result,
+    next_job: std.atomic.Value(usize) = std.atomic.Value(usize).init(0),
+};
+
+/// Runs `maze` once for each job in the file at `jobs_path`, `threads` at a time, and writes the
+/// results to `results_path`. Each job runs with `options`, except that it's never split across
+/// threads and its output's captured.
+pub fn run(
+    alloc: Allocator,
+    maze: *const Maze,
+    options: Labyrinth.Options,
+    threads: u32,
+    jobs_path: []const u8,
+    results_path: []const u8,
+) !void {
+    const contents = try utils.readFile(alloc, jobs_path);
+    defer alloc.free(contents);
+
+    var arena = std.heap.ArenaAllocator.init(alloc);
+    defer arena.deinit();
+    const jobs = try parseJobs(arena.allocator(), contents);
+
+    const results = try alloc.alloc(Result, jobs.len);
+    defer {
+        for (results) |result| alloc.free(result.stdout);
+        alloc.free(results);
+    }
+    for (results, 0..) |*result, idx| result.* = .{ .job = idx };
+
+    var job_options = options;
+    job_options.threads = 1;
+    job_options.flush = .capture;
+    var context = Context{ .alloc = alloc, .maze = maze, .options = job_options, .jobs = jobs, .results = results };
+
+    var pool: std.Thread.Pool = undefined;
+    try pool.init(.{ .allocator = alloc, .n_jobs = threads });
+    defer pool.deinit();
+
+    var wait_group = std.Thread.WaitGroup{};
+    for (0..@min(threads, jobs.len)) |_| {
+        wait_group.start();
+        pool.spawn(worker, .{ &context, &wait_group }) catch |err| {
+            wait_group.finish();
+            wait_group.wait();
+            return err;
+        };
+    }
+    wait_group.wait();
+
+    const file = try std.fs.cwd().createFile(results_path, .{});
+    defer file.close();
+    var buffered = std.io.bufferedWriter(file.writer());
+    for (results) |result| {
+        try std.json.stringify(result, .{}, buffered.writer());
+        try buffered.writer().writeByte('\n');
+    }
+    try buffered.flush();
+}
+
+/// Parses every non-blank line of `contents` as a `Job`, allocating them with `alloc`.
+fn parseJobs(alloc: Allocator, contents: []const u8) ![]const Job {
+    var jobs = std.ArrayList(Job).init(alloc);
+    var lines = std.mem.splitScalar(u8, contents, '\n');
+    var line_number: usize = 0;
+
+    while (lines.next()) |line| {
+        line_number += 1;
+        if (std.mem.trim(u8, line, " \t\r").len == 0) continue;
+
+        const job = std.json.parseFromSliceLeaky(Job, alloc, line, .{ .ignore_unknown_fields = true }) catch |err| {
+            try utils.eprintln("invalid job on line {d}: {s}", .{ line_number, @errorName(err) });
+            return error.InvalidJob;
+        };
+        try jobs.append(job);
+    }
+
+    return jobs.toOwnedSlice();
+}
+
+/// Runs jobs until there's none left. Jobs are handed out one at a time, so threads that finish
+/// early keep on taking work from the rest.
+fn worker(context: *Context, wait_group: *std.Thread.WaitGroup) void {
+    defer wait_group.finish();
+
+    while (true) {
+        const idx = context.next_job.fetchAdd(1, .monotonic);
+        if (context.jobs.len <= idx) return;
+
+        const result = &context.results[idx];
+        runJob(context, context.jobs[idx], result) catch |err| {
+            result.@"error" = @errorName(err);
+        };
+    }
+}
+
+fn runJob(context: *const Context, job: Job, result: *Result) !void {
+    // Only this thread touches the job's allocator.
+    var slab = SlabAllocator.init(context.alloc, .{});
+    // A job that fails some other way reports that instead, since it'll have leaked along the way.
+    defer if (slab.deinit() == .leak and result.@"error" == null) {
+        result.@"error" = "MemoryLeaked";
+    };
+    const alloc = switch (context.options.allocator) {
+        .gpa => context.alloc,
+        .slab => slab.allocator(),
+    };
+
+    var maze = try context.maze.share(alloc);
+    var labyrinth = Labyrinth.init(alloc, maze, context.options) catch |err| {
+        maze.deinit(alloc);
+        return err;
+    };
+    defer labyrinth.deinit();
+
+    {
+        var minotaur = labyrinth.getMinotaur(0) catch unreachable;
+        defer labyrinth.setMinotaur(0, minotaur);
+        for (job.args) |arg| {
+            const string = try Array.fromString(alloc, arg);
+            errdefer string.decrement(alloc);
+            try minotaur.push(Value.from(string));
+        }
+    }
+
+    defer {
+        result.generations = labyrinth.generation;
+        result.exit_status = labyrinth.exit_status;
+        if (context.alloc.dupe(u8, labyrinth.output.buffer.items)) |stdout| {
+            result.stdout = stdout;
+        } else |_| if (result.@"error" == null) {
+            result.@"error" = "OutOfMemory";
+        }
+    }
+
+    while (!labyrinth.isDone()) {
+        if (job.max_generations) |max| if (max <= labyrinth.generation) {
+            result.@"error" = "MaxGenerations";
+            return;
+        };
+        try labyrinth.playGeneration();
+    }
+}
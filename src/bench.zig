@@ -0,0 +1,373 @@
+//! The benchmark runner behind `zig build bench`.
+//!
+//! Every maze in the corpus is run headless (with output going to `/dev/null`) in its own child
+//! process, so that peak RSS is per-maze. The results are written out as JSON, and can be compared
+//! against a previous run to look for regressions:
+//!
+//!     zig build bench -- --out baseline.json
+//!     zig build bench -- --compare baseline.json
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Labyrinth = @import("Labyrinth.zig");
+const Maze = @import("Maze.zig");
+const SlabAllocator = @import("SlabAllocator.zig");
+const utils = @import("utils.zig");
+
+/// Synthetic mazes which stress one part of the interpreter each. None of them exit on their own,
+/// so they run until `--max-ticks`.
+const synthetic = [_]struct { name: []const u8, source: []const u8 }{
+    // Forks every lap, with the stack getting one deeper each time; one side of the fork exits.
+    .{ .name = "synthetic:fork", .source =
+    \\v   Q
+    \\>123|
+    \\^---<
+    },
+    // Adds, subtracts, multiplies, and divides in a loop, without the value going anywhere.
+    .{ .name = "synthetic:arithmetic", .source =
+    \\0>1+1_2*2%v
+    \\ ^--------<
+    },
+    // Keeps on appending to a string, and taking its length.
+    .{ .name = "synthetic:string", .source =
+    \\"">"hello world"&.L,v
+    \\  ^-----------------<
+    },
+};
+
+/// The results of running one maze.
+const Result = struct {
+    name: []const u8,
+    generations: u64 = 0,
+    minotaur_ticks: u64 = 0,
+    elapsed_ns: u64 = 0,
+    ticks_per_sec: f64 = 0,
+    ns_per_minotaur_tick: f64 = 0,
+    peak_minotaurs: usize = 0,
+    allocations: u64 = 0,
+    frees: u64 = 0,
+    peak_bytes: usize = 0,
+    peak_rss_kb: u64 = 0,
+    exit_status: ?u8 = null,
+    /// Why the maze stopped early, if it did.
+    @"error": ?[]const u8 = null,
+};
+
+const Report = struct {
+    max_ticks: u64,
+    allocator: Labyrinth.AllocatorKind,
+    results: []const Result,
+};
+
+const Options = struct {
+    max_ticks: u64 = 100_000,
+    repeat: usize = 1,
+    allocator: Labyrinth.AllocatorKind = .slab,
+    out: ?[]const u8 = null,
+    compare: ?[]const u8 = null,
+    /// How many percent slower than the baseline something has to be to count as a regression.
+    threshold: f64 = 10,
+    /// Only run this maze, and print its result; used by child processes.
+    one: ?[]const u8 = null,
+    files: std.ArrayListUnmanaged([]const u8) = .{},
+};
+
+pub fn main() !u8 {
+    var gpa = std.heap.GeneralPurposeAllocator(.{}){};
+    defer _ = gpa.deinit();
+    const alloc = gpa.allocator();
+
+    const args = try std.process.argsAlloc(alloc);
+    defer std.process.argsFree(alloc, args);
+
+    var options = Options{};
+    defer options.files.deinit(alloc);
+    try parseArgs(alloc, args, &options);
+
+    if (options.one) |name| {
+        const result = try runOne(alloc, name, options);
+        try std.json.stringify(result, .{}, std.io.getStdOut().writer());
+        return 0;
+    }
+
+    var results = std.ArrayList(Result).init(alloc);
+    defer {
+        for (results.items) |result| freeResult(alloc, result);
+        results.deinit();
+    }
+
+    for (options.files.items) |file| try results.append(try runChild(alloc, args[0], file, options));
+    for (synthetic) |maze| try results.append(try runChild(alloc, args[0], maze.name, options));
+
+    const report = Report{ .max_ticks = options.max_ticks, .allocator = options.allocator, .results = results.items };
+    if (options.out) |path| {
+        var file = try std.fs.cwd().createFile(path, .{});
+        defer file.close();
+        try std.json.stringify(report, .{ .whitespace = .indent_2 }, file.writer());
+    } else {
+        try std.json.stringify(report, .{ .whitespace = .indent_2 }, std.io.getStdOut().writer());
+        try std.io.getStdOut().writeAll("\n");
+    }
+
+    if (options.compare) |path| {
+        if (try compare(alloc, path, results.items, options.threshold)) return 1;
+    }
+
+    return 0;
+}
+
+fn usage(program: []const u8) noreturn {
+    utils.eprintln(
+        \\usage: {s} [flags] [files...]
+        \\flags:
+        \\  --max-ticks N     stops each maze after N generations (default 100000)
+        \\  --repeat N        runs each maze N times, keeping the fastest
+        \\  --alloc KIND      runs with the `slab` or `gpa` allocator
+        \\  --out FILE        writes the JSON report to FILE instead of stdout
+        \\  --compare FILE    compares against the report in FILE, failing on regressions
+        \\  --threshold PCT   how much slower counts as a regression (default 10)
+    , .{program}) catch {};
+    std.process.exit(1);
+}
+
+fn parseArgs(alloc: Allocator, args: []const []const u8, options: *Options) !void {
+    var i: usize = 1;
+    while (i < args.len) : (i += 1) {
+        const arg = args[i];
+        if (arg.len == 0 or arg[0] != '-') {
+            try options.files.append(alloc, arg);
+            continue;
+        }
+
+        i += 1;
+        if (args.len <= i) usage(args[0]);
+        const value = args[i];
+
+        if (std.mem.eql(u8, arg, "--max-ticks")) {
+            options.max_ticks = std.fmt.parseInt(u64, value, 10) catch usage(args[0]);
+        } else if (std.mem.eql(u8, arg, "--repeat")) {
+            options.repeat = @max(1, std.fmt.parseInt(usize, value, 10) catch usage(args[0]));
+        } else if (std.mem.eql(u8, arg, "--alloc")) {
+            options.allocator = std.meta.stringToEnum(Labyrinth.AllocatorKind, value) orelse usage(args[0]);
+        } else if (std.mem.eql(u8, arg, "--out")) {
+            options.out = value;
+        } else if (std.mem.eql(u8, arg, "--compare")) {
+            options.compare = value;
+        } else if (std.mem.eql(u8, arg, "--threshold")) {
+            options.threshold = std.fmt.parseFloat(f64, value) catch usage(args[0]);
+        } else if (std.mem.eql(u8, arg, "--one")) {
+            options.one = value;
+        } else usage(args[0]);
+    }
+}
+
+/// Runs `name` in a child process, so its peak RSS isn't mixed up with any other maze's.
+fn runChild(alloc: Allocator, self: []const u8, name: []const u8, options: Options) !Result {
+    var max_ticks_buf: [32]u8 = undefined;
+    var repeat_buf: [32]u8 = undefined;
+
+    const child = try std.process.Child.run(.{
+        .allocator = alloc,
+        .argv = &.{
+            self,
+            "--one",
+            name,
+            "--max-ticks",
+            try std.fmt.bufPrint(&max_ticks_buf, "{d}", .{options.max_ticks}),
+            "--repeat",
+            try std.fmt.bufPrint(&repeat_buf, "{d}", .{options.repeat}),
+            "--alloc",
+            @tagName(options.allocator),
+        },
+    });
+    defer alloc.free(child.stdout);
+    defer alloc.free(child.stderr);
+
+    if (child.term != .Exited or child.term.Exited != 0) {
+        try utils.eprintln("{s}: crashed ({any})\n{s}", .{ name, child.term, child.stderr });
+        return .{ .name = try alloc.dupe(u8, name), .@"error" = try alloc.dupe(u8, "crashed") };
+    }
+
+    const parsed = try std.json.parseFromSlice(Result, alloc, child.stdout, .{});
+    defer parsed.deinit();
+    return dupeResult(alloc, parsed.value);
+}
+
+fn dupeResult(alloc: Allocator, result: Result) Allocator.Error!Result {
+    var copy = result;
+    copy.name = try alloc.dupe(u8, result.name);
+    errdefer alloc.free(copy.name);
+    if (result.@"error") |err| copy.@"error" = try alloc.dupe(u8, err);
+    return copy;
+}
+
+fn freeResult(alloc: Allocator, result: Result) void {
+    alloc.free(result.name);
+    if (result.@"error") |err| alloc.free(err);
+}
+
+fn runOne(alloc: Allocator, name: []const u8, options: Options) !Result {
+    const source = for (synthetic) |maze| {
+        if (std.mem.eql(u8, maze.name, name)) break try alloc.dupe(u8, maze.source);
+    } else try utils.readFile(alloc, name);
+    defer alloc.free(source);
+
+    var best: ?Result = null;
+    for (0..options.repeat) |_| {
+        const result = try runMaze(alloc, name, skipShebang(source), options);
+        if (best == null or result.elapsed_ns < best.?.elapsed_ns) best = result;
+    }
+
+    var result = best.?;
+    const rusage = std.posix.getrusage(std.posix.rusage.SELF);
+    result.peak_rss_kb = @intCast(rusage.maxrss);
+    return result;
+}
+
+fn skipShebang(source: []const u8) []const u8 {
+    if (!std.mem.startsWith(u8, source, "#!")) return source;
+    const end = std.mem.indexOfScalar(u8, source, '\n') orelse return "";
+    return source[end + 1 ..];
+}
+
+fn runMaze(backing: Allocator, name: []const u8, source: []const u8, options: Options) !Result {
+    var slab = SlabAllocator.init(backing, .{});
+    defer _ = slab.deinit();
+
+    var counting = CountingAllocator{ .child = switch (options.allocator) {
+        .gpa => backing,
+        .slab => slab.allocator(),
+    } };
+    const alloc = counting.allocator();
+
+    var devnull = try std.fs.cwd().openFile("/dev/null", .{ .mode = .write_only });
+    defer devnull.close();
+
+    var maze = try Maze.init(alloc, name, source);
+    var labyrinth = Labyrinth.init(alloc, maze, .{
+        .program_name = "bench",
+        .output_file = devnull,
+        .flush = .exit,
+    }) catch |err| {
+        maze.deinit(alloc);
+        return err;
+    };
+    defer labyrinth.deinit();
+
+    var result = Result{ .name = name };
+    var timer = try std.time.Timer.start();
+
+    while (!labyrinth.isDone() and labyrinth.generation < options.max_ticks) {
+        result.minotaur_ticks += labyrinth.minotaurs.len;
+        result.peak_minotaurs = @max(result.peak_minotaurs, labyrinth.minotaurs.len);
+
+        labyrinth.playGeneration() catch |err| {
+            result.@"error" = @errorName(err);
+            break;
+        };
+    }
+
+    result.elapsed_ns = timer.read();
+    result.generations = labyrinth.generation;
+    result.exit_status = labyrinth.exit_status;
+
+    const elapsed: f64 = @floatFromInt(@max(1, result.elapsed_ns));
+    result.ticks_per_sec = @as(f64, @floatFromInt(result.generations)) * std.time.ns_per_s / elapsed;
+    result.ns_per_minotaur_tick = elapsed / @as(f64, @floatFromInt(@max(1, result.minotaur_ticks)));
+    result.allocations = counting.allocations;
+    result.frees = counting.frees;
+    result.peak_bytes = counting.peak_bytes;
+    return result;
+}
+
+/// Compares `results` against the report at `path`, printing any regressions. Returns whether there
+/// were any.
+fn compare(alloc: Allocator, path: []const u8, results: []const Result, threshold: f64) !bool {
+    const contents = try utils.readFile(alloc, path);
+    defer alloc.free(contents);
+
+    const baseline = try std.json.parseFromSlice(Report, alloc, contents, .{ .ignore_unknown_fields = true });
+    defer baseline.deinit();
+
+    var regressed = false;
+    for (results) |result| {
+        const old = for (baseline.value.results) |old| {
+            if (std.mem.eql(u8, old.name, result.name)) break old;
+        } else continue;
+
+        if (old.@"error" == null and result.@"error" != null) {
+            try utils.eprintln("regression: {s}: now fails with {s}", .{ result.name, result.@"error".? });
+            regressed = true;
+            continue;
+        }
+
+        const change = 100 * (result.ns_per_minotaur_tick - old.ns_per_minotaur_tick) / old.ns_per_minotaur_tick;
+        const status = if (threshold < change) "regression" else "ok";
+        if (threshold < change) regressed = true;
+
+        try utils.eprintln("{s}: {s}: {d:.2} -> {d:.2} ns/minotaur-tick ({d:.1}%), {d} -> {d} allocations", .{
+            status,
+            result.name,
+            old.ns_per_minotaur_tick,
+            result.ns_per_minotaur_tick,
+            change,
+            old.allocations,
+            result.allocations,
+        });
+    }
+
+    return regressed;
+}
+
+/// Counts how many allocations are made, and the most memory that was live at once.
+const CountingAllocator = struct {
+    child: Allocator,
+    allocations: u64 = 0,
+    frees: u64 = 0,
+    live_bytes: usize = 0,
+    peak_bytes: usize = 0,
+    mutex: std.Thread.Mutex = .{},
+
+    fn allocator(counting: *CountingAllocator) Allocator {
+        return .{
+            .ptr = counting,
+            .vtable = &.{ .alloc = alloc, .resize = resize, .free = free },
+        };
+    }
+
+    fn grew(counting: *CountingAllocator, by: usize) void {
+        counting.live_bytes += by;
+        counting.peak_bytes = @max(counting.peak_bytes, counting.live_bytes);
+    }
+
+    fn alloc(ctx: *anyopaque, len: usize, log2_align: u8, ret_addr: usize) ?[*]u8 {
+        const counting: *CountingAllocator = @ptrCast(@alignCast(ctx));
+        const ptr = counting.child.rawAlloc(len, log2_align, ret_addr) orelse return null;
+
+        counting.mutex.lock();
+        defer counting.mutex.unlock();
+        counting.allocations += 1;
+        counting.grew(len);
+        return ptr;
+    }
+
+    fn resize(ctx: *anyopaque, buf: []u8, log2_align: u8, new_len: usize, ret_addr: usize) bool {
+        const counting: *CountingAllocator = @ptrCast(@alignCast(ctx));
+        if (!counting.child.rawResize(buf, log2_align, new_len, ret_addr)) return false;
+
+        counting.mutex.lock();
+        defer counting.mutex.unlock();
+        if (buf.len < new_len) counting.grew(new_len - buf.len) else counting.live_bytes -= buf.len - new_len;
+        return true;
+    }
+
+    fn free(ctx: *anyopaque, buf: []u8, log2_align: u8, ret_addr: usize) void {
+        const counting: *CountingAllocator = @ptrCast(@alignCast(ctx));
+        counting.child.rawFree(buf, log2_align, ret_addr);
+
+        counting.mutex.lock();
+        defer counting.mutex.unlock();
+        counting.frees += 1;
+        counting.live_bytes -= buf.len;
+    }
+};
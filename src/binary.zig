@@ -0,0 +1,133 @@
+//! What `checkpoint` images and `Recorder` traces have in common: they lay out the maze the same
+//! way, and are read back checking everything, so a corrupt one is an error and not a crash.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const leb = std.leb;
+const Maze = @import("Maze.zig");
+const Coordinate = @import("Coordinate.zig");
+
+/// Writes `maze` little-endian: its filename, `dense_width` and `dense_height`, every line, then
+/// the far away tiles (see `Maze.tiles`) and the lengths of the lines they're on.
+pub fn writeMaze(maze: *const Maze, writer: anytype) !void {
+    try writer.writeInt(u32, @intCast(maze.filename.len), .little);
+    try writer.writeAll(maze.filename);
+    try writer.writeInt(u32, maze.dense_width, .little);
+    try writer.writeInt(u32, maze.dense_height, .little);
+
+    try writer.writeInt(u64, maze.lineCount(), .little);
+    for (0..maze.lineCount()) |y| {
+        const line = maze.getLine(y);
+        try writer.writeInt(u32, @intCast(line.len), .little);
+        try writer.writeAll(line);
+    }
+
+    try writer.writeInt(u64, maze.tiles.count(), .little);
+    var tiles = maze.tiles.iterator();
+    while (tiles.next()) |entry| {
+        try writer.writeInt(u32, entry.key_ptr.x, .little);
+        try writer.writeInt(u32, entry.key_ptr.y, .little);
+        try writer.writeAll(entry.value_ptr.*);
+    }
+
+    try writer.writeInt(u64, maze.far_lens.count(), .little);
+    var far_lens = maze.far_lens.iterator();
+    while (far_lens.next()) |entry| {
+        try writer.writeInt(u32, entry.key_ptr.*, .little);
+        try writer.writeInt(u64, entry.value_ptr.*, .little);
+    }
+}
+
+/// The methods of `Reader`, which has `bytes` and `pos` fields, for it to `usingnamespace`.
+/// Reading past the end, or anything that doesn't make sense, is `invalid`.
+pub fn Reading(comptime Reader: type, comptime invalid: anytype) type {
+    const Error = @TypeOf(invalid);
+
+    return struct {
+        pub fn take(reader: *Reader, len: usize) Error![]const u8 {
+            if (reader.bytes.len - reader.pos < len) return invalid;
+            defer reader.pos += len;
+            return reader.bytes[reader.pos..][0..len];
+        }
+
+        pub fn byte(reader: *Reader) Error!u8 {
+            return (try reader.take(1))[0];
+        }
+
+        pub fn int(reader: *Reader, comptime T: type) Error!T {
+            return std.mem.readInt(T, (try reader.take(@sizeOf(T)))[0..@sizeOf(T)], .little);
+        }
+
+        pub fn size(reader: *Reader) Error!usize {
+            return std.math.cast(usize, try reader.int(u64)) orelse invalid;
+        }
+
+        /// Reads how many of something there are. Every one takes at least a byte, so there can't
+        /// be more than there are bytes left; this stops a corrupt count from allocating too much.
+        pub fn count(reader: *Reader) Error!usize {
+            return checkCount(reader, try reader.size());
+        }
+
+        /// Like `count`, but LEB128.
+        pub fn unsignedCount(reader: *Reader) Error!usize {
+            return checkCount(reader, try reader.unsigned(usize));
+        }
+
+        fn checkCount(reader: *const Reader, n: usize) Error!usize {
+            if (reader.bytes.len - reader.pos < n) return invalid;
+            return n;
+        }
+
+        pub fn unsigned(reader: *Reader, comptime T: type) Error!T {
+            var stream = std.io.fixedBufferStream(reader.bytes[reader.pos..]);
+            defer reader.pos += stream.pos;
+            return leb.readULEB128(T, stream.reader()) catch invalid;
+        }
+
+        pub fn signed(reader: *Reader, comptime T: type) Error!T {
+            var stream = std.io.fixedBufferStream(reader.bytes[reader.pos..]);
+            defer reader.pos += stream.pos;
+            return leb.readILEB128(T, stream.reader()) catch invalid;
+        }
+
+        /// Reads a maze written by `writeMaze`. Its lines point into `bytes`, which has to outlive it.
+        pub fn maze(reader: *Reader, alloc: Allocator) (Error || Allocator.Error)!Maze {
+            var result = Maze{ .filename = try reader.take(try reader.int(u32)) };
+            errdefer result.deinit(alloc);
+            result.dense_width = try reader.int(u32);
+            result.dense_height = try reader.int(u32);
+
+            const line_count = try reader.count();
+            try result.lines.ensureTotalCapacity(alloc, line_count);
+            for (0..line_count) |_| {
+                const line = try reader.take(try reader.int(u32));
+                result.lines.appendAssumeCapacity(.{ .ptr = line.ptr, .len = @intCast(line.len) });
+                result.max_x = @max(result.max_x, line.len);
+            }
+
+            const tile_count = try reader.count();
+            try result.tiles.ensureTotalCapacity(alloc, @intCast(tile_count));
+            for (0..tile_count) |_| {
+                const key = Coordinate{ .x = try reader.int(u32), .y = try reader.int(u32) };
+                const bytes = try reader.take(@sizeOf(Maze.Tile));
+
+                const entry = result.tiles.getOrPutAssumeCapacity(key);
+                if (entry.found_existing) return invalid;
+                entry.value_ptr.* = alloc.create(Maze.Tile) catch |err| {
+                    result.tiles.removeByPtr(entry.key_ptr);
+                    return err;
+                };
+                @memcpy(entry.value_ptr.*, bytes);
+            }
+
+            const far_count = try reader.count();
+            try result.far_lens.ensureTotalCapacity(alloc, @intCast(far_count));
+            for (0..far_count) |_| {
+                const y = try reader.int(u32);
+                result.far_lens.putAssumeCapacity(y, try reader.size());
+            }
+
+            return result;
+        }
+    };
+}
@@ -0,0 +1,661 @@
+//! Saves a whole `Labyrinth` to a compact binary image between generations, and restores it, so
+//! long runs can be stopped and picked up again later.
+//!
+//! The image is little-endian, and laid out as:
+//!
+//!   header     `magic`, `version`, `Minotaur.positions_count`
+//!   state      the generation and the rng's state
+//!   maze       every line, then the far away tiles (see `Maze.tiles`)
+//!   arrays     every array any minotaur can reach, each after the arrays it refers to
+//!   segments   every shared stack segment (see `Stack`), each after its parent
+//!   minotaurs  then timelines; spilled ones are copied in whole (see `TimelineStore`)
+//!
+//! Values are written the way they're stored in memory: ints as `2n + 1`, and arrays as `4i`, where
+//! `i` is the array's index in `arrays` plus one (so the empty array is `0`). Since arrays and
+//! segments are written once each and referred to by index, everything that's shared when a
+//! labyrinth is saved is still shared once it's restored. Big integers are the exception: they're
+//! written in place as `4n + 2` (negated if the integer is negative) followed by their `n` limbs,
+//! so each reference to one is restored as a copy.
+//!
+//! Restoring maps the image into memory, and the maze's lines point straight into it, so even a big
+//! maze is restored without being copied.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Labyrinth = @import("Labyrinth.zig");
+const Minotaur = @import("Minotaur.zig");
+const Maze = @import("Maze.zig");
+const Stack = @import("Stack.zig");
+const TimelineStore = @import("TimelineStore.zig");
+const Array = @import("Array.zig");
+const Value = @import("Value.zig");
+const BigInt = @import("BigInt.zig");
+const Vector = @import("Vector.zig");
+const IntType = @import("types.zig").IntType;
+const binary = @import("binary.zig");
+
+pub const magic = "NCKP";
+pub const version: u32 = 4;
+
+pub const Error = error{InvalidCheckpoint};
+
+const ArrayKind = enum(u8) { small, values, view, cons };
+
+/// Saves `labyrinth` to `path`, replacing whatever was there only once all of it's been written.
+pub fn save(labyrinth: *Labyrinth, path: []const u8) !void {
+    var file = try std.fs.cwd().atomicFile(path, .{});
+    defer file.deinit();
+
+    var buffered = std.io.bufferedWriter(file.file.writer());
+    try write(labyrinth, buffered.writer());
+    try buffered.flush();
+    try file.finish();
+}
+
+/// Restores the labyrinth saved at `path`.
+pub fn restore(alloc: Allocator, path: []const u8, options: Labyrinth.Options) !Labyrinth {
+    return load(alloc, try Maze.Source.read(alloc, path), options);
+}
+
+/// Writes `labyrinth` to `writer`. This has to be done between generations.
+///
+/// Minotaurs that are part way through a trace or an interned literal are settled first, which
+/// doesn't change what they do, and everything they've printed is flushed.
+pub fn write(labyrinth: *Labyrinth, writer: anytype) !void {
+    const alloc = labyrinth.allocator;
+    try labyrinth.settleAll();
+    try labyrinth.output.flush();
+
+    for (0..labyrinth.minotaurs.len) |id| {
+        if (labyrinth.minotaurs.items(.mode)[id] != .literal) continue;
+        var minotaur = labyrinth.minotaurs.get(id);
+        defer labyrinth.minotaurs.set(id, minotaur);
+        try minotaur.unintern();
+    }
+    const timelines = &labyrinth.timelines;
+    for (timelines.entries.items) |*entry| switch (entry.state) {
+        .resident => |*minotaur| if (minotaur.mode == .literal) try minotaur.unintern(),
+        .evicted, .spilled => {},
+    };
+
+    var tables = Tables{};
+    defer tables.deinit(alloc);
+    const stacks = labyrinth.minotaurs.items(.stack);
+    for (stacks) |*stack| try tables.addStack(alloc, stack);
+    for (timelines.entries.items) |*entry| switch (entry.state) {
+        .resident => |*minotaur| try tables.addStack(alloc, &minotaur.stack),
+        .evicted, .spilled => {},
+    };
+
+    try writer.writeAll(magic);
+    try writer.writeInt(u32, version, .little);
+    try writer.writeInt(u8, Minotaur.positions_count, .little);
+
+    try writer.writeInt(u64, labyrinth.generation, .little);
+    for (labyrinth.rng.s) |word| try writer.writeInt(u64, word, .little);
+
+    try binary.writeMaze(&labyrinth.maze, writer);
+
+    try tables.writeShared(writer);
+
+    try writer.writeInt(u64, labyrinth.minotaurs.len, .little);
+    for (0..labyrinth.minotaurs.len) |id| {
+        const minotaur = labyrinth.minotaurs.get(id);
+        try tables.writeMinotaur(&minotaur, writer);
+    }
+
+    try writer.writeInt(u64, timelines.len(), .little);
+    for (timelines.entries.items, 0..) |*entry, id| {
+        try writer.writeInt(u8, @intFromEnum(entry.state), .little);
+        switch (entry.state) {
+            .resident => |*minotaur| try tables.writeMinotaur(minotaur, writer),
+            .evicted => {},
+            .spilled => {
+                const image = try timelines.readSpilled(alloc, id);
+                defer alloc.free(image);
+                try writer.writeInt(u64, image.len, .little);
+                try writer.writeAll(image);
+            },
+        }
+    }
+}
+
+/// Writes an image of just `minotaur` and everything its stack refers to, which `readMinotaur`
+/// reads back in; this is how `TimelineStore` spills timelines.
+pub fn writeMinotaur(alloc: Allocator, minotaur: *Minotaur, writer: anytype) !void {
+    if (minotaur.mode == .literal) try minotaur.unintern();
+
+    var tables = Tables{};
+    defer tables.deinit(alloc);
+    try tables.addStack(alloc, &minotaur.stack);
+
+    try tables.writeShared(writer);
+    try tables.writeMinotaur(minotaur, writer);
+}
+
+/// Reads a minotaur back in from an image written by `writeMinotaur`.
+pub fn readMinotaur(alloc: Allocator, image: []const u8) (Error || Allocator.Error)!Minotaur {
+    var reader = Reader{ .bytes = image };
+    var shared = try reader.sharedObjects(alloc);
+    defer shared.deinit(alloc);
+
+    var minotaur = try reader.minotaur(alloc, shared.arrays.items, shared.segments.items);
+    errdefer minotaur.deinit();
+    if (reader.pos != image.len) return error.InvalidCheckpoint;
+    return minotaur;
+}
+
+/// Every array and stack segment that's reachable from a labyrinth's minotaurs, in an order where
+/// each one comes after everything it refers to.
+const Tables = struct {
+    arrays: std.AutoArrayHashMapUnmanaged(*const Array, void) = .{},
+    segments: std.AutoArrayHashMapUnmanaged(*const Stack.Segment, void) = .{},
+    /// Arrays that are waiting for their children to be added, in `addArray`.
+    pending: std.ArrayListUnmanaged(Pending) = .{},
+    /// The segments that are being added, in `addSegment`.
+    chain: std.ArrayListUnmanaged(*const Stack.Segment) = .{},
+
+    const Pending = struct { ary: *const Array, expanded: bool };
+
+    fn deinit(tables: *Tables, alloc: Allocator) void {
+        tables.arrays.deinit(alloc);
+        tables.segments.deinit(alloc);
+        tables.pending.deinit(alloc);
+        tables.chain.deinit(alloc);
+        tables.* = undefined;
+    }
+
+    fn addStack(tables: *Tables, alloc: Allocator, stack: *const Stack) Allocator.Error!void {
+        if (stack.shared) |shared| try tables.addSegment(alloc, shared);
+        for (stack.top.items) |value| try tables.addValue(alloc, value);
+    }
+
+    fn addSegment(tables: *Tables, alloc: Allocator, segment: *const Stack.Segment) Allocator.Error!void {
+        tables.chain.clearRetainingCapacity();
+        var current: ?*const Stack.Segment = segment;
+        while (current) |seg| : (current = seg.parent) {
+            if (tables.segments.contains(seg)) break;
+            try tables.chain.append(alloc, seg);
+        }
+
+        // Parents go first.
+        var idx = tables.chain.items.len;
+        while (idx != 0) {
+            idx -= 1;
+            const seg = tables.chain.items[idx];
+            for (seg.values) |value| try tables.addValue(alloc, value);
+            try tables.segments.put(alloc, seg, {});
+        }
+    }
+
+    fn addValue(tables: *Tables, alloc: Allocator, value: Value) Allocator.Error!void {
+        switch (value.classify()) {
+            .int, .big => {},
+            .ary => |ary| try tables.addArray(alloc, ary),
+        }
+    }
+
+    /// Adds `root` and everything it refers to, children first. This doesn't recurse, so deeply
+    /// nested arrays can't overflow the stack.
+    fn addArray(tables: *Tables, alloc: Allocator, root: *const Array) Allocator.Error!void {
+        try tables.push(alloc, root);
+
+        while (tables.pending.popOrNull()) |pending| {
+            const ary = pending.ary;
+            if (tables.arrays.contains(ary)) continue;
+
+            if (pending.expanded) {
+                try tables.arrays.put(alloc, ary, {});
+                continue;
+            }
+
+            try tables.pending.append(alloc, .{ .ary = ary, .expanded = true });
+            switch (ary.tag) {
+                .small => {},
+                .values => if (ary.data.values.owner) |owner| {
+                    try tables.push(alloc, owner);
+                } else for (ary.data.values.ptr[0..ary.len]) |value| switch (value.classify()) {
+                    .int, .big => {},
+                    .ary => |child| try tables.push(alloc, child),
+                },
+                .cons => {
+                    try tables.push(alloc, ary.data.cons.right);
+                    try tables.push(alloc, ary.data.cons.left);
+                },
+            }
+        }
+    }
+
+    fn push(tables: *Tables, alloc: Allocator, ary: *const Array) Allocator.Error!void {
+        if (ary == Array.empty or tables.arrays.contains(ary)) return;
+        try tables.pending.append(alloc, .{ .ary = ary, .expanded = false });
+    }
+
+    fn arrayRef(tables: *const Tables, ary: *const Array) u64 {
+        if (ary == Array.empty) return 0;
+        return tables.arrays.getIndex(ary).? + 1;
+    }
+
+    fn segmentRef(tables: *const Tables, segment: ?*const Stack.Segment) u64 {
+        return tables.segments.getIndex(segment orelse return 0).? + 1;
+    }
+
+    /// Writes every array, and then every segment.
+    fn writeShared(tables: *const Tables, writer: anytype) !void {
+        try writer.writeInt(u64, tables.arrays.count(), .little);
+        for (tables.arrays.keys()) |ary| try tables.writeArray(ary, writer);
+
+        try writer.writeInt(u64, tables.segments.count(), .little);
+        for (tables.segments.keys()) |segment| {
+            try writer.writeInt(u64, tables.segmentRef(segment.parent), .little);
+            try writer.writeInt(u64, segment.base, .little);
+            try tables.writeValues(segment.values, writer);
+        }
+    }
+
+    fn writeValue(tables: *const Tables, value: Value, writer: anytype) !void {
+        const data: i64 = switch (value.classify()) {
+            .int => value._data,
+            .ary => |ary| @intCast(tables.arrayRef(ary) << 2),
+            .big => |int| {
+                const header: i64 = @intCast((int.limbs.len << 2) | 2);
+                try writer.writeInt(i64, if (int.positive) header else -header, .little);
+                for (int.limbs) |limb| try writer.writeInt(u64, limb, .little);
+                return;
+            },
+        };
+        try writer.writeInt(i64, data, .little);
+    }
+
+    fn writeValues(tables: *const Tables, values: []const Value, writer: anytype) !void {
+        try writer.writeInt(u64, values.len, .little);
+        for (values) |value| try tables.writeValue(value, writer);
+    }
+
+    fn writeArray(tables: *const Tables, ary: *const Array, writer: anytype) !void {
+        switch (ary.tag) {
+            .small => {
+                try writer.writeInt(u8, @intFromEnum(ArrayKind.small), .little);
+                try writer.writeInt(u8, @intCast(ary.len), .little);
+                try writer.writeAll(ary.data.small[0..ary.len]);
+            },
+            .values => if (ary.data.values.owner) |owner| {
+                const offset = (@intFromPtr(ary.data.values.ptr) - @intFromPtr(owner.data.values.ptr)) / @sizeOf(Value);
+                try writer.writeInt(u8, @intFromEnum(ArrayKind.view), .little);
+                try writer.writeInt(u64, tables.arrayRef(owner), .little);
+                try writer.writeInt(u64, offset, .little);
+                try writer.writeInt(u64, ary.len, .little);
+            } else {
+                try writer.writeInt(u8, @intFromEnum(ArrayKind.values), .little);
+                try tables.writeValues(ary.data.values.ptr[0..ary.len], writer);
+            },
+            .cons => {
+                try writer.writeInt(u8, @intFromEnum(ArrayKind.cons), .little);
+                try writer.writeInt(u64, tables.arrayRef(ary.data.cons.left), .little);
+                try writer.writeInt(u64, tables.arrayRef(ary.data.cons.right), .little);
+            },
+        }
+    }
+
+    fn writeMinotaur(tables: *const Tables, minotaur: *const Minotaur, writer: anytype) !void {
+        const stack = &minotaur.stack;
+        try writer.writeInt(u64, tables.segmentRef(stack.shared), .little);
+        try writer.writeInt(u64, stack.shared_len, .little);
+        try tables.writeValues(stack.top.items, writer);
+
+        try writer.writeInt(i64, minotaur.velocity.x, .little);
+        try writer.writeInt(i64, minotaur.velocity.y, .little);
+        for (minotaur.positions) |pos| {
+            try writer.writeInt(u32, pos.x, .little);
+            try writer.writeInt(u32, pos.y, .little);
+        }
+
+        try writer.writeInt(u8, @intFromEnum(minotaur.mode), .little);
+        switch (minotaur.mode) {
+            .normal => {},
+            .integer => |int| try writer.writeInt(i64, int, .little),
+            .string => |bytes| {
+                try writer.writeInt(u64, bytes.items.len, .little);
+                try writer.writeAll(bytes.items);
+            },
+            .literal => unreachable, // `write` uninterns them all.
+        }
+
+        try writer.writeInt(u64, minotaur.wake_at, .little);
+        try writer.writeInt(u8, @intFromBool(minotaur.is_first), .little);
+        try writer.writeInt(u8, minotaur.colour, .little);
+        try writer.writeInt(u8, @intFromBool(minotaur.exit_status != null), .little);
+        try writer.writeInt(u8, minotaur.exit_status orelse 0, .little);
+        try writer.writeInt(u8, minotaur.trace_cooldown, .little);
+        try writer.writeInt(u64, minotaur.copies, .little);
+    }
+};
+
+/// Restores a labyrinth from the image in `source`, which it takes ownership of; the maze's lines
+/// point into it.
+pub fn load(alloc: Allocator, source: Maze.Source, options: Labyrinth.Options) !Labyrinth {
+    var labyrinth = read(alloc, source.bytes(), options) catch |err| {
+        source.deinit(alloc);
+        return err;
+    };
+    labyrinth.maze.source = source;
+    return labyrinth;
+}
+
+fn read(alloc: Allocator, bytes: []const u8, options: Labyrinth.Options) !Labyrinth {
+    var reader = Reader{ .bytes = bytes };
+    if (!std.mem.eql(u8, magic, try reader.take(magic.len))) return error.InvalidCheckpoint;
+    if (try reader.int(u32) != version) return error.InvalidCheckpoint;
+    if (try reader.int(u8) != Minotaur.positions_count) return error.InvalidCheckpoint;
+
+    const generation = try reader.size();
+    var rng_state: [4]u64 = undefined;
+    for (&rng_state) |*word| word.* = try reader.int(u64);
+
+    var maze = try reader.maze(alloc);
+    var labyrinth = Labyrinth.init(alloc, maze, options) catch |err| {
+        maze.deinit(alloc);
+        return err;
+    };
+    errdefer labyrinth.deinit();
+
+    // Get rid of the minotaur that every labyrinth starts off with.
+    var first = labyrinth.minotaurs.pop();
+    first.deinit();
+
+    labyrinth.generation = generation;
+    labyrinth.last_checkpoint = generation;
+    labyrinth.rng.s = rng_state;
+
+    var shared = try reader.sharedObjects(alloc);
+    defer shared.deinit(alloc);
+    const arrays = shared.arrays.items;
+    const segments = shared.segments.items;
+
+    const minotaur_count = try reader.count();
+    try labyrinth.minotaurs.ensureTotalCapacity(alloc, minotaur_count);
+    for (0..minotaur_count) |_| {
+        const minotaur = try reader.minotaur(alloc, arrays, segments);
+        labyrinth.minotaurs.appendAssumeCapacity(minotaur);
+    }
+
+    const timeline_count = try reader.count();
+    for (0..timeline_count) |_| {
+        const state = std.meta.intToEnum(std.meta.Tag(TimelineStore.State), try reader.int(u8)) catch return error.InvalidCheckpoint;
+        switch (state) {
+            .resident => {
+                var minotaur = try reader.minotaur(alloc, arrays, segments);
+                errdefer minotaur.deinit();
+                _ = try labyrinth.timelines.add(alloc, minotaur);
+            },
+            .evicted => try labyrinth.timelines.addEvicted(alloc),
+            .spilled => try labyrinth.timelines.addSpilled(alloc, try reader.take(try reader.size())),
+        }
+    }
+
+    if (reader.pos != bytes.len) return error.InvalidCheckpoint;
+    if (labyrinth.minotaurs.len == 0) return error.InvalidCheckpoint;
+
+    try labyrinth.reschedule();
+    return labyrinth;
+}
+
+/// The arrays and segments near the start of an image, which everything after them refers to by
+/// index. They each hold a reference to everything in them, which is dropped once everything that
+/// refers to it has been read.
+const Shared = struct {
+    arrays: std.ArrayListUnmanaged(*Array) = .{},
+    segments: std.ArrayListUnmanaged(*Stack.Segment) = .{},
+
+    fn deinit(shared: *Shared, alloc: Allocator) void {
+        for (shared.arrays.items) |ary| ary.decrement(alloc);
+        shared.arrays.deinit(alloc);
+        for (shared.segments.items) |segment| segment.decrement(alloc);
+        shared.segments.deinit(alloc);
+        shared.* = undefined;
+    }
+};
+
+/// Reads an image, checking everything it reads so a corrupt one is an error and not a crash.
+const Reader = struct {
+    bytes: []const u8,
+    pos: usize = 0,
+
+    usingnamespace binary.Reading(Reader, error.InvalidCheckpoint);
+
+    fn sharedObjects(reader: *Reader, alloc: Allocator) !Shared {
+        var result = Shared{};
+        errdefer result.deinit(alloc);
+
+        const array_count = try reader.count();
+        try result.arrays.ensureTotalCapacity(alloc, array_count);
+        for (0..array_count) |_| result.arrays.appendAssumeCapacity(try reader.array(alloc, result.arrays.items));
+
+        const segment_count = try reader.count();
+        try result.segments.ensureTotalCapacity(alloc, segment_count);
+        for (0..segment_count) |_|
+            result.segments.appendAssumeCapacity(try reader.segment(alloc, result.arrays.items, result.segments.items));
+
+        return result;
+    }
+
+    fn arrayRef(reader: *Reader, arrays: []const *Array) Error!*Array {
+        const ref = try reader.size();
+        if (ref == 0) return Array.empty;
+        if (arrays.len < ref) return error.InvalidCheckpoint;
+        return arrays[ref - 1];
+    }
+
+    fn value(reader: *Reader, alloc: Allocator, arrays: []const *Array) (Error || Allocator.Error)!Value {
+        const data = try reader.int(i64);
+        if (data & 1 == 1) return .{ ._data = data };
+        if (data & 2 == 2) return reader.bigInt(alloc, data);
+        if (data < 0) return error.InvalidCheckpoint;
+
+        const ref = std.math.cast(usize, data >> 2) orelse return error.InvalidCheckpoint;
+        if (arrays.len < ref) return error.InvalidCheckpoint;
+        const ary = if (ref == 0) Array.empty else arrays[ref - 1];
+        ary.increment();
+        return Value.from(ary);
+    }
+
+    /// Reads the limbs of a big integer whose header is `data`.
+    fn bigInt(reader: *Reader, alloc: Allocator, data: i64) (Error || Allocator.Error)!Value {
+        const len = std.math.cast(usize, @abs(data) >> 2) orelse return error.InvalidCheckpoint;
+        if ((reader.bytes.len - reader.pos) / @sizeOf(u64) < len) return error.InvalidCheckpoint;
+
+        const limbs = try alloc.alloc(BigInt.Limb, len);
+        defer alloc.free(limbs);
+        for (limbs) |*limb| limb.* = std.math.cast(BigInt.Limb, try reader.int(u64)) orelse return error.InvalidCheckpoint;
+
+        // Anything that fits in an int would've been written as one.
+        const num = std.math.big.int.Const{ .limbs = limbs, .positive = 0 < data };
+        if (len == 0 or limbs[len - 1] == 0 or num.fits(IntType)) return error.InvalidCheckpoint;
+        return BigInt.normalize(alloc, num);
+    }
+
+    /// Reads a count and then that many values, into memory that's allocated with `alloc`.
+    fn values(reader: *Reader, alloc: Allocator, arrays: []const *Array) ![]Value {
+        const len = try reader.count();
+        const result = try alloc.alloc(Value, len);
+        var done: usize = 0;
+        errdefer {
+            for (result[0..done]) |val| val.deinit(alloc);
+            alloc.free(result);
+        }
+
+        while (done < len) : (done += 1) result[done] = try reader.value(alloc, arrays);
+        return result;
+    }
+
+    fn array(reader: *Reader, alloc: Allocator, arrays: []const *Array) !*Array {
+        const kind = std.meta.intToEnum(ArrayKind, try reader.int(u8)) catch return error.InvalidCheckpoint;
+        const new = try alloc.create(Array);
+        errdefer alloc.destroy(new);
+
+        switch (kind) {
+            .small => {
+                const bytes = try reader.take(try reader.int(u8));
+                if (Array.max_small_len < bytes.len) return error.InvalidCheckpoint;
+                new.* = .{ .tag = .small, .len = bytes.len, .data = .{ .small = undefined } };
+                @memcpy(new.data.small[0..bytes.len], bytes);
+            },
+            .values => {
+                const vals = try reader.values(alloc, arrays);
+                new.* = .{ .tag = .values, .len = vals.len, .data = .{ .values = .{ .ptr = vals.ptr, .owner = null } } };
+            },
+            .view => {
+                const owner = try reader.arrayRef(arrays);
+                const offset = try reader.size();
+                const len = try reader.size();
+                if (owner.tag != .values or owner.data.values.owner != null) return error.InvalidCheckpoint;
+                if (owner.len < offset or owner.len - offset < len) return error.InvalidCheckpoint;
+
+                new.* = .{ .tag = .values, .len = len, .data = .{ .values = .{
+                    .ptr = owner.data.values.ptr + offset,
+                    .owner = owner,
+                } } };
+                owner.increment();
+            },
+            .cons => {
+                const left = try reader.arrayRef(arrays);
+                const right = try reader.arrayRef(arrays);
+                new.* = .{
+                    .tag = .cons,
+                    .depth = @max(left.depth, right.depth) +| 1,
+                    .len = left.len + right.len,
+                    .data = .{ .cons = .{ .left = left, .right = right } },
+                };
+                left.increment();
+                right.increment();
+            },
+        }
+
+        return new;
+    }
+
+    fn segmentRef(reader: *Reader, segments: []const *Stack.Segment) Error!?*Stack.Segment {
+        const ref = try reader.size();
+        if (ref == 0) return null;
+        if (segments.len < ref) return error.InvalidCheckpoint;
+        return segments[ref - 1];
+    }
+
+    fn segment(reader: *Reader, alloc: Allocator, arrays: []const *Array, segments: []const *Stack.Segment) !*Stack.Segment {
+        const parent = try reader.segmentRef(segments);
+        const base = try reader.size();
+        const end = if (parent) |p| p.base + p.values.len else 0;
+        if (end < base) return error.InvalidCheckpoint;
+
+        const vals = try reader.values(alloc, arrays);
+        errdefer {
+            for (vals) |val| val.deinit(alloc);
+            alloc.free(vals);
+        }
+
+        const new = try alloc.create(Stack.Segment);
+        new.* = .{
+            .depth = if (parent) |p| p.depth + 1 else 1,
+            .parent = parent,
+            .base = base,
+            .values = vals,
+        };
+        if (parent) |p| p.increment();
+        return new;
+    }
+
+    fn stack(reader: *Reader, alloc: Allocator, arrays: []const *Array, segments: []const *Stack.Segment) !Stack {
+        const shared = try reader.segmentRef(segments);
+        const shared_len = try reader.size();
+        if (shared_len > if (shared) |s| s.base + s.values.len else 0) return error.InvalidCheckpoint;
+
+        if (shared) |s| s.increment();
+        var result = Stack{ .shared = shared, .shared_len = shared_len };
+        errdefer result.deinit(alloc);
+
+        const top_len = try reader.count();
+        try result.top.ensureTotalCapacity(alloc, top_len);
+        for (0..top_len) |_| result.top.appendAssumeCapacity(try reader.value(alloc, arrays));
+        return result;
+    }
+
+    fn minotaur(reader: *Reader, alloc: Allocator, arrays: []const *Array, segments: []const *Stack.Segment) !Minotaur {
+        var result = Minotaur{ .allocator = alloc, .stack = try reader.stack(alloc, arrays, segments) };
+        errdefer result.deinit();
+
+        result.velocity = .{
+            .x = std.math.cast(Vector.VecInt, try reader.int(i64)) orelse return error.InvalidCheckpoint,
+            .y = std.math.cast(Vector.VecInt, try reader.int(i64)) orelse return error.InvalidCheckpoint,
+        };
+        for (&result.positions) |*pos| pos.* = .{ .x = try reader.int(u32), .y = try reader.int(u32) };
+
+        const mode = std.meta.intToEnum(std.meta.Tag(Minotaur.Mode), try reader.int(u8)) catch return error.InvalidCheckpoint;
+        result.mode = switch (mode) {
+            .normal => .normal,
+            .integer => .{ .integer = std.math.cast(IntType, try reader.int(i64)) orelse return error.InvalidCheckpoint },
+            .string => blk: {
+                const bytes = try reader.take(try reader.size());
+                var string = try std.ArrayListUnmanaged(u8).initCapacity(alloc, bytes.len);
+                string.appendSliceAssumeCapacity(bytes);
+                break :blk .{ .string = string };
+            },
+            .literal => return error.InvalidCheckpoint,
+        };
+
+        result.wake_at = try reader.size();
+        result.is_first = try reader.int(u8) != 0;
+        result.colour = try reader.int(u8);
+        const exited = try reader.int(u8) != 0;
+        const exit_status = try reader.int(u8);
+        result.exit_status = if (exited) exit_status else null;
+        result.trace_cooldown = try reader.int(u8);
+        result.copies = try reader.size();
+        if (result.copies == 0) return error.InvalidCheckpoint;
+        return result;
+    }
+};
+
+test "checkpoints keep arrays and stacks shared" {
+    const alloc = std.testing.allocator;
+    const maze = try Maze.init(alloc, "test", "1:2\"abc\"3");
+    var labyrinth = try Labyrinth.init(alloc, maze, .{ .program_name = "test" });
+    defer labyrinth.deinit();
+
+    var builder = try Array.Builder.initCapacity(alloc, 40);
+    for (0..40) |i| builder.appendAssumeCapacity(Value.from(@as(IntType, @intCast(i))));
+    const ary = try builder.finish(alloc);
+    const view = try ary.slice(alloc, 3, 30);
+
+    var minotaur = try labyrinth.getMinotaur(0);
+    try minotaur.push(Value.from(ary));
+    try minotaur.push(Value.from(ary).clone());
+    try minotaur.push(Value.from(view));
+    _ = try labyrinth.addTimeline(try minotaur.clone());
+    try minotaur.push(try Value.from(@as(IntType, std.math.minInt(IntType))).mul(alloc, Value.from(3)));
+    try minotaur.push(Value.from(7));
+    labyrinth.setMinotaur(0, minotaur);
+    labyrinth.generation = 12;
+
+    var image = std.ArrayList(u8).init(alloc);
+    defer image.deinit();
+    try write(&labyrinth, image.writer());
+
+    var restored = try load(alloc, .{ .owned = try alloc.dupe(u8, image.items) }, .{ .program_name = "test" });
+    defer restored.deinit();
+
+    try std.testing.expectEqual(@as(usize, 12), restored.generation);
+    try std.testing.expectEqual(labyrinth.rng.s, restored.rng.s);
+    try std.testing.expectEqualStrings("1:2\"abc\"3", restored.maze.getLine(0));
+
+    const stack = &restored.minotaurs.items(.stack)[0];
+    try std.testing.expectEqual(@as(usize, 5), stack.len());
+    try std.testing.expectEqual(@as(IntType, 7), try stack.peek(0).toInt());
+    try std.testing.expect(stack.peek(1).equals(labyrinth.minotaurs.items(.stack)[0].peek(1)));
+    const restored_ary = stack.peek(4).classify().ary;
+    try std.testing.expectEqual(restored_ary, stack.peek(3).classify().ary);
+    try std.testing.expectEqual(restored_ary, stack.peek(2).classify().ary.data.values.owner.?);
+    try std.testing.expect(restored_ary.equals(ary));
+
+    // The timeline still shares the bottom of the stack with the minotaur it was cloned from.
+    try std.testing.expectEqual(stack.shared, restored.timelines.entries.items[0].state.resident.stack.shared);
+}
@@ -104,8 +104,8 @@ pub const Function = enum(u8) {
     tos = 's', // Convert the topmost integer to a string.
     toi = 'i', // Convert the topmost string to an int.
     len = 'L', // Get the length of the topmost item.
-    get = 'G', // TODO
-    set = 'S', // TODO
+    get = 'G', // str[index..index+len]
+    set = 'S', // str[index..index+len] = value
     head = '(', // top[0]
     tail = ')', // top[1..]
     cons = '&', // top + secondtotop
@@ -120,6 +120,9 @@ pub const Function = enum(u8) {
     quit0     = 'Q', // Kills the current minotaur; Exits with code 0 if it's the last minotaur.
     quit      = 'q', // Kills the current minotaur; Exits with code n if it's the last minotaur.
     gets      = 0x01, // TODO
+
+    // Not a real function; `Maze` decodes whitespace, padding, and unknown bytes to this.
+    invalid   = 0x00,
     // zig fmt: on
 
     // Gets the byte representation of `func`.
@@ -129,7 +132,48 @@ pub const Function = enum(u8) {
 
     pub const ValidateError = error{NotAValidFunction};
     pub fn fromByte(chr: u8) ValidateError!Function {
-        return std.meta.intToEnum(Function, chr) catch error.NotAValidFunction;
+        const func = decode(chr);
+        return if (func == .invalid) error.NotAValidFunction else func;
+    }
+
+    /// Decodes `chr` without validating it; bytes that aren't functions become `.invalid`.
+    pub inline fn decode(chr: u8) Function {
+        return decode_table[chr];
+    }
+
+    const decode_table = blk: {
+        var table = [_]Function{.invalid} ** 256;
+        for (std.enums.values(Function)) |func| table[func.toByte()] = func;
+        break :blk table;
+    };
+
+    /// Returns the digit that `func` starts an integer literal with, if it's one of `int0`-`int9`.
+    pub inline fn toDigit(func: Function) ?u8 {
+        return switch (func) {
+            .int0, .int1, .int2, .int3, .int4, .int5, .int6, .int7, .int8, .int9 => func.toByte() - '0',
+            else => null,
+        };
+    }
+
+    /// Roughly what a function does, following the groups above; see `Profiler`.
+    pub const Class = enum { literal, maze, stack, minotaur, movement, conditional, misc, math, logic, array, io };
+
+    pub fn class(func: Function) Class {
+        return switch (func) {
+            .int0, .int1, .int2, .int3, .int4, .int5, .int6, .int7, .int8, .int9 => .literal,
+            .str, .ary, .ary_end => .literal,
+            .set_at, .get_at => .maze,
+            .dup, .dup1, .dup2, .pop, .pop1, .pop2, .swap, .stacklen, .ifpop => .stack,
+            .moveh, .movev, .spawnl, .spawnr, .slay1, .branchl, .branchr, .branch, .travel, .travelq => .minotaur,
+            .right, .left, .up, .down, .speedup, .slowdown, .jump1, .jump, .randdir => .movement,
+            .x_to_neg1, .neg_x_to_neg1 => .movement,
+            .ifr, .ifl, .ifjump1, .ifjump, .unlessjump1, .unlessjump => .conditional,
+            .sleep1, .sleep, .getcolour, .setcolour, .foreign, .invalid => .misc,
+            .neg, .inc, .dec, .add, .sub, .mul, .div, .mod, .rand => .math,
+            .not, .eql, .lth, .gth, .cmp => .logic,
+            .chr, .ord, .tos, .toi, .len, .get, .set, .head, .tail, .cons => .array,
+            .printnl, .print, .dumpvalnl, .dumpval, .dumpq, .dump, .quit0, .quit, .gets => .io,
+        };
     }
 
     pub const MaxArgc = 4;
@@ -140,7 +184,7 @@ pub const Function = enum(u8) {
             .dup1, .dup2, .pop2, .swap, .stacklen, .getcolour, .branchl, .branchr, .branch => 0,
             .moveh, .movev, .up, .down, .left, .right, .speedup, .slowdown, .sleep1 => 0,
             .dump, .dumpq, .quit0, .gets, .str, .jump1, .randdir, .rand, .spawnl, .spawnr => 0,
-            .rotl, .rotr => 0,
+            .x_to_neg1, .neg_x_to_neg1 => 0,
 
             .pop1, .dup, .pop, .not, .chr, .ord, .tos, .toi, .inc, .dec, .neg => 1,
             .ifl, .ifr, .ifpop, .ifjump1, .unlessjump1, .jump, .quit, .len => 1,
@@ -158,6 +202,7 @@ pub const Function = enum(u8) {
             .foreign => 1,
 
             .ary, .ary_end, .slay1 => @panic("todo"),
+            .invalid => unreachable, // never executed; `Minotaur.tick` rejects it.
         };
     }
 };
@@ -0,0 +1,137 @@
+//! Elementwise arithmetic over runs of values, which is what `Value.add` and friends do to arrays.
+//!
+//! Ints are stored tagged (`2n + 1`, see `Value.from`), and `+ - *` are done directly on the tagged
+//! representation a vector at a time, so there's no untagging or retagging of each element:
+//!
+//!   (2a + 1) + 2b       = 2(a + b) + 1
+//!   (2a + 1) - 2b       = 2(a - b) + 1
+//!   a * 2b + 1          = 2(a * b) + 1
+//!
+//! Each of those overflows an `i64` exactly when the untagged result overflows an `IntType`, so
+//! overflow is checked with the `@...WithOverflow` builtins, and runs stop at the element that
+//! overflows so `Value` can promote it to a `BigInt`. Division has no vector instructions, so `/`
+//! and `%` go one element at a time, but still skip `Value`'s recursion.
+
+const std = @import("std");
+const Value = @import("Value.zig");
+const IntType = @import("types.zig").IntType;
+const DataType = Value.DataType;
+
+pub const Op = enum { add, sub, mul, div, mod };
+
+pub const Error = error{ IntOverflow, DivisionByZero };
+
+/// Which side of an operation is a single value that's used for every element.
+pub const Shape = enum { both, lhs_broadcast, rhs_broadcast };
+
+const vector_len = std.simd.suggestVectorLength(DataType) orelse 1;
+const Vector = @Vector(vector_len, DataType);
+const ones: Vector = @splat(1);
+const shift_one: @Vector(vector_len, std.math.Log2Int(DataType)) = @splat(1);
+
+/// Does `op` to two ints, returning an error instead of overflowing.
+pub fn apply(comptime op: Op, lhs: IntType, rhs: IntType) Error!IntType {
+    return switch (op) {
+        .add => std.math.add(IntType, lhs, rhs) catch error.IntOverflow,
+        .sub => std.math.sub(IntType, lhs, rhs) catch error.IntOverflow,
+        .mul => std.math.mul(IntType, lhs, rhs) catch error.IntOverflow,
+        .div => if (rhs == 0)
+            error.DivisionByZero
+        else if (rhs == -1)
+            std.math.negate(lhs) catch error.IntOverflow
+        else
+            @divTrunc(lhs, rhs),
+        .mod => if (rhs == 0) error.DivisionByZero else if (rhs == -1) 0 else floorMod(lhs, rhs),
+    };
+}
+
+/// The remainder of flooring division, which has the sign of `rhs` like `BigInt`'s `divFloor`.
+/// `@mod` only allows positive divisors.
+fn floorMod(lhs: IntType, rhs: IntType) IntType {
+    if (0 < rhs) return @mod(lhs, rhs);
+    const rem = @rem(lhs, rhs);
+    return if (0 < rem) rem + rhs else rem;
+}
+
+/// Does `op` to each element of `lhs` and `rhs` into `out`, stopping at the first element where
+/// either side isn't an int or the result would overflow, and returning how many were done.
+/// Whichever side `shape` says is broadcast only has one element; the other has as many as `out`.
+pub fn run(comptime op: Op, comptime shape: Shape, out: []Value, lhs: []const Value, rhs: []const Value) Error!usize {
+    var idx: usize = 0;
+
+    if (op == .add or op == .sub or op == .mul) {
+        while (idx + vector_len <= out.len) : (idx += vector_len) {
+            const l = load(lhs, idx, shape == .lhs_broadcast);
+            const r = load(rhs, idx, shape == .rhs_broadcast);
+            if (!@reduce(.And, (l & r & ones) == ones)) break;
+
+            const result, const overflow = switch (op) {
+                .add => @addWithOverflow(l, r - ones),
+                .sub => @subWithOverflow(l, r - ones),
+                .mul => @mulWithOverflow(l >> shift_one, r - ones),
+                else => unreachable,
+            };
+            // The scalar loop below finds which element it was.
+            if (@reduce(.Or, overflow) != 0) break;
+
+            const tagged = if (op == .mul) result | ones else result;
+            for (out[idx..][0..vector_len], 0..) |*value, lane| value.* = .{ ._data = tagged[lane] };
+        }
+    }
+
+    while (idx < out.len) : (idx += 1) {
+        const l = switch (lhs[if (shape == .lhs_broadcast) 0 else idx].classify()) {
+            .int => |int| int,
+            else => break,
+        };
+        const r = switch (rhs[if (shape == .rhs_broadcast) 0 else idx].classify()) {
+            .int => |int| int,
+            else => break,
+        };
+        out[idx] = Value.from(apply(op, l, r) catch |err| switch (err) {
+            error.IntOverflow => break,
+            else => |e| return e,
+        });
+    }
+
+    return idx;
+}
+
+inline fn load(values: []const Value, idx: usize, comptime broadcast: bool) Vector {
+    if (broadcast) return @splat(values[0]._data);
+
+    var vector: Vector = undefined;
+    inline for (0..vector_len) |lane| vector[lane] = values[idx + lane]._data;
+    return vector;
+}
+
+test "kernels keep order, broadcast, and stop at overflow" {
+    var lhs: [19]Value = undefined;
+    var out: [19]Value = undefined;
+    for (&lhs, 0..) |*value, i| value.* = Value.from(@as(IntType, @intCast(i)) - 5);
+
+    try std.testing.expectEqual(@as(usize, lhs.len), try run(.mul, .rhs_broadcast, &out, &lhs, &.{Value.from(-3)}));
+    for (out, 0..) |value, i| try std.testing.expectEqual((@as(IntType, @intCast(i)) - 5) * -3, try value.toInt());
+
+    try std.testing.expectEqual(@as(usize, lhs.len), try run(.sub, .both, &out, &lhs, &out));
+    for (out, 0..) |value, i| try std.testing.expectEqual((@as(IntType, @intCast(i)) - 5) * 4, try value.toInt());
+
+    // Only the elements up to the first positive one are done.
+    const max = Value.from(@as(IntType, std.math.maxInt(IntType)));
+    try std.testing.expectEqual(@as(usize, 6), try run(.add, .lhs_broadcast, &out, &.{max}, &lhs));
+    try std.testing.expectError(error.DivisionByZero, run(.div, .rhs_broadcast, &out, &lhs, &.{Value.from(0)}));
+}
+
+test "mod floors towards negative divisors" {
+    const lhs = [_]Value{ Value.from(7), Value.from(-7), Value.from(6), Value.from(-6) };
+    var out: [lhs.len]Value = undefined;
+
+    try std.testing.expectEqual(@as(usize, lhs.len), try run(.mod, .rhs_broadcast, &out, &lhs, &.{Value.from(-3)}));
+    for (out, [_]IntType{ -2, -1, 0, 0 }) |value, expected| try std.testing.expectEqual(expected, try value.toInt());
+
+    try std.testing.expectEqual(@as(usize, lhs.len), try run(.mod, .rhs_broadcast, &out, &lhs, &.{Value.from(3)}));
+    for (out, [_]IntType{ 1, 2, 0, 0 }) |value, expected| try std.testing.expectEqual(expected, try value.toInt());
+
+    try std.testing.expectEqual(@as(IntType, 0), try apply(.mod, std.math.minInt(IntType), -1));
+    try std.testing.expectEqual(@as(IntType, -1), try apply(.mod, std.math.maxInt(IntType), std.math.minInt(IntType)));
+}
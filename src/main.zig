@@ -3,18 +3,56 @@ const Labyrinth = @import("Labyrinth.zig");
 const Maze = @import("Maze.zig");
 const CommandLineArgs = @import("CommandLineArgs.zig");
 const Debugger = @import("Debugger.zig");
+const SlabAllocator = @import("SlabAllocator.zig");
+const MemStats = @import("MemStats.zig");
+const batch = @import("batch.zig");
+const replay = @import("replay.zig");
 const utils = @import("utils.zig");
 
 pub fn main() !u8 {
     var gpa = std.heap.GeneralPurposeAllocator(.{}){};
-    defer _ = gpa.deinit();
-    const alloc = gpa.allocator();
+    const status = run(gpa.allocator());
+    const check = gpa.deinit();
+    return leakStatus(check, try status);
+}
 
+fn run(alloc: std.mem.Allocator) !u8 {
     var args = try CommandLineArgs.init(alloc);
     defer args.deinit();
     try args.parse();
 
-    var labyrinth = try args.createLabyrinth();
+    if (args.replay) |trace_path| {
+        try replay.run(alloc, trace_path, .{ .fps = args.options.fps, .sleep_ms = args.options.sleep_ms, .seek = args.seek });
+        return 0;
+    }
+
+    if (args.batch) |jobs_path| {
+        var maze = try args.createMaze(alloc);
+        defer maze.deinit(alloc);
+        try batch.run(alloc, &maze, args.options, args.batchThreads(), jobs_path, args.batch_results);
+        return 0;
+    }
+
+    // When running multithreaded, the pool's workers free their jobs on their own threads.
+    var slab = SlabAllocator.init(alloc, .{ .thread_safe = 1 < args.options.threads });
+    const status = runLabyrinth(&args, alloc, &slab);
+    const check = slab.deinit();
+    return leakStatus(check, try status);
+}
+
+fn runLabyrinth(args: *CommandLineArgs, alloc: std.mem.Allocator, slab: *SlabAllocator) !u8 {
+    // With `--mem-stats`, everything the labyrinth allocates is counted on its way to the slabs.
+    var mem_stats = MemStats.init(switch (args.options.allocator) {
+        .gpa => alloc,
+        .slab => slab.allocator(),
+    });
+    defer mem_stats.deinit();
+    if (args.options.mem_stats_path != null) {
+        MemStats.active = &mem_stats;
+        MemStats.reportOnSignal();
+    }
+
+    var labyrinth = try args.createLabyrinth(if (MemStats.active != null) mem_stats.allocator() else mem_stats.child);
     defer labyrinth.deinit();
 
     // try labyrinth.printMaze(std.io.getStdOut().writer());
@@ -30,3 +68,29 @@ pub fn main() !u8 {
         return labyrinth.exit_status orelse 0;
     }
 }
+
+/// Makes a run that leaked fail, if it didn't already. The allocator's logged what leaked.
+fn leakStatus(check: std.heap.Check, status: u8) u8 {
+    if (check == .ok or status != 0) return status;
+    utils.eprintln("memory leaked", .{}) catch {};
+    return 1;
+}
+
+test {
+    _ = @import("Array.zig");
+    _ = @import("BigInt.zig");
+    _ = @import("checkpoint.zig");
+    _ = @import("kernels.zig");
+    _ = @import("Labyrinth.zig");
+    _ = @import("LiteralCache.zig");
+    _ = @import("Maze.zig");
+    _ = @import("MemStats.zig");
+    _ = @import("Minotaur.zig");
+    _ = @import("Profiler.zig");
+    _ = @import("replay.zig");
+    _ = @import("SlabAllocator.zig");
+    _ = @import("Stack.zig");
+    _ = @import("TimelineStore.zig");
+    _ = @import("TimerWheel.zig");
+    _ = @import("TraceCache.zig");
+}
@@ -0,0 +1,268 @@
+//! Plays back a trace recorded with `--record` (see `Recorder`) for `--replay`, drawing each
+//! generation with `Maze.printMaze` without running anything.
+//!
+//! Frames only have what changed since the one before, so seeking to a generation applies every
+//! frame up to it without drawing them. That only costs as much as reading the trace that far.
+
+const std = @import("std");
+const Allocator = std.mem.Allocator;
+const Recorder = @import("Recorder.zig");
+const Labyrinth = @import("Labyrinth.zig");
+const Minotaur = @import("Minotaur.zig");
+const Maze = @import("Maze.zig");
+const Coordinate = @import("Coordinate.zig");
+const Vector = @import("Vector.zig");
+const binary = @import("binary.zig");
+
+pub const Error = error{InvalidTrace};
+
+pub const Options = struct {
+    /// If set, how many generations are drawn a second.
+    fps: ?u32 = null,
+    /// When `fps` isn't set, how long to wait between generations.
+    sleep_ms: u32 = 20,
+    /// Generations before this one are played without being drawn.
+    seek: usize = 0,
+};
+
+/// Plays the trace at `path` to stdout.
+pub fn run(alloc: Allocator, path: []const u8, options: Options) !void {
+    const source = try Maze.Source.read(alloc, path);
+    defer source.deinit(alloc);
+
+    var player = try Player.init(alloc, source.bytes());
+    defer player.deinit(alloc);
+
+    var scratch = std.heap.ArenaAllocator.init(alloc);
+    defer scratch.deinit();
+
+    const interval = if (options.fps) |fps| std.time.ns_per_s / fps else @as(u64, options.sleep_ms) * std.time.ns_per_ms;
+    var last_frame: ?std.time.Instant = null;
+    var stdout = std.io.bufferedWriter(std.io.getStdOut().writer());
+
+    while (true) {
+        if (options.seek <= player.generation) {
+            if (last_frame) |last| {
+                const elapsed = (std.time.Instant.now() catch last).since(last);
+                if (elapsed < interval) std.time.sleep(interval - elapsed);
+            }
+            last_frame = std.time.Instant.now() catch null;
+
+            try player.draw(scratch.allocator(), stdout.writer());
+            try stdout.flush();
+            _ = scratch.reset(.retain_capacity);
+        }
+
+        if (!try player.next(alloc)) break;
+    }
+}
+
+/// The state of a recorded run, as of the last frame that was applied.
+pub const Player = struct {
+    reader: Reader,
+    maze: Maze,
+    generation: usize,
+    minotaurs: std.MultiArrayList(Recorder.State) = .{},
+    /// What was printed during the last frame.
+    output: std.ArrayListUnmanaged(u8) = .{},
+
+    /// Reads the header of `trace`, which has to outlive the player, as the maze points into it.
+    pub fn init(alloc: Allocator, trace: []const u8) (Error || Allocator.Error)!Player {
+        var reader = Reader{ .bytes = trace };
+        if (!std.mem.eql(u8, Recorder.magic, try reader.take(Recorder.magic.len))) return error.InvalidTrace;
+        if (try reader.int(u32) != Recorder.version) return error.InvalidTrace;
+        if (try reader.unsigned(usize) != Minotaur.positions_count) return error.InvalidTrace;
+
+        const generation = try reader.unsigned(usize);
+        const maze = try reader.maze(alloc);
+        return .{ .reader = reader, .maze = maze, .generation = generation };
+    }
+
+    pub fn deinit(player: *Player, alloc: Allocator) void {
+        player.maze.deinit(alloc);
+        player.minotaurs.deinit(alloc);
+        player.output.deinit(alloc);
+        player.* = undefined;
+    }
+
+    /// Applies the next frame, or returns false if there aren't any left.
+    pub fn next(player: *Player, alloc: Allocator) (Error || Allocator.Error)!bool {
+        const reader = &player.reader;
+        if (reader.pos == reader.bytes.len) return false;
+        player.generation += try reader.unsigned(usize);
+
+        const removed = try reader.unsignedCount();
+        if (removed != 0) {
+            // Compact the survivors down over the minotaurs that were removed.
+            var slice = player.minotaurs.slice();
+            var kept: usize = 0;
+            var alive: usize = 0;
+            for (0..removed) |_| {
+                const id = alive + try reader.unsigned(usize);
+                if (slice.len <= id) return error.InvalidTrace;
+                while (alive < id) : (alive += 1) {
+                    slice.set(kept, slice.get(alive));
+                    kept += 1;
+                }
+                alive = id + 1;
+            }
+            while (alive < slice.len) : (alive += 1) {
+                slice.set(kept, slice.get(alive));
+                kept += 1;
+            }
+            player.minotaurs.shrinkRetainingCapacity(kept);
+        }
+
+        const positions = player.minotaurs.items(.positions);
+        const velocities = player.minotaurs.items(.velocity);
+        const colours = player.minotaurs.items(.colour);
+        const changed_count = try reader.unsignedCount();
+        var after: usize = 0;
+        for (0..changed_count) |_| {
+            const id = after + try reader.unsigned(usize);
+            if (positions.len <= id) return error.InvalidTrace;
+            after = id + 1;
+
+            const changed: Recorder.Changed = @bitCast(try reader.byte());
+            if (changed.head) {
+                const head = positions[id][0];
+                positions[id] = Recorder.follow(positions[id], .{
+                    .x = try reader.offset(head.x),
+                    .y = try reader.offset(head.y),
+                });
+            }
+            if (changed.trail) positions[id] = try reader.trail();
+            if (changed.velocity) velocities[id] = try reader.vector();
+            if (changed.colour) colours[id] = try reader.byte();
+        }
+
+        // New minotaurs come in order of where they go, so each one's in front of the next.
+        const spawned = try reader.unsignedCount();
+        try player.minotaurs.ensureUnusedCapacity(alloc, spawned);
+        after = 0;
+        for (0..spawned) |_| {
+            const id = after + try reader.unsigned(usize);
+            if (player.minotaurs.len < id) return error.InvalidTrace;
+            after = id + 1;
+            player.minotaurs.insertAssumeCapacity(id, .{
+                .positions = try reader.trail(),
+                .velocity = try reader.vector(),
+                .colour = try reader.byte(),
+            });
+        }
+
+        const writes = try reader.unsignedCount();
+        for (0..writes) |_| {
+            const pos = try reader.coordinate();
+            try player.maze.set(alloc, pos, try reader.byte());
+        }
+
+        player.output.clearRetainingCapacity();
+        const output = try reader.take(try reader.unsignedCount());
+        try player.output.appendSlice(alloc, output);
+        return true;
+    }
+
+    /// Clears the terminal, and draws the maze and minotaurs, followed by what was printed.
+    pub fn draw(player: *const Player, scratch: Allocator, writer: anytype) !void {
+        try writer.print("\x1B[1;1H\x1B[2Jtick {d}\n", .{player.generation});
+        try player.maze.printMaze(.{
+            .scratch = scratch,
+            .positions = player.minotaurs.items(.positions),
+            .colours = player.minotaurs.items(.colour),
+        }, writer);
+        try writer.writeAll(player.output.items);
+    }
+};
+
+const Reader = struct {
+    bytes: []const u8,
+    pos: usize = 0,
+
+    usingnamespace binary.Reading(Reader, error.InvalidTrace);
+
+    /// Reads a difference from `from`.
+    fn offset(reader: *Reader, from: Coordinate.CoordInt) Error!Coordinate.CoordInt {
+        return std.math.cast(Coordinate.CoordInt, @as(i64, from) + try reader.signed(i64)) orelse error.InvalidTrace;
+    }
+
+    fn coordinate(reader: *Reader) Error!Coordinate {
+        return .{ .x = try reader.unsigned(Coordinate.CoordInt), .y = try reader.unsigned(Coordinate.CoordInt) };
+    }
+
+    fn trail(reader: *Reader) Error!Recorder.Trail {
+        var result: Recorder.Trail = undefined;
+        for (&result) |*pos| pos.* = try reader.coordinate();
+        return result;
+    }
+
+    fn vector(reader: *Reader) Error!Vector {
+        return .{ .x = try reader.signed(Vector.VecInt), .y = try reader.signed(Vector.VecInt) };
+    }
+};
+
+test "frames play back to the minotaurs and maze they were recorded from" {
+    const alloc = std.testing.allocator;
+    var maze = try Maze.init(alloc, "test", "abc\ndef");
+    defer maze.deinit(alloc);
+    try maze.set(alloc, .{ .x = 200, .y = 1 }, 'Z');
+
+    var minotaurs = Labyrinth.MinotaurList{};
+    defer {
+        for (0..minotaurs.len) |id| {
+            var minotaur = minotaurs.get(id);
+            minotaur.deinit();
+        }
+        minotaurs.deinit(alloc);
+    }
+    for (0..3) |colour| {
+        var minotaur = try Minotaur.initCapacity(alloc, 1);
+        minotaur.colour = @intCast(colour);
+        try minotaurs.append(alloc, minotaur);
+    }
+
+    var recorder = try Recorder.init(alloc, null, &maze, 0, minotaurs.len);
+    defer recorder.deinit(alloc);
+    try recorder.frame(alloc, 0, minotaurs.slice(), "");
+
+    // The first minotaur takes a step, the second is slain, and a new one's spawned.
+    const positions = minotaurs.items(.positions);
+    positions[0] = Recorder.follow(positions[0], .{ .x = 1 });
+    var slain = minotaurs.get(1);
+    slain.deinit();
+    minotaurs.orderedRemove(1);
+    recorder.removed(&.{1});
+
+    var child = try Minotaur.initCapacity(alloc, 1);
+    child.velocity = Vector.Down;
+    child.positions[0] = .{ .y = 1 };
+    try minotaurs.append(alloc, child);
+    try recorder.spawned(alloc, 1);
+    try recorder.wrote(alloc, .{ .x = 2, .y = 1 }, 'X');
+    try recorder.frame(alloc, 3, minotaurs.slice(), "");
+
+    // A copy split off the first minotaur goes right after it, and the one in front of it moves.
+    var copy = try Minotaur.initCapacity(alloc, 1);
+    copy.colour = 7;
+    try minotaurs.insert(alloc, 1, copy);
+    try recorder.inserted(alloc, &.{1});
+    const moved = minotaurs.items(.positions);
+    moved[0] = Recorder.follow(moved[0], .{ .x = 2 });
+    try recorder.frame(alloc, 4, minotaurs.slice(), "hi");
+
+    var player = try Player.init(alloc, recorder.buffer.items);
+    defer player.deinit(alloc);
+    try std.testing.expect(try player.next(alloc));
+    try std.testing.expectEqual(@as(usize, 3), player.minotaurs.len);
+    try std.testing.expect(try player.next(alloc));
+    try std.testing.expect(try player.next(alloc));
+    try std.testing.expect(!try player.next(alloc));
+
+    try std.testing.expectEqual(@as(usize, 4), player.generation);
+    try std.testing.expectEqualDeep(minotaurs.items(.positions), player.minotaurs.items(.positions));
+    try std.testing.expectEqualDeep(minotaurs.items(.velocity), player.minotaurs.items(.velocity));
+    try std.testing.expectEqualSlices(u8, minotaurs.items(.colour), player.minotaurs.items(.colour));
+    try std.testing.expectEqualStrings("hi", player.output.items);
+    try std.testing.expectEqual(@as(?u8, 'X'), player.maze.get(.{ .x = 2, .y = 1 }));
+    try std.testing.expectEqual(@as(?u8, 'Z'), player.maze.get(.{ .x = 200, .y = 1 }));
+}
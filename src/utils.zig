@@ -22,23 +22,19 @@ pub const FmtEnum = enum {
     }
 };
 
-pub fn clearScreen(writer: anytype) std.os.WriteError!void {
-    try writer.writeAll("\x1B[1;1H\x1B[2J");
-}
-
 pub inline fn safeIndex(slice: anytype, idx: anytype) ?@TypeOf(slice[0]) {
     return if (idx < slice.len) slice[idx] else null;
 }
 
-pub fn println(comptime fmt: []const u8, args: anytype) std.os.WriteError!void {
+pub fn println(comptime fmt: []const u8, args: anytype) std.posix.WriteError!void {
     return print(fmt ++ "\n", args);
 }
 
-pub fn print(comptime fmt: []const u8, args: anytype) std.os.WriteError!void {
+pub fn print(comptime fmt: []const u8, args: anytype) std.posix.WriteError!void {
     return std.io.getStdOut().writer().print(fmt, args);
 }
 
-pub fn eprintln(comptime fmt: []const u8, args: anytype) std.os.WriteError!void {
+pub fn eprintln(comptime fmt: []const u8, args: anytype) std.posix.WriteError!void {
     return std.io.getStdErr().writer().print(fmt ++ "\n", args);
 }
 
@@ -46,7 +42,10 @@ pub fn readLine(alloc: std.mem.Allocator, cap: usize) !?[]u8 {
     return try std.io.getStdIn().reader().readUntilDelimiterOrEofAlloc(alloc, '\n', cap);
 }
 
+/// Reads all of the file at `path`, or stdin if it's `-`.
 pub fn readFile(alloc: Allocator, path: []const u8) ![]u8 {
+    if (std.mem.eql(u8, path, "-")) return std.io.getStdIn().reader().readAllAlloc(alloc, std.math.maxInt(usize));
+
     var file = try std.fs.cwd().openFile(path, .{});
     defer file.close();
     return file.reader().readAllAlloc(alloc, std.math.maxInt(usize));